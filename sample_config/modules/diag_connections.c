@@ -16,7 +16,7 @@ static void on_net_thread_diagnostics() {
   nxweb_http_server_connection* conn;
   for (conn=nxp_iterate_allocated_objects(tdata->free_conn_pool, &itr); conn; conn=nxp_iterate_allocated_objects(0, &itr)) {
     nxweb_log_error("[diag] conn %p %ds %s [%d] parent=%p state=%d %s", conn, (int)((current_time-conn->connected_time)/1000000),
-        conn->remote_addr, conn->hsp.request_count, conn->parent, (int)conn->hsp.state, conn->hsp.req.uri);
+        conn->remote_addr, conn->hsp.request_count, conn->parent, (int)conn->hsp.state, conn->hsp.rq? conn->hsp.rq->req.uri : "-");
   }
 
   // nxweb_log_error("net thread diagnostics end");
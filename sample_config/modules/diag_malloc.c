@@ -167,16 +167,19 @@ static void* fill_meminfo(nx_meminfo* mi, size_t size, char fn, void* caller) {
     if (w) {
       int i;
       mi->worker=1;
+      nxw_factory* f=w->job? w->job->factory : w->factory; // job could be stolen from other net thread
       for (i=0; i<_nxweb_num_net_threads; i++) {
-        if (w->factory==&_nxweb_net_threads[i].workers_factory) {
+        if (f==&_nxweb_net_threads[i].workers_factory) {
           tdata=&_nxweb_net_threads[i];
           break;
         }
       }
-      conn=w->job_param;
-      mi->conn_uid=conn->uid;
-      mi->req_uid=conn->hsp.req.uid;
-      strncpy(mi->req_uri, conn->hsp.req.uri, sizeof(mi->req_uri)-1);
+      if (w->job) {
+        conn=w->job->job_param;
+        mi->conn_uid=conn->uid;
+        mi->req_uid=conn->hsp.rq->req.uid;
+        strncpy(mi->req_uri, conn->hsp.rq->req.uri, sizeof(mi->req_uri)-1);
+      }
     }
   }
   if (tdata) {
@@ -81,6 +81,8 @@ typedef struct nxweb_filter {
   void (*finalize)(struct nxweb_filter* fparam, struct nxweb_http_server_connection* conn, nxweb_http_request* req, nxweb_http_response* resp, nxweb_filter_data* fdata);
   struct nxweb_filter* next_defined;
   struct nxweb_filter* (*config)(struct nxweb_filter* base, const struct nx_json* json);
+  unsigned splice_passthrough:1; // content stream inserted by do_filter() accepts NXEF_PIPE writes
+  unsigned needs_identity:1; // do_filter() parses response body, so upstream must not send it compressed
 } nxweb_filter;
 
 struct fc_filter_data* _nxweb_fc_create(nxb_buffer* nxb, const char* cache_dir);
@@ -106,11 +108,18 @@ typedef struct nxweb_handler {
   const char* charset;
   const char* index_file;
   nxe_ssize_t size;
+  nxe_ssize_t proxy_buffer_size; // memory limit for proxy_buffering & proxy_spool_request
+  int proxy_hedge_delay; // ms; 0 = backend response time p95
+  int memcache_ttl; // ms; 0 = nxweb_server_config.memcache.ttl
   _Bool memcache:1;
   _Bool proxy_copy_host:1;
+  _Bool proxy_buffering:1; // read whole backend response before handing it to client; spill to temp file in dir
+  _Bool proxy_spool_request:1; // receive whole request body (up to size) before connecting to backend
+  _Bool proxy_hedge:1; // repeat GET to another server if first one has not responded within proxy_hedge_delay
   _Bool secure_only:1;
   _Bool insecure_only:1;
   int idx;
+  int worker_class; // for NXWEB_INWORKER handlers; index in nxweb_server_config.worker_class_config
 
   struct nxweb_handler* next; // next in routing list
   nxweb_filter* filters[NXWEB_MAX_FILTERS];
@@ -165,7 +174,11 @@ typedef struct __attribute__ ((aligned(64))) nxweb_net_thread_data {
   nxe_subscriber gc_sub;
   nxw_factory workers_factory;
   nxp_pool* free_conn_pool;
+#ifdef WITH_SSL
+  nxp_pool* free_ssl_conn_pool;
+#endif
   nxp_pool* free_conn_nxb_pool;
+  nxp_pool* free_conn_rq_pool;
   nxp_pool* free_rbuf_pool;
 
   char* access_log_block;
@@ -176,19 +189,21 @@ typedef struct __attribute__ ((aligned(64))) nxweb_net_thread_data {
 
   nxe_eventfd_source diagnostics_efs;
   nxe_subscriber diagnostics_sub;
+
+  // admission control
+  int in_flight; // requests admitted and not yet complete
+  nxe_time_t loop_lag; // smoothed event loop lag (usec)
+  nxe_time_t lag_check_time; // when lag_timer is due
+  nxe_timer lag_timer;
+  unsigned long requests_shed;
+  _Bool accept_paused:1;
 } nxweb_net_thread_data;
 
 typedef struct nxweb_http_server_connection {
   nxd_http_server_proto hsp;
-#ifdef WITH_SSL
-  nxd_ssl_socket sock; // could be either socket or ssl_socket (ssl_socket struct is larger)
-#else
-  nxd_socket sock;
-#endif // WITH_SSL
   nxe_subscriber events_sub;
-  nxe_subscriber worker_complete;
-  volatile int worker_job_done;
-  char remote_addr[16]; // 255.255.255.255
+  nxw_job worker_job;
+  char remote_addr[46]; // INET6_ADDRSTRLEN; forwarded address might be ipv6
   nxweb_handler* handler;
   nxe_data handler_param;
   nxweb_net_thread_data* tdata;
@@ -198,6 +213,7 @@ typedef struct nxweb_http_server_connection {
   _Bool subrequest_failed:1;
   _Bool in_worker:1;
   _Bool connection_closing:1;
+  _Bool admitted:1; // counted in tdata->in_flight
   uint64_t uid; // unique connection id
   nxe_time_t connected_time;
   struct nxweb_http_server_connection* parent;
@@ -205,17 +221,50 @@ typedef struct nxweb_http_server_connection {
   struct nxweb_http_server_connection* next;
   void (*on_response_ready)(struct nxweb_http_server_connection* conn, nxe_data data);
   nxe_data on_response_ready_data;
-  nxd_ibuffer ib;
+  // socket must be the last member: plain connections are allocated without ssl_sock tail
+#ifdef WITH_SSL
+  union {
+    nxd_socket sock;
+    nxd_ssl_socket ssl_sock; // secure connections only (ssl_socket struct is larger)
+  };
+#else
+  nxd_socket sock;
+#endif // WITH_SSL
 } nxweb_http_server_connection;
 
-typedef struct nxweb_http_proxy_pool_config {
-  const char* host;
-  struct addrinfo* saddr;
-} nxweb_http_proxy_pool_config;
+#define NXWEB_PLAIN_CONNECTION_SIZE (offsetof(nxweb_http_server_connection, sock)+sizeof(nxd_socket))
+
+typedef nxd_http_proxy_pool_config nxweb_http_proxy_pool_config;
+
+typedef struct nxweb_worker_class_config {
+  const char* name;
+  int max_concurrency; // per net thread; 0 = unlimited
+  int max_queue; // per net thread; requests beyond that get 503
+  nxe_time_t queue_timeout; // usec; requests waiting longer than that get 503
+} nxweb_worker_class_config;
+
+typedef struct nxweb_admission_config {
+  // all limits are per net thread; zero disables the check
+  int max_in_flight; // requests being processed
+  int max_worker_queue; // in-worker requests waiting for worker
+  nxe_time_t max_loop_lag; // usec
+  int fd_reserve; // stop accepting when that close to RLIMIT_NOFILE
+} nxweb_admission_config;
+
+typedef struct nxweb_memcache_config {
+  size_t size; // bytes; split evenly between NXWEB_MEMCACHE_SHARDS
+  size_t max_item_size; // larger files are not cached
+  nxe_time_t ttl; // usec; for handlers without own memcache_ttl
+} nxweb_memcache_config;
 
 typedef struct nxweb_server_listen_config {
   int listen_fd;
+  int thread_fd[NXWEB_MAX_NET_THREADS]; // per net thread sockets if reuseport; thread_fd[0]==listen_fd
   _Bool secure:1;
+  _Bool reuseport:1;
+  _Bool cpu_steering:1;
+  _Bool unix_socket:1;
+  const char* forwarded_header; // unix socket: take remote_addr from this request header (last address)
 #ifdef WITH_SSL
   gnutls_certificate_credentials_t x509_cred;
   gnutls_priority_t priority_cache;
@@ -228,6 +277,11 @@ struct nxweb_server_config {
   int listen_config_idx;
   nxweb_server_listen_config listen_config[NXWEB_MAX_LISTEN_SOCKETS];
   nxweb_http_proxy_pool_config http_proxy_pool_config[NXWEB_MAX_PROXY_POOLS];
+  nxweb_worker_class_config worker_class_config[NXWEB_MAX_WORKER_CLASSES];
+  nxweb_admission_config admission;
+  nxweb_memcache_config memcache;
+  int max_fd; // RLIMIT_NOFILE
+  int workers_per_thread; // size of fixed worker pool of each net thread
   nxweb_handler_callback request_dispatcher;
   nxweb_handler* handler_list;
   nxweb_handler* handlers_defined;
@@ -342,6 +396,18 @@ static inline uint64_t nxweb_generate_unique_id() {
 nxweb_result nxweb_cache_try(nxweb_http_server_connection* conn, nxweb_http_response* resp, const char* key, time_t if_modified_since, time_t revalidated_mtime);
 nxweb_result nxweb_cache_store_response(nxweb_http_server_connection* conn, nxweb_http_response* resp);
 
+typedef struct nxweb_cache_stats {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t admitted; // moved from admission window to main area
+  uint64_t rejected; // dropped from window by TinyLFU filter
+  uint64_t evicted; // removed from main area to make room for more frequent record
+  size_t size; // bytes
+  int items;
+} nxweb_cache_stats;
+
+void nxweb_cache_get_stats(nxweb_cache_stats* stats);
+
 #ifdef	__cplusplus
 }
 #endif
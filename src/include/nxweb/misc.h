@@ -99,7 +99,11 @@ void _nxweb_batch_write_end(int fd);
 void _nxweb_close_good_socket(int fd);
 void _nxweb_close_bad_socket(int fd);
 int _nxweb_bind_socket(const char *host_and_port, int backlog);
-struct addrinfo* _nxweb_resolve_host(const char *host_and_port, int passive); // passive for bind(); active for connect()
+int _nxweb_bind_socket_ex(const char *host_and_port, int backlog, _Bool reuseport);
+int _nxweb_set_unix_socket_perms(const char* host_and_port, int mode, uid_t uid, gid_t gid);
+int _nxweb_set_incoming_cpu(int fd, int cpu);
+int _nxweb_attach_cpu_steering(int fd, int group_size); // fd must be bound; applies to its whole reuseport group
+struct addrinfo* _nxweb_resolve_host(const char *host_and_port, int passive); // passive for bind(); active for connect(); also accepts unix:/path and unix:@abstract
 void _nxweb_free_addrinfo(struct addrinfo* ai);
 void _nxweb_sleep_us(int us);
 
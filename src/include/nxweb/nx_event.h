@@ -31,11 +31,15 @@ extern "C" {
 #include <stddef.h>
 #include <time.h>
 #include <sys/epoll.h>
+#include <sys/socket.h>
 //#include <sys/eventfd.h>
 
 #include "nx_pool.h"
 
 #define NXE_NUMBER_OF_TIMER_QUEUES 8
+#define NXE_TIMER_WHEEL_LEVELS 4
+#define NXE_TIMER_WHEEL_BITS 6 // 64 slots per level; 1ms resolution; 2^24 ms (4.6 hours) max
+#define NXE_TIMER_WHEEL_SIZE (1<<NXE_TIMER_WHEEL_BITS)
 #define NXE_FREE_EVENT_POOL_INITIAL_SIZE 16
 
 /*
@@ -81,7 +85,9 @@ enum nxe_error_code {
 };
 
 enum nxe_flags {
-  NXEF_EOF=0x1
+  NXEF_EOF=0x1,
+  NXEF_MORE=0x2, // more data follows immediately; socket may hold partial frame (MSG_MORE)
+  NXEF_PIPE=0x4  // write(): fd is a pipe; data gets spliced out of it (ptr unused)
 };
 
 typedef union nxe_data {
@@ -167,6 +173,8 @@ typedef struct nxe_istream_class {
   nxe_interface_base_class super;
   void (*do_write)(struct nxe_istream* is, struct nxe_ostream* os);
   nxe_size_t (*read)(struct nxe_istream* is, struct nxe_ostream* os, void* ptr, nxe_size_t size, nxe_flags_t* flags);
+  // optional; same as read() but moves data into pipe_fd with splice() instead of copying it to memory
+  nxe_ssize_t (*splice)(struct nxe_istream* is, struct nxe_ostream* os, int pipe_fd, nxe_size_t size, nxe_flags_t* flags);
 } nxe_istream_class;
 
 typedef struct nxe_istream {
@@ -183,6 +191,9 @@ typedef struct nxe_ostream_class {
   nxe_interface_base_class super;
   void (*do_read)(struct nxe_ostream* os, struct nxe_istream* is);
   nxe_ssize_t (*write)(struct nxe_ostream* os, struct nxe_istream* is, int fd, struct nx_file_reader* fr, nxe_data ptr, nxe_size_t size, nxe_flags_t* flags); // fd & fr are 0 for memory ptr
+  // optional; same as write() but sends prefix (eg. headers) in front of data in one go;
+  // returns total bytes sent including prefix
+  nxe_ssize_t (*write_prefixed)(struct nxe_ostream* os, struct nxe_istream* is, const void* prefix, nxe_size_t prefix_size, int fd, struct nx_file_reader* fr, nxe_data ptr, nxe_size_t size, nxe_flags_t* flags);
   void (*shutdown)(struct nxe_ostream* os);
 } nxe_ostream_class;
 
@@ -229,8 +240,9 @@ typedef struct nxe_timer_class {
 typedef struct nxe_timer {
   nxe_interface_base super;
   nxe_time_t abs_time;
+  nxe_time_t wheel_tick; // the tick (msec) timer has been hashed to; timer gets examined not later than that
   nxe_data data;
-  struct nxe_timer* next;
+  struct nxe_timer* next; // circular list of wheel slot; null if timer is not set
   struct nxe_timer* prev;
   //struct nxe_event evt; // embedded event
 } nxe_timer;
@@ -252,6 +264,7 @@ extern const nxe_event_source_class* const NXE_ES_LFD;
 typedef struct nxe_fd_source {
   const nxe_event_source_class* cls;
   int fd;
+  _Bool uring_io; // plain socket; recv/send through io_uring if loop supports that (cleared on registration otherwise)
   nxe_istream data_is;
   nxe_ostream data_os;
   nxe_publisher data_error;
@@ -266,14 +279,18 @@ typedef struct nxe_eventfd_source {
 typedef struct nxe_listenfd_source {
   const nxe_event_source_class* cls;
   int fd;
+  _Bool uring_accept; // set on registration if connections are accepted through io_uring; take them with nxe_accept()
   nxe_publisher data_notify;
 } nxe_listenfd_source;
 
-typedef struct nxe_timer_queue {
-  nxe_time_t timeout;
-  nxe_timer* timer_first;
-  nxe_timer* timer_last;
-} nxe_timer_queue;
+enum nxe_backend {
+  NXE_BACKEND_EPOLL=0,
+  NXE_BACKEND_IO_URING=1 // requires nxweb compiled with io_uring support; falls back to epoll if unavailable
+};
+
+extern enum nxe_backend nxe_default_backend; // used by nxe_create(); set before creating loops
+
+struct nxe_uring;
 
 typedef struct nxe_loop {
   nxe_time_t current_time;
@@ -286,6 +303,7 @@ typedef struct nxe_loop {
   int ref_count;
 
   int epoll_fd;
+  struct nxe_uring* uring; // non-null if io_uring backend is used instead of epoll
 
   int batch_write_fd;
 
@@ -295,7 +313,10 @@ typedef struct nxe_loop {
 
   nxe_event* first;
   nxe_event* last;
-  nxe_timer_queue timers[NXE_NUMBER_OF_TIMER_QUEUES];
+  nxe_time_t timer_timeouts[NXE_NUMBER_OF_TIMER_QUEUES];
+  nxe_time_t timer_wheel_tick; // last processed tick (msec)
+  int num_timers;
+  nxe_timer timer_wheel[NXE_TIMER_WHEEL_LEVELS][NXE_TIMER_WHEEL_SIZE]; // slot list heads
 
   nxe_publisher gc_pub; // subscribe for gc events
 
@@ -332,6 +353,7 @@ void nxe_trigger_eventfd(nxe_eventfd_source* efs); // wake up from other thread
 
 void nxe_register_listenfd_source(nxe_loop* loop, nxe_listenfd_source* lfs); // registers with epoll
 void nxe_unregister_listenfd_source(nxe_listenfd_source* lfs); // unregisters with epoll
+int nxe_accept(nxe_listenfd_source* lfs, struct sockaddr* addr, socklen_t* addrlen); // accept4(SOCK_NONBLOCK) on registered listener
 
 void nxe_register_fd_source(nxe_loop* loop, nxe_fd_source* fs); // registers with epoll
 void nxe_unregister_fd_source(nxe_fd_source* fs); // unregister from epoll
@@ -341,7 +363,8 @@ void nxe_disconnect_streams(nxe_istream* is, nxe_ostream* os);
 void nxe_schedule_callback(nxe_loop* loop, void (*func)(nxe_data data), nxe_data data); // creates new nxe_event
 
 void nxe_set_timer_queue_timeout(nxe_loop* loop, int queue_idx, nxe_time_t usec_interval);
-void nxe_set_timer(nxe_loop* loop, int queue_idx, nxe_timer* timer);
+void nxe_set_timer(nxe_loop* loop, int queue_idx, nxe_timer* timer); // (re)arms timer with queue's timeout
+void nxe_set_timer_usec(nxe_loop* loop, nxe_timer* timer, nxe_time_t usec_interval); // (re)arms timer with arbitrary timeout
 void nxe_unset_timer(nxe_loop* loop, int queue_idx, nxe_timer* timer);
 
 time_t nxe_get_current_http_time(nxe_loop* loop);
@@ -360,6 +383,23 @@ static inline nxe_time_t nxe_get_time_usec() {
 
 void nxe_link(nxe_loop* loop, nxe_event* evt); // internal use only
 
+// io_uring backend; internal use only
+int _nxe_uring_create(nxe_loop* loop);
+void _nxe_uring_destroy(nxe_loop* loop);
+int _nxe_uring_add(nxe_loop* loop, int fd, uint32_t events, void* ptr);
+int _nxe_uring_del(nxe_loop* loop, int fd);
+int _nxe_uring_wait(nxe_loop* loop, int timeout_ms); // fills loop->epoll_events like epoll_wait()
+// socket I/O through io_uring (see nxe_fd_source.uring_io); these mimic recv(), splice(), send() and shutdown()
+int _nxe_uring_add_socket(nxe_loop* loop, int fd, uint32_t events, void* ptr); // ENOTSUP => use _nxe_uring_add()
+nxe_ssize_t _nxe_uring_recv(nxe_loop* loop, int fd, void* ptr, nxe_size_t size);
+nxe_ssize_t _nxe_uring_recv_splice(nxe_loop* loop, int fd, int pipe_fd, nxe_size_t size);
+nxe_ssize_t _nxe_uring_send(nxe_loop* loop, int fd, const void* ptr, nxe_size_t size); // copies data to send buffer
+int _nxe_uring_send_flush(nxe_loop* loop, int fd, int more); // sends buffered data right now; -1/EAGAIN if some is left
+int _nxe_uring_add_listener(nxe_loop* loop, int fd, uint32_t events, void* ptr); // ENOTSUP => use _nxe_uring_add()
+int _nxe_uring_accept(nxe_loop* loop, int fd, struct sockaddr* addr, socklen_t* addrlen); // mimics accept4(SOCK_NONBLOCK)
+void _nxe_uring_shutdown(nxe_loop* loop, int fd); // SHUT_WR once buffered data is sent
+void _nxe_uring_close_socket(nxe_loop* loop, int fd, int good); // closes once buffered data is sent
+
 static inline void nxe_istream_set_ready(nxe_loop* loop, nxe_istream* is) {
   if (is->ready) return;
   is->ready=1;
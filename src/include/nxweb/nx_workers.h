@@ -24,45 +24,74 @@
 extern "C" {
 #endif
 
-#include "nx_queue_tpl.h"
+#define NXWEB_WORKERS_PER_FACTORY 16 // default size of fixed pool of long-lived workers per net thread
+#define NXWEB_MAX_WORKERS_PER_FACTORY 1024
+#define NXWEB_MAX_QUEUED_JOBS 1024 // per factory; must be power of 2
+#define NXWEB_MAX_WORKER_FACTORIES 64
+#define NXWEB_MAX_WORKER_CLASSES 8 // class 0 is default (unlimited)
 
-#define NXWEB_MAX_WORKERS 512
-#define NXWEB_MAX_IDLE_WORKERS_IN_QUEUE 16
-#define NXWEB_MAX_WORKERS_IN_QUEUE 128
-#define NXWEB_START_WORKERS_IN_QUEUE 0
+typedef struct nxw_job {
+  void (*do_job)(void* job_param); // executed in worker thread
+  void (*on_complete)(struct nxw_job* job); // executed in factory (net) thread after do_job()
+  void* job_param;
+  int job_class; // index in factory's classes
+  _Bool expired:1; // set if job has been dropped from class queue without being executed
+  nxe_time_t queued_time;
+  struct nxw_factory* factory; // factory job has been submitted to; set by nxw_submit_job()
+  struct nxw_job* next; // completion queue link; class queue link while waiting
+} nxw_job;
+
+typedef struct nxw_job_class {
+  // limits are per factory (net thread)
+  int max_running; // 0 = unlimited
+  int max_queued;
+  nxe_time_t queue_timeout; // usec; 0 = wait forever
+  int running;
+  int queued;
+  nxw_job* queue_head;
+  nxw_job* queue_tail;
+  nxe_timer expire_timer;
+} nxw_job_class;
 
 typedef struct nxw_worker {
   struct nxw_factory* factory;
   pthread_t tid;
-  pthread_cond_t start_cond;
-  pthread_mutex_t start_mux;
-  nxe_eventfd_source complete_efs;
-  struct nxw_worker* prev;
-  struct nxw_worker* next;
-  volatile _Bool shutdown_in_progress;
-  volatile _Bool dead;
-  // job spec:
-  void (*do_job)(void* job_param);
-  void* job_param;
-  volatile int* job_done;
+  nxw_job* volatile job; // job currently being executed
 } nxw_worker;
 
-NX_QUEUE_DECLARE(workers, nxw_worker*, NXWEB_MAX_WORKERS_IN_QUEUE)
+typedef struct nxw_job_queue {
+  // bounded lock-free queue: single producer (factory thread) pushes at tail,
+  // multiple consumers (own workers and thieves from other factories) pop at head
+  volatile unsigned head;
+  volatile unsigned tail;
+  nxw_job* volatile jobs[NXWEB_MAX_QUEUED_JOBS];
+} nxw_job_queue;
 
 typedef struct nxw_factory {
   volatile _Bool shutdown_in_progress;
+  int index; // in global factory list (for stealing)
   int worker_count;
   nxe_loop* loop;
-  pthread_mutex_t queue_mux;
-  nx_queue_workers queue;
-  nxw_worker* list;
+  nxw_worker* workers;
+  nxw_job_queue queue;
+  nxw_job_class classes[NXWEB_MAX_WORKER_CLASSES]; // accessed by factory thread only
+  int in_flight; // jobs started and not yet completed (including stolen ones); factory thread only
+  // idle workers sleep on this condition
+  pthread_mutex_t idle_mux;
+  pthread_cond_t idle_cond;
+  volatile int idle_count;
+  // completed jobs: lock-free multi-producer stack drained by factory thread;
+  // eventfd is only triggered when the stack goes from empty to non-empty
+  nxw_job* volatile complete_head;
+  nxe_eventfd_source complete_efs;
+  nxe_subscriber complete_sub;
 } nxw_factory;
 
-void nxw_init_factory(nxw_factory* f, nxe_loop* loop);
+void nxw_init_factory(nxw_factory* f, nxe_loop* loop, int num_workers);
 void nxw_finalize_factory(nxw_factory* f);
-void nxw_gc_factory(nxw_factory* f);
-nxw_worker* nxw_get_worker(nxw_factory* f);
-void nxw_start_worker(nxw_worker* w, void (*job_func)(void* job_param), void* job_param, volatile int* job_done);
+void nxw_setup_job_class(nxw_factory* f, int idx, int max_running, int max_queued, nxe_time_t queue_timeout);
+int nxw_submit_job(nxw_factory* f, nxw_job* job); // returns -1 if job queue (or job class queue) is full
+int nxw_queue_depth(nxw_factory* f); // number of jobs submitted but not yet started
 
 #ifdef	__cplusplus
 }
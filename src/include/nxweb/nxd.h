@@ -38,7 +38,6 @@ typedef struct nxd_socket_class {
 typedef struct nxd_socket {
   const nxd_socket_class* cls;
   nxe_fd_source fs;
-  nx_file_reader fr;
 } nxd_socket;
 
 void nxd_socket_init(nxd_socket* ss);
@@ -148,6 +147,55 @@ void nxd_rbuffer_read(nxd_rbuffer* rb, int size);
 void nxd_rbuffer_write(nxd_rbuffer* rb, int size);
 
 
+// pipe buffer: moves data between file descriptors with splice(), never copying it to user space;
+// source istream must implement splice(), sink ostream must accept NXEF_PIPE writes
+#define NXD_PBUFFER_CHUNK_SIZE 65536 // default pipe capacity
+
+typedef struct nxd_pbuffer {
+  nxe_istream data_out;
+  nxe_ostream data_in;
+  int pipe_fd[2];
+  nxe_size_t size; // bytes sitting in the pipe
+  _Bool eof:1;
+} nxd_pbuffer;
+
+int nxd_pbuffer_init(nxd_pbuffer* pb);
+void nxd_pbuffer_finalize(nxd_pbuffer* pb);
+
+
+// spool buffer: accepts data as fast as source produces it, keeping up to max_mem_size bytes in memory;
+// the rest goes to temp file in spill_dir; without spill_dir the source is throttled instead
+#define NXD_SBUFFER_BLOCK_SIZE 16384
+
+typedef struct nxd_sbuffer_block {
+  struct nxd_sbuffer_block* next;
+  nxe_size_t size; // bytes written into data
+  char data[NXD_SBUFFER_BLOCK_SIZE];
+} nxd_sbuffer_block;
+
+typedef struct nxd_sbuffer {
+  nxe_istream data_out;
+  nxe_ostream data_in;
+  nxd_sbuffer_block* head; // read from here
+  nxd_sbuffer_block* tail; // write here
+  nxe_size_t read_pos; // in head block
+  nxe_size_t mem_size; // bytes allocated in blocks
+  nxe_size_t max_mem_size;
+  const char* spill_dir;
+  int fd; // temp file; -1 until spilled
+  int error; // errno of temp file write or EFBIG; once set the rest of data is swallowed
+  nxe_size_t max_size; // 0 = unlimited
+  off_t file_offset; // read position in temp file
+  off_t file_size;
+  nx_file_reader fr;
+  nxe_size_t size; // total bytes received via data_in
+  _Bool eof:1;
+} nxd_sbuffer;
+
+void nxd_sbuffer_init(nxd_sbuffer* sb, nxe_size_t max_mem_size, const char* spill_dir);
+void nxd_sbuffer_finalize(nxd_sbuffer* sb);
+
+
 typedef struct nxd_fbuffer {
   nxe_istream data_out;
   int fd;
@@ -218,6 +266,14 @@ enum nxd_http_server_proto_state {
   HSP_SENDING_BODY
 };
 
+typedef struct nxd_http_server_proto_request { // per-request state; only allocated while request is active
+  nxweb_http_request req;
+  nxweb_http_response _resp; // embedded response
+  nxd_obuffer ob;
+  nxd_fbuffer fb;
+  nxd_ibuffer ib;
+} nxd_http_server_proto_request;
+
 typedef struct nxd_http_server_proto {
   const nxd_http_server_proto_class* cls;
   nxe_ostream data_in;
@@ -231,20 +287,20 @@ typedef struct nxd_http_server_proto {
   nxe_timer timer_write;
   nxb_buffer* nxb;
   nxp_pool* nxb_pool;
+  nxp_pool* rq_pool;
   //char* req_headers;
   //int sock_fd;
   enum nxd_http_server_proto_state state;
   int request_count;
   int headers_bytes_received;
   //unsigned keep_alive:1;
-  nxweb_http_request req;
-  nxweb_http_response _resp; // embedded response
+  nxd_http_server_proto_request* rq; // null while connection is idle
   nxweb_http_response* resp;
   const char* first_body_chunk;
   const char* first_body_chunk_end;
+  const char* pipelined_data; // bytes of next request(s) received along with current one
+  const char* pipelined_data_end;
   const char* resp_headers_ptr;
-  nxd_obuffer ob;
-  nxd_fbuffer fb;
   void* req_data;
   void (*req_finalize)(struct nxd_http_server_proto* hsp, void* req_data);
 } nxd_http_server_proto;
@@ -262,12 +318,14 @@ enum nxd_http_server_proto_error_code {
   NXD_HSP_REQUEST_COMPLETE=27109
 };
 
-void nxd_http_server_proto_init(nxd_http_server_proto* hsp, nxp_pool* nxb_pool);
+void nxd_http_server_proto_init(nxd_http_server_proto* hsp, nxp_pool* nxb_pool, nxp_pool* rq_pool);
 void nxd_http_server_proto_connect(nxd_http_server_proto* hsp, nxe_loop* loop);
-void nxd_http_server_proto_subrequest_init(nxd_http_server_proto* hsp, nxp_pool* nxb_pool);
+void nxd_http_server_proto_subrequest_init(nxd_http_server_proto* hsp, nxp_pool* nxb_pool, nxp_pool* rq_pool);
 void nxweb_http_server_proto_subrequest_execute(nxd_http_server_proto* hsp, const char* host, const char* uri, nxweb_http_request* parent_req);
 void nxd_http_server_proto_finish_response(nxweb_http_response* resp);
 void nxd_http_server_proto_setup_content_out(nxd_http_server_proto* hsp, nxweb_http_response* resp);
+void _nxd_http_server_proto_alloc_request(nxd_http_server_proto* hsp);
+void _nxd_http_server_proto_free_request(nxd_http_server_proto* hsp);
 void nxweb_reset_content_out(nxd_http_server_proto* hsp, nxweb_http_response* resp);
 
 enum nxd_http_client_proto_state {
@@ -339,7 +397,10 @@ typedef struct nxd_http_proxy {
   nxd_http_client_proto hcp;
   nxe_subscriber events_sub; // for idle monitoring, etc.
   struct nxd_http_proxy_pool* pool;
+  struct nxd_http_proxy_server* server;
   uint64_t uid;
+  nxe_time_t request_start_time; // for response time measurement
+  int connected; // NXD_HCP_CONNECTED seen; errors before that are connect failures
   struct nxd_http_proxy* prev; // used by http_proxy_pool pool
   struct nxd_http_proxy* next;
 } nxd_http_proxy;
@@ -355,13 +416,111 @@ void nxd_http_proxy_start_request(nxd_http_proxy* hpx, nxweb_http_request* req);
 #define NXD_FREE_PROXY_POOL_INITIAL_SIZE 4
 #define NXD_HTTP_PROXY_POOL_TIME_DELTA_SAMPLES 8
 #define NXD_HTTP_PROXY_POOL_TIME_DELTA_NO_VALUE 1000000
+#define NXD_HTTP_PROXY_HASH_POINTS 64 // consistent hash ring points per unit of server weight
+#define NXD_HTTP_PROXY_MAX_EJECT_BACKOFF 8 // fail_timeout multiplier cap for repeatedly ejected servers
+#define NXD_HTTP_PROXY_REFILL_DELAY 10000 // usec; batches idle connection refills
+#define NXD_HTTP_PROXY_SHARED_IDLE_MAX 256 // parked idle connections per server, shared by all net threads
+#define NXD_HTTP_PROXY_P95_MIN_SAMPLES 20 // response time p95 estimate is not reported before that many responses
+
+typedef enum nxd_http_proxy_balance {
+  NXD_BALANCE_ROUND_ROBIN=0, // weighted (smooth) round-robin
+  NXD_BALANCE_LEAST_CONN,    // fewest active connections per weight
+  NXD_BALANCE_EWMA,          // lowest smoothed response time times active connections
+  NXD_BALANCE_URI_HASH       // consistent hash of request uri
+} nxd_http_proxy_balance;
+
+typedef enum nxd_http_proxy_server_state {
+  NXD_SERVER_UP=0,   // circuit closed
+  NXD_SERVER_DOWN,   // circuit open: ejected, gets no requests
+  NXD_SERVER_PROBING // circuit half-open: one trial request at a time
+} nxd_http_proxy_server_state;
+
+typedef struct nxd_http_proxy_health_config {
+  int max_fails;         // consecutive failures that eject server; 0 = never eject
+  int fail_timeout;      // ms; ejected server gets trial request after that (longer if ejected repeatedly)
+  int check_interval;    // ms; probe period for ejected servers; 0 = trial requests after fail_timeout; if set, only probes re-admit servers
+  const char* check_uri; // probe uri; any response other than 5xx means healthy
+  int slow_start;        // ms; re-admitted server ramps up to full weight during that period
+} nxd_http_proxy_health_config;
+
+struct nxd_http_proxy_shared_idle;
+
+struct nxd_http_proxy_shared_idle* nxd_http_proxy_shared_idle_create();
+void nxd_http_proxy_shared_idle_destroy(struct nxd_http_proxy_shared_idle* si); // closes parked connections
+
+typedef struct nxd_http_proxy_server_config {
+  const char* host;
+  struct addrinfo* saddr;
+  int weight;
+  struct nxd_http_proxy_shared_idle* shared_idle; // registry of idle connections other net threads can adopt
+} nxd_http_proxy_server_config;
 
-typedef struct nxd_http_proxy_pool {
-  nxe_loop* loop;
+typedef struct nxd_http_proxy_server {
+  struct nxd_http_proxy_pool* pool;
   const char* host;
   struct addrinfo* saddr;
-  nxd_http_proxy* first;
+  int weight;
+  int current_weight; // for smooth weighted round-robin
+  nxd_http_proxy* first; // idle connections
   nxd_http_proxy* last;
+  int idle_count;
+  struct nxd_http_proxy_shared_idle* shared_idle;
+  int conn_count; // connections in use
+  int conn_count_max;
+  nxe_time_t ewma_response_time; // usec
+  nxd_http_proxy_server_state state;
+  int fails; // consecutive
+  int ejections; // consecutive
+  nxe_time_t down_until; // when ejected server gets trial request
+  nxe_time_t up_since; // for slow start
+  nxd_http_proxy* probe; // active health check connection
+  _Bool probe_done:1;
+} nxd_http_proxy_server;
+
+typedef struct nxd_http_proxy_pool_config {
+  nxd_http_proxy_server_config* servers;
+  int num_servers;
+  nxd_http_proxy_balance balance;
+  nxd_http_proxy_health_config health;
+  int max_conns; // per server per net thread; 0 = unlimited
+  int max_queue; // requests waiting for connection when all servers are at max_conns; per net thread
+  nxe_time_t queue_timeout; // usec; requests waiting longer than that get 503
+  int min_idle; // keep-alive connections kept open to each server per net thread
+  int max_local_idle; // idle connections above that are parked for any net thread to adopt; 0 = never share
+} nxd_http_proxy_pool_config;
+
+typedef struct nxd_http_proxy_pool_waiter {
+  void (*on_connection)(struct nxd_http_proxy_pool_waiter* w, nxd_http_proxy* hpx); // hpx=0 if timed out
+  const char* uri;
+  nxe_time_t queued_time;
+  struct nxd_http_proxy_pool_waiter* next;
+} nxd_http_proxy_pool_waiter;
+
+typedef struct nxd_http_proxy_hash_point {
+  uint32_t hash;
+  int server_idx;
+} nxd_http_proxy_hash_point;
+
+typedef struct nxd_http_proxy_pool {
+  nxe_loop* loop;
+  nxd_http_proxy_server* servers;
+  int num_servers;
+  nxd_http_proxy_balance balance;
+  nxd_http_proxy_health_config health;
+  nxe_timer health_timer;
+  int max_conns;
+  int max_queue;
+  nxe_time_t queue_timeout;
+  int queued;
+  nxd_http_proxy_pool_waiter* queue_head;
+  nxd_http_proxy_pool_waiter* queue_tail;
+  nxe_timer queue_timer;
+  int min_idle;
+  int max_local_idle;
+  nxe_timer refill_timer;
+  nxd_http_proxy_hash_point* hash_ring; // sorted by hash; for NXD_BALANCE_URI_HASH
+  int hash_ring_size;
+  unsigned next_server; // start position for scans, so ties are spread
   nxp_pool* free_pool;
   nxp_pool* nxb_pool;
   nxe_subscriber gc_sub;
@@ -369,11 +528,21 @@ typedef struct nxd_http_proxy_pool {
   int backend_time_delta_idx;
   int conn_count;
   int conn_count_max;
+  _Bool finalizing; // finalize called; memory is released once last checked out connection is returned
+  nxe_time_t response_time_p95; // usec; running estimate over all servers, for adaptive hedging
+  int response_time_samples;
 } nxd_http_proxy_pool;
 
-void nxd_http_proxy_pool_init(nxd_http_proxy_pool* pp, nxe_loop* loop, nxp_pool* nxb_pool, const char* host, struct addrinfo* saddr);
-nxd_http_proxy* nxd_http_proxy_pool_connect(nxd_http_proxy_pool* pp);
+void nxd_http_proxy_pool_init(nxd_http_proxy_pool* pp, nxe_loop* loop, nxp_pool* nxb_pool, const nxd_http_proxy_pool_config* conf);
+nxd_http_proxy* nxd_http_proxy_pool_connect(nxd_http_proxy_pool* pp, const char* uri); // uri is only used for hashing; null if no server available or all busy
+nxd_http_proxy* nxd_http_proxy_pool_connect_other(nxd_http_proxy_pool* pp, const char* uri, nxd_http_proxy_server* exclude); // server other than exclude; for hedged requests
+int nxd_http_proxy_pool_wait(nxd_http_proxy_pool* pp, nxd_http_proxy_pool_waiter* w); // 0 = queued; 1 = all busy & queue full; -1 = no server available
+void nxd_http_proxy_pool_cancel_wait(nxd_http_proxy_pool* pp, nxd_http_proxy_pool_waiter* w);
 void nxd_http_proxy_pool_return(nxd_http_proxy* hpx, int closed);
+void nxd_http_proxy_pool_report_response(nxd_http_proxy* hpx); // response headers received
+void nxd_http_proxy_pool_report_cancelled(nxd_http_proxy* hpx); // request abandoned in favor of its hedge
+nxe_time_t nxd_http_proxy_pool_get_response_time_p95(nxd_http_proxy_pool* pp); // usec; 0 until enough samples
+void nxd_http_proxy_pool_report_failure(nxd_http_proxy* hpx); // connect error or timeout
 void nxd_http_proxy_pool_finalize(nxd_http_proxy_pool* pp);
 void nxd_http_proxy_pool_report_backend_time_delta(nxd_http_proxy_pool* pp, time_t delta);
 time_t nxd_http_proxy_pool_get_backend_time_delta(nxd_http_proxy_pool* pp);
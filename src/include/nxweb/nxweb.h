@@ -351,9 +351,19 @@ static inline nx_simple_map_entry* nx_simple_map_itr_next(nx_simple_map_entry* i
 }
 
 
+enum nxweb_listen_flags {
+  NXWEB_LISTEN_REUSEPORT=1, // bind separate SO_REUSEPORT socket for each net thread
+  NXWEB_LISTEN_CPU_STEERING=2 // deliver connections to net thread pinned to the CPU that received them (implies REUSEPORT)
+};
+
 int nxweb_listen(const char* host_and_port, int backlog);
 int nxweb_listen_ssl(const char* host_and_port, int backlog, _Bool secure, const char* cert_file, const char* key_file, const char* dh_params_file, const char* cipher_priority_string);
+int nxweb_listen_ex(const char* host_and_port, int backlog, int flags, _Bool secure, const char* cert_file, const char* key_file, const char* dh_params_file, const char* cipher_priority_string);
 int nxweb_setup_http_proxy_pool(int idx, const char* host_and_port);
+int nxweb_add_http_proxy_pool_server(int idx, const char* host_and_port, int weight);
+void nxweb_set_http_proxy_pool_balance(int idx, nxd_http_proxy_balance balance);
+int nxweb_setup_worker_class(int idx, const char* name, int max_concurrency, int max_queue, nxe_time_t queue_timeout);
+int nxweb_find_worker_class(const char* name);
 void nxweb_set_timeout(enum nxweb_timers timer_idx, nxe_time_t timeout);
 void nxweb_run();
 
@@ -29,16 +29,33 @@ extern "C" {
 //#endif
 
 #define NXWEB_MAX_LISTEN_SOCKETS 4
-#define NXWEB_MAX_PROXY_POOLS 4
+#define NXWEB_MAX_PROXY_POOLS 16
 #define NXWEB_MAX_REQUEST_HEADERS_SIZE 4096
 #define NXWEB_MAX_REQUEST_BODY_SIZE 512000
 #define NXWEB_RBUF_SIZE 16384
 #define NXWEB_PROXY_RETRY_COUNT 4
+#define NXWEB_PROXY_SPLICE_MIN_SIZE 65536 // smaller proxied bodies are not worth a pipe; 0 disables splice()
+#define NXWEB_DEFAULT_PROXY_BUFFER_SIZE 262144 // in-memory part of buffered proxy response; rest spills to temp file
+#define NXWEB_DEFAULT_PROXY_MAX_SPOOL_SIZE 52428800 // max request body for proxy_spool_request
+#define NXWEB_DEFAULT_PROXY_HEDGE_DELAY 50000 // usec; used for proxy_hedge until backend p95 is known
+#define NXWEB_PROXY_HEDGE_MIN_DELAY 2000 // usec; lower bound for p95-based hedge delay
+#define NXWEB_DEFAULT_PROXY_MAX_FAILS 3
+#define NXWEB_DEFAULT_PROXY_FAIL_TIMEOUT 10000 // msec
+#define NXWEB_DEFAULT_PROXY_SLOW_START 5000 // msec
+#define NXWEB_DEFAULT_PROXY_MAX_QUEUE 1024 // requests waiting for backend connection when max_conns reached
+#define NXWEB_DEFAULT_PROXY_QUEUE_TIMEOUT 5000000 // usec
+#define NXWEB_DEFAULT_PROXY_MAX_LOCAL_IDLE 8 // idle backend connections kept by net thread; more get shared
 #define NXWEB_CONN_NXB_SIZE (NXWEB_MAX_REQUEST_HEADERS_SIZE+1024)
 #define NXWEB_MAX_FILTERS 16
-#define NXWEB_DEFAULT_CACHED_TIME 30000000
-#define NXWEB_MAX_CACHED_ITEMS 500
-#define NXWEB_MAX_CACHED_ITEM_SIZE 32768
+#define NXWEB_DEFAULT_CACHED_TIME 30000000 // usec; memcache ttl
+#define NXWEB_DEFAULT_MEMCACHE_SIZE (16*1024*1024) // bytes; total for all shards
+#define NXWEB_DEFAULT_MAX_CACHED_ITEM_SIZE 32768
+#define NXWEB_MEMCACHE_SHARDS 16 // must be power of 2
+#define NXWEB_MEMCACHE_WINDOW_PERCENT 1 // W-TinyLFU admission window; share of shard budget
+#define NXWEB_MEMCACHE_AVG_ITEM_SIZE 2048 // for sizing frequency sketch
+#define NXWEB_MEMCACHE_SKETCH_SAMPLES 10 // halve frequencies every that many accesses per sketch counter
+#define NXWEB_DEFAULT_FD_RESERVE 32 // stop accepting connections when that close to RLIMIT_NOFILE
+#define NXWEB_LOOP_LAG_CHECK_INTERVAL 100000 // usec
 
 #ifdef NX_DEBUG
 #define NXWEB_MAX_NET_THREADS 1
@@ -25,184 +25,645 @@
 #include "deps/ulib/alignhash_tpl.h"
 #include "deps/ulib/hash.h"
 
+// Memory cache is split into NXWEB_MEMCACHE_SHARDS shards selected by key hash.
+// Each shard has its own rwlock, hash table and byte budget (memcache size / number of shards).
+// Cache hits take read lock only; recency is tracked by CLOCK algorithm:
+// hit just sets referenced flag, eviction sweeps the ring clearing flags and picks first record not referenced.
+// Each record holds one reference on behalf of the cache (dropped when removed from hash)
+// plus one per request serving it; whoever drops last reference frees the record.
+//
+// Besides small files, bodies generated by handlers (eg. proxied responses) are cached
+// by capturing them on their way to the client; see cache_capture below.
+//
+// Admission follows W-TinyLFU: new records enter small window ring; records pushed out of the window
+// are admitted to main ring only if their access frequency beats that of main ring's victim.
+// Frequencies are estimated by count-min sketch with doorkeeper bitmap, both halved/cleared
+// every NXWEB_MEMCACHE_SKETCH_SAMPLES*width accesses. So one-off scans of cold URLs
+// can't flush hot records from main ring.
+
 typedef struct nxweb_cache_rec {
   nxe_ssize_t content_length;
   const char* content_type;
   const char* content_charset;
   nxe_time_t expires_time;
+  nxe_time_t ttl;
   time_t last_modified;
+  size_t size; // bytes charged to shard's budget
+  uint32_t hash;
   uint32_t ref_count;
-  struct nxweb_cache_rec* prev;
+  uint8_t referenced; // CLOCK bit; set on hit without write lock
+  uint8_t in_window;
+  struct nxweb_cache_rec* prev; // CLOCK ring
   struct nxweb_cache_rec* next;
+  // generated responses only:
+  const char* cache_control;
+  const char* extra_raw_headers;
+  time_t max_age;
+  time_t expires;
   _Bool gzip_encoded:1;
-  char content[];
+  _Bool generated:1;
+  char content[]; // content, '\0', key, '\0' [, other strings of generated response]
 } nxweb_cache_rec;
 
+#define CACHE_REC_KEY(rec) ((rec)->content+(rec)->content_length+1)
+
 #define nxweb_cache_hash_fn(key) hash_sdbm((const unsigned char*)(key))
 #define nxweb_cache_eq_fn(a, b) (!strcmp((a), (b)))
 
 DECLARE_ALIGNHASH(nxweb_cache, const char*, nxweb_cache_rec*, 1, nxweb_cache_hash_fn, nxweb_cache_eq_fn)
 
-static alignhash_t(nxweb_cache) *_nxweb_cache;
-static nxweb_cache_rec* _nxweb_cache_head;
-static nxweb_cache_rec* _nxweb_cache_tail;
-static pthread_mutex_t _nxweb_cache_mutex;
+#define SKETCH_DEPTH 4
+#define SKETCH_MAX_COUNT 15
 
-#define IS_LINKED(rec) ((rec)->prev || _nxweb_cache_head==(rec))
+typedef struct nxweb_cache_shard {
+  pthread_rwlock_t lock;
+  alignhash_t(nxweb_cache) *hash;
+  nxweb_cache_rec* window_hand; // CLOCK hands; all records of the shard are linked into one of two rings
+  nxweb_cache_rec* main_hand;
+  size_t window_size; // bytes
+  size_t main_size;
+  // frequency sketch; updated without locks (lost updates are harmless)
+  uint8_t* sketch; // SKETCH_DEPTH rows of _nxweb_cache_sketch_width counters
+  uint8_t* doorkeeper; // _nxweb_cache_sketch_width bytes => 8*width bits
+  uint32_t sketch_samples;
+  // counters
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t admitted;
+  uint64_t rejected;
+  uint64_t evicted;
+} __attribute__((aligned(64))) nxweb_cache_shard;
 
-static inline void cache_rec_link(nxweb_cache_rec* rec) {
-  // add to head
-  rec->prev=0;
-  rec->next=_nxweb_cache_head;
-  if (_nxweb_cache_head) _nxweb_cache_head->prev=rec;
-  else _nxweb_cache_tail=rec;
-  _nxweb_cache_head=rec;
+static nxweb_cache_shard _nxweb_cache_shards[NXWEB_MEMCACHE_SHARDS];
+static size_t _nxweb_cache_window_budget;
+static size_t _nxweb_cache_main_budget;
+static uint32_t _nxweb_cache_sketch_width; // power of 2
+static int _nxweb_cache_sketch_shift; // 32-log2(width)
+
+static const uint32_t sketch_seeds[SKETCH_DEPTH+1]={0x9E3779B1U, 0x85EBCA77U, 0xC2B2AE3DU, 0x27D4EB2FU, 0x165667B1U};
+
+static inline nxweb_cache_shard* cache_shard(uint32_t hash) {
+  // use high bits; low bits select bucket within shard's hash table
+  return &_nxweb_cache_shards[(hash*2654435761U)>>24 & (NXWEB_MEMCACHE_SHARDS-1)];
 }
 
-static inline void cache_rec_unlink(nxweb_cache_rec* rec) {
-  if (rec->prev) rec->prev->next=rec->next;
-  else _nxweb_cache_head=rec->next;
-  if (rec->next) rec->next->prev=rec->prev;
-  else _nxweb_cache_tail=rec->prev;
+static inline uint32_t sketch_index(uint32_t hash, int row) {
+  return (hash*sketch_seeds[row])>>_nxweb_cache_sketch_shift;
+}
+
+static int sketch_frequency(nxweb_cache_shard* shard, uint32_t hash) {
+  uint32_t di=sketch_index(hash, SKETCH_DEPTH);
+  int freq=SKETCH_MAX_COUNT, row;
+  for (row=0; row<SKETCH_DEPTH; row++) {
+    int c=__atomic_load_n(&shard->sketch[row*_nxweb_cache_sketch_width+sketch_index(hash, row)], __ATOMIC_RELAXED);
+    if (c<freq) freq=c;
+  }
+  if (__atomic_load_n(&shard->doorkeeper[di>>3], __ATOMIC_RELAXED) & (1<<(di&7))) freq++;
+  return freq;
+}
+
+static void sketch_reset(nxweb_cache_shard* shard) {
+  uint32_t i;
+  for (i=0; i<SKETCH_DEPTH*_nxweb_cache_sketch_width; i++) {
+    __atomic_store_n(&shard->sketch[i], __atomic_load_n(&shard->sketch[i], __ATOMIC_RELAXED)>>1, __ATOMIC_RELAXED);
+  }
+  for (i=0; i<_nxweb_cache_sketch_width; i++) {
+    __atomic_store_n(&shard->doorkeeper[i], 0, __ATOMIC_RELAXED);
+  }
+  __atomic_store_n(&shard->sketch_samples, 0, __ATOMIC_RELAXED);
+}
+
+static void sketch_increment(nxweb_cache_shard* shard, uint32_t hash) {
+  uint32_t di=sketch_index(hash, SKETCH_DEPTH);
+  uint8_t bit=1<<(di&7);
+  if (!(__atomic_load_n(&shard->doorkeeper[di>>3], __ATOMIC_RELAXED) & bit)) {
+    // first access within sample period only goes to doorkeeper
+    __atomic_fetch_or(&shard->doorkeeper[di>>3], bit, __ATOMIC_RELAXED);
+  }
+  else {
+    int row;
+    for (row=0; row<SKETCH_DEPTH; row++) {
+      uint8_t* c=&shard->sketch[row*_nxweb_cache_sketch_width+sketch_index(hash, row)];
+      uint8_t v=__atomic_load_n(c, __ATOMIC_RELAXED);
+      if (v<SKETCH_MAX_COUNT) __atomic_store_n(c, v+1, __ATOMIC_RELAXED);
+    }
+  }
+  if (__atomic_add_fetch(&shard->sketch_samples, 1, __ATOMIC_RELAXED)==NXWEB_MEMCACHE_SKETCH_SAMPLES*_nxweb_cache_sketch_width) {
+    sketch_reset(shard); // only one thread gets here
+  }
+}
+
+static inline void cache_ring_insert(nxweb_cache_rec** hand_ptr, nxweb_cache_rec* rec) {
+  // insert right behind the hand, so new record is the last one to be swept
+  nxweb_cache_rec* hand=*hand_ptr;
+  if (!hand) {
+    rec->next=rec->prev=rec;
+    *hand_ptr=rec;
+  }
+  else {
+    rec->next=hand;
+    rec->prev=hand->prev;
+    hand->prev->next=rec;
+    hand->prev=rec;
+  }
+}
+
+static inline void cache_ring_remove(nxweb_cache_rec** hand_ptr, nxweb_cache_rec* rec) {
+  if (rec->next==rec) {
+    *hand_ptr=0;
+  }
+  else {
+    rec->prev->next=rec->next;
+    rec->next->prev=rec->prev;
+    if (*hand_ptr==rec) *hand_ptr=rec->next;
+  }
   rec->next=0;
   rec->prev=0;
 }
 
-static int cache_init() {
-  pthread_mutex_init(&_nxweb_cache_mutex, 0);
-  _nxweb_cache=alignhash_init(nxweb_cache);
+// must be called under write lock
+static nxweb_cache_rec* cache_clock_victim(nxweb_cache_rec** hand_ptr, nxe_time_t loop_time) {
+  nxweb_cache_rec* rec;
+  while ((rec=*hand_ptr)) {
+    if (rec->referenced && loop_time<=rec->expires_time) {
+      rec->referenced=0;
+      *hand_ptr=rec->next;
+      continue;
+    }
+    return rec;
+  }
   return 0;
 }
 
-static void cache_finalize() {
-  ah_iter_t ci;
-  for (ci=alignhash_begin(_nxweb_cache); ci!=alignhash_end(_nxweb_cache); ci++) {
-    if (alignhash_exist(_nxweb_cache, ci)) {
-      nxweb_cache_rec* rec=alignhash_value(_nxweb_cache, ci);
-      if (rec->ref_count) nxweb_log_error("file %s still in cache with ref_count=%d", alignhash_key(_nxweb_cache, ci), rec->ref_count);
-      cache_rec_unlink(rec);
-      nx_free(rec);
-    }
+static inline void cache_rec_release(nxweb_cache_rec* rec) {
+  if (!__sync_sub_and_fetch(&rec->ref_count, 1)) nx_free(rec);
+}
+
+// must be called under write lock
+static void cache_rec_remove(nxweb_cache_shard* shard, ah_iter_t ci, nxweb_cache_rec* rec) {
+  alignhash_del(nxweb_cache, shard->hash, ci);
+  if (rec->in_window) {
+    cache_ring_remove(&shard->window_hand, rec);
+    shard->window_size-=rec->size;
+  }
+  else {
+    cache_ring_remove(&shard->main_hand, rec);
+    shard->main_size-=rec->size;
   }
-  alignhash_destroy(nxweb_cache, _nxweb_cache);
-  pthread_mutex_destroy(&_nxweb_cache_mutex);
+  cache_rec_release(rec); // records still being sent get freed by the last request
 }
 
-NXWEB_MODULE(cache, .on_server_startup=cache_init, .on_server_shutdown=cache_finalize);
-
-static inline void cache_check_size() {
-  while (alignhash_size(_nxweb_cache)>NXWEB_MAX_CACHED_ITEMS) {
-    nxweb_cache_rec* rec=_nxweb_cache_tail;
-    while (rec && rec->ref_count) rec=rec->prev;
-    if (rec) {
-      const char* fpath=rec->content+rec->content_length+1;
-      ah_iter_t ci=alignhash_get(nxweb_cache, _nxweb_cache, fpath);
-      if (ci!=alignhash_end(_nxweb_cache)) {
-        assert(rec==alignhash_value(_nxweb_cache, ci));
-        cache_rec_unlink(rec);
-        alignhash_del(nxweb_cache, _nxweb_cache, ci);
-        nx_free(rec);
+// must be called under write lock
+static void cache_rec_drop(nxweb_cache_shard* shard, nxweb_cache_rec* rec) {
+  ah_iter_t ci=alignhash_get(nxweb_cache, shard->hash, CACHE_REC_KEY(rec));
+  assert(ci!=alignhash_end(shard->hash) && rec==alignhash_value(shard->hash, ci));
+  cache_rec_remove(shard, ci, rec);
+}
+
+// must be called under write lock
+static void cache_evict(nxweb_cache_shard* shard, nxe_time_t loop_time) {
+  nxweb_cache_rec* cand;
+  nxweb_cache_rec* victim;
+  while (shard->window_size>_nxweb_cache_window_budget && (cand=cache_clock_victim(&shard->window_hand, loop_time))) {
+    if (loop_time>cand->expires_time) {
+      cache_rec_drop(shard, cand);
+      continue;
+    }
+    // make room in main ring if candidate is worth it
+    int cand_freq=-1;
+    while (shard->main_size+cand->size>_nxweb_cache_main_budget && (victim=cache_clock_victim(&shard->main_hand, loop_time))) {
+      if (loop_time<=victim->expires_time) {
+        if (cand_freq<0) cand_freq=sketch_frequency(shard, cand->hash);
+        if (cand_freq<=sketch_frequency(shard, victim->hash)) break;
+        shard->evicted++;
       }
+      cache_rec_drop(shard, victim);
     }
-    else {
-      break;
+    if (shard->main_size+cand->size>_nxweb_cache_main_budget) {
+      shard->rejected++;
+      cache_rec_drop(shard, cand);
+      continue;
     }
+    cache_ring_remove(&shard->window_hand, cand);
+    shard->window_size-=cand->size;
+    cand->in_window=0;
+    cache_ring_insert(&shard->main_hand, cand);
+    shard->main_size+=cand->size;
+    shard->admitted++;
   }
 }
 
-static void cache_rec_unref(nxd_http_server_proto* hsp, void* req_data) {
-  pthread_mutex_lock(&_nxweb_cache_mutex);
-  nxweb_cache_rec* rec=req_data;
-  assert(rec->ref_count>0);
-  if (!--rec->ref_count) {
-    nxe_time_t loop_time=_nxweb_net_thread_data->loop->current_time;
-    if (loop_time > rec->expires_time || !IS_LINKED(rec)) {
-      const char* fpath=rec->content+rec->content_length+1;
-      ah_iter_t ci=alignhash_get(nxweb_cache, _nxweb_cache, fpath);
-      if (ci!=alignhash_end(_nxweb_cache) && rec==alignhash_value(_nxweb_cache, ci)) {
-        alignhash_del(nxweb_cache, _nxweb_cache, ci);
-        cache_rec_unlink(rec);
-      }
-      else {
-        nxweb_log_error("freed previously removed cache entry %s [%p]", fpath, rec);
+static int cache_init() {
+  nxweb_memcache_config* mc=&nxweb_server_config.memcache;
+  size_t shard_budget=mc->size/NXWEB_MEMCACHE_SHARDS;
+  if (mc->max_item_size>shard_budget/4) {
+    mc->max_item_size=shard_budget/4;
+    nxweb_log_warning("memcache max_item_size reduced to %ld to fit %d shards", (long)mc->max_item_size, NXWEB_MEMCACHE_SHARDS);
+  }
+  _nxweb_cache_window_budget=shard_budget*NXWEB_MEMCACHE_WINDOW_PERCENT/100;
+  if (_nxweb_cache_window_budget<mc->max_item_size) _nxweb_cache_window_budget=mc->max_item_size;
+  _nxweb_cache_main_budget=shard_budget-_nxweb_cache_window_budget;
+  // sketch width: power of 2 >= expected number of records in the shard
+  _nxweb_cache_sketch_width=64;
+  _nxweb_cache_sketch_shift=32-6;
+  while (_nxweb_cache_sketch_width<shard_budget/NXWEB_MEMCACHE_AVG_ITEM_SIZE && _nxweb_cache_sketch_shift>8) {
+    _nxweb_cache_sketch_width<<=1;
+    _nxweb_cache_sketch_shift--;
+  }
+  int i;
+  for (i=0; i<NXWEB_MEMCACHE_SHARDS; i++) {
+    nxweb_cache_shard* shard=&_nxweb_cache_shards[i];
+    pthread_rwlock_init(&shard->lock, 0);
+    shard->hash=alignhash_init(nxweb_cache);
+    shard->sketch=nx_calloc(SKETCH_DEPTH*_nxweb_cache_sketch_width);
+    shard->doorkeeper=nx_calloc(_nxweb_cache_sketch_width);
+  }
+  return 0;
+}
+
+static void cache_finalize() {
+  int i;
+  for (i=0; i<NXWEB_MEMCACHE_SHARDS; i++) {
+    nxweb_cache_shard* shard=&_nxweb_cache_shards[i];
+    ah_iter_t ci;
+    for (ci=alignhash_begin(shard->hash); ci!=alignhash_end(shard->hash); ci++) {
+      if (alignhash_exist(shard->hash, ci)) {
+        nxweb_cache_rec* rec=alignhash_value(shard->hash, ci);
+        if (rec->ref_count>1) nxweb_log_error("file %s still in cache with ref_count=%d", alignhash_key(shard->hash, ci), rec->ref_count-1);
+        nx_free(rec);
       }
-      nx_free(rec);
     }
+    alignhash_destroy(nxweb_cache, shard->hash);
+    nx_free(shard->sketch);
+    nx_free(shard->doorkeeper);
+    pthread_rwlock_destroy(&shard->lock);
   }
-  cache_check_size();
-  pthread_mutex_unlock(&_nxweb_cache_mutex);
 }
 
-nxweb_result nxweb_cache_try(nxweb_http_server_connection* conn, nxweb_http_response* resp, const char* key, time_t if_modified_since, time_t revalidated_mtime) {
+void nxweb_cache_get_stats(nxweb_cache_stats* stats) {
+  memset(stats, 0, sizeof(nxweb_cache_stats));
+  int i;
+  for (i=0; i<NXWEB_MEMCACHE_SHARDS; i++) {
+    nxweb_cache_shard* shard=&_nxweb_cache_shards[i];
+    pthread_rwlock_rdlock(&shard->lock);
+    stats->hits+=__atomic_load_n(&shard->hits, __ATOMIC_RELAXED);
+    stats->misses+=__atomic_load_n(&shard->misses, __ATOMIC_RELAXED);
+    stats->admitted+=shard->admitted;
+    stats->rejected+=shard->rejected;
+    stats->evicted+=shard->evicted;
+    stats->size+=shard->window_size+shard->main_size;
+    stats->items+=alignhash_size(shard->hash);
+    pthread_rwlock_unlock(&shard->lock);
+  }
+}
+
+static void cache_diagnostics() {
+  nxweb_cache_stats st;
+  nxweb_cache_get_stats(&st);
+  nxweb_log_error("memcache: %d items, %ld bytes; hits=%llu misses=%llu admitted=%llu rejected=%llu evicted=%llu",
+          st.items, (long)st.size, (unsigned long long)st.hits, (unsigned long long)st.misses,
+          (unsigned long long)st.admitted, (unsigned long long)st.rejected, (unsigned long long)st.evicted);
+}
+
+NXWEB_MODULE(cache, .on_server_startup=cache_init, .on_server_shutdown=cache_finalize, .on_server_diagnostics=cache_diagnostics);
+
+static void cache_rec_unref(nxd_http_server_proto* hsp, void* req_data) {
+  cache_rec_release(req_data);
+}
+
+static void cache_serve_rec(nxweb_http_server_connection* conn, nxweb_http_response* resp, nxweb_cache_rec* rec) {
+  // caller must hold a reference to rec
+  resp->content_length=rec->content_length;
+  resp->content=rec->content;
+  resp->content_type=rec->content_type;
+  resp->content_charset=rec->content_charset;
+  resp->last_modified=rec->last_modified;
+  resp->gzip_encoded=rec->gzip_encoded;
+  if (rec->generated) {
+    resp->cache_control=rec->cache_control;
+    resp->extra_raw_headers=rec->extra_raw_headers;
+    resp->max_age=rec->max_age;
+    resp->expires=rec->expires>nxe_get_current_http_time(conn->tdata->loop)? rec->expires : 0;
+  }
+  conn->hsp.req_data=rec;
+  conn->hsp.req_finalize=cache_rec_unref;
+}
+
+static nxweb_result cache_try(nxweb_http_server_connection* conn, nxweb_http_response* resp, const char* key, time_t if_modified_since, time_t revalidated_mtime, _Bool count_access) {
   if (*key==' ' || *key=='*') return NXWEB_MISS; // not implemented yet
   nxe_time_t loop_time=nxweb_get_loop_time(conn);
+  uint32_t hash=hash_sdbm((const unsigned char*)key);
+  nxweb_cache_shard* shard=cache_shard(hash);
+  if (count_access) sketch_increment(shard, hash);
   ah_iter_t ci;
   //nxweb_log_error("trying cache for %s", fpath);
-  pthread_mutex_lock(&_nxweb_cache_mutex);
-  if ((ci=alignhash_get(nxweb_cache, _nxweb_cache, key))!=alignhash_end(_nxweb_cache)) {
-    nxweb_cache_rec* rec=alignhash_value(_nxweb_cache, ci);
-    if (rec->last_modified==revalidated_mtime) {
-      rec->expires_time=loop_time+NXWEB_DEFAULT_CACHED_TIME;
-      nxweb_log_info("revalidated %s in memcache", key);
-    }
-    if (loop_time <= rec->expires_time) {
-      if (rec!=_nxweb_cache_head) {
-        cache_rec_unlink(rec);
-        cache_rec_link(rec); // relink to head
-      }
-      if (if_modified_since && rec->last_modified<=if_modified_since) {
-        pthread_mutex_unlock(&_nxweb_cache_mutex);
-        resp->status_code=304;
-        resp->status="Not Modified";
-        return NXWEB_OK;
-      }
-      rec->ref_count++; // this must be within mutex-protected section
-      pthread_mutex_unlock(&_nxweb_cache_mutex);
-      resp->content_length=rec->content_length;
-      resp->content=rec->content;
-      resp->content_type=rec->content_type;
-      resp->content_charset=rec->content_charset;
-      resp->last_modified=rec->last_modified;
-      resp->gzip_encoded=rec->gzip_encoded;
-      conn->hsp.req_data=rec;
-      conn->hsp.req_finalize=cache_rec_unref;
+  pthread_rwlock_rdlock(&shard->lock);
+  if ((ci=alignhash_get(nxweb_cache, shard->hash, key))==alignhash_end(shard->hash)) {
+    pthread_rwlock_unlock(&shard->lock);
+    if (count_access) __atomic_fetch_add(&shard->misses, 1, __ATOMIC_RELAXED);
+    return NXWEB_MISS;
+  }
+  nxweb_cache_rec* rec=alignhash_value(shard->hash, ci);
+  if (revalidated_mtime && rec->last_modified==revalidated_mtime) {
+    // concurrent readers might race here, but any of their values will do
+    __atomic_store_n(&rec->expires_time, loop_time+rec->ttl, __ATOMIC_RELAXED);
+    nxweb_log_info("revalidated %s in memcache", key);
+  }
+  if (loop_time <= __atomic_load_n(&rec->expires_time, __ATOMIC_RELAXED)) {
+    if (!rec->referenced) __atomic_store_n(&rec->referenced, 1, __ATOMIC_RELAXED); // don't dirty cache line on every hit
+    if (count_access) __atomic_fetch_add(&shard->hits, 1, __ATOMIC_RELAXED);
+    if (if_modified_since && rec->last_modified && rec->last_modified<=if_modified_since) {
+      pthread_rwlock_unlock(&shard->lock);
+      resp->status_code=304;
+      resp->status="Not Modified";
       return NXWEB_OK;
     }
-    else if (!revalidated_mtime) {
-      pthread_mutex_unlock(&_nxweb_cache_mutex);
-      return NXWEB_REVALIDATE;
+    __sync_add_and_fetch(&rec->ref_count, 1); // must be taken before releasing the lock
+    pthread_rwlock_unlock(&shard->lock);
+    cache_serve_rec(conn, resp, rec);
+    return NXWEB_OK;
+  }
+  pthread_rwlock_unlock(&shard->lock);
+  if (count_access) __atomic_fetch_add(&shard->misses, 1, __ATOMIC_RELAXED);
+  if (!revalidated_mtime) return NXWEB_REVALIDATE;
+  // expired & file has changed => drop it
+  pthread_rwlock_wrlock(&shard->lock);
+  if ((ci=alignhash_get(nxweb_cache, shard->hash, key))!=alignhash_end(shard->hash)) {
+    rec=alignhash_value(shard->hash, ci);
+    if (loop_time > rec->expires_time) cache_rec_remove(shard, ci, rec);
+  }
+  pthread_rwlock_unlock(&shard->lock);
+  return NXWEB_MISS;
+}
+
+nxweb_result nxweb_cache_try(nxweb_http_server_connection* conn, nxweb_http_response* resp, const char* key, time_t if_modified_since, time_t revalidated_mtime) {
+  return cache_try(conn, resp, key, if_modified_since, revalidated_mtime, 1);
+}
+
+typedef struct cache_capture {
+  nxe_ostream data_in;
+  nxe_istream data_out;
+  nxweb_cache_rec* rec; // body being collected; not in cache yet
+  nxe_size_t capacity; // of rec->content
+  const char* strings; // key & other strings to append after content
+  int strings_size;
+} cache_capture;
+
+static void cache_capture_abort(cache_capture* cc) {
+  if (cc->rec) {
+    nx_free(cc->rec);
+    cc->rec=0;
+  }
+}
+
+static int cache_capture_append(cache_capture* cc, int fd, nxe_flags_t flags, nxe_data ptr, nxe_size_t size) {
+  nxweb_cache_rec* rec=cc->rec;
+  if (fd && flags&NXEF_PIPE) { // spliced content can't be seen
+    cache_capture_abort(cc);
+    return -1;
+  }
+  if (rec->content_length+size>cc->capacity) {
+    size_t max_item_size=nxweb_server_config.memcache.max_item_size;
+    if (rec->content_length+size>max_item_size) {
+      cache_capture_abort(cc);
+      return -1;
     }
-    alignhash_del(nxweb_cache, _nxweb_cache, ci);
-    cache_rec_unlink(rec);
-    if (!rec->ref_count) {
-      nx_free(rec);
+    nxe_size_t capacity=cc->capacity*2;
+    if (capacity<rec->content_length+size) capacity=rec->content_length+size;
+    if (capacity>max_item_size) capacity=max_item_size;
+    rec=realloc(rec, sizeof(nxweb_cache_rec)+capacity+1+cc->strings_size);
+    if (!rec) {
+      nxweb_log_error("cache_capture_append(): can't grow capture buffer to %ld bytes", (long)capacity);
+      nx_free(cc->rec);
+      cc->rec=0;
+      return -1;
+    }
+    cc->rec=rec;
+    cc->capacity=capacity;
+  }
+  char* dst=rec->content+rec->content_length;
+  if (fd) { // invoked as sendfile
+    if (pread(fd, dst, size, ptr.offs)!=size) {
+      nxweb_log_error("cache_capture_append(): can't read %ld bytes from fd", (long)size);
+      cache_capture_abort(cc);
+      return -1;
+    }
+  }
+  else {
+    memcpy(dst, ptr.cptr, size);
+  }
+  rec->content_length+=size;
+  return 0;
+}
+
+static void cache_capture_store(cache_capture* cc, nxe_time_t loop_time) {
+  nxweb_cache_rec* rec=cc->rec;
+  cc->rec=0;
+  size_t size=sizeof(nxweb_cache_rec)+rec->content_length+1+cc->strings_size;
+  nxweb_cache_rec* r=realloc(rec, size); // shrink to fit
+  if (r) rec=r;
+  rec->size=size;
+  char* p=rec->content+rec->content_length;
+  *p++='\0';
+  memcpy(p, cc->strings, cc->strings_size);
+  // fix up string pointers, which have been stored as offsets
+  const char* key=p;
+  if (rec->content_type) rec->content_type=p+(intptr_t)rec->content_type;
+  if (rec->content_charset) rec->content_charset=p+(intptr_t)rec->content_charset;
+  if (rec->cache_control) rec->cache_control=p+(intptr_t)rec->cache_control;
+  if (rec->extra_raw_headers) rec->extra_raw_headers=p+(intptr_t)rec->extra_raw_headers;
+  rec->expires_time=loop_time+rec->ttl;
+
+  nxweb_cache_shard* shard=cache_shard(rec->hash);
+  int ret=0;
+  ah_iter_t ci;
+  pthread_rwlock_wrlock(&shard->lock);
+  if ((ci=alignhash_get(nxweb_cache, shard->hash, key))!=alignhash_end(shard->hash)) {
+    cache_rec_remove(shard, ci, alignhash_value(shard->hash, ci)); // ours is fresher
+  }
+  ci=alignhash_set(nxweb_cache, shard->hash, key, &ret);
+  if (ci!=alignhash_end(shard->hash) && ret!=AH_INS_ERR) {
+    alignhash_value(shard->hash, ci)=rec;
+    rec->ref_count=1; // the cache's own reference
+    rec->in_window=1;
+    cache_ring_insert(&shard->window_hand, rec);
+    shard->window_size+=size;
+    cache_evict(shard, loop_time);
+    pthread_rwlock_unlock(&shard->lock);
+    nxweb_log_info("memcached %s", cc->strings); // rec might be gone already; key copy in request nxb stays
+    return;
+  }
+  pthread_rwlock_unlock(&shard->lock);
+  nx_free(rec);
+}
+
+static void cache_capture_data_out_do_write(nxe_istream* is, nxe_ostream* os) {
+  cache_capture* cc=OBJ_PTR_FROM_FLD_PTR(cache_capture, data_out, is);
+  nxe_loop* loop=is->super.loop;
+
+  nxe_istream* prev_is=cc->data_in.pair;
+  if (prev_is) {
+    if (prev_is->ready) {
+      cc->data_in.ready=1;
+      ISTREAM_CLASS(prev_is)->do_write(prev_is, &cc->data_in);
+    }
+    if (!prev_is->ready) {
+      nxe_istream_unset_ready(is);
+      nxe_ostream_set_ready(loop, &cc->data_in); // get notified when prev_is becomes ready again
+    }
+  }
+  else {
+    nxe_istream_unset_ready(is);
+  }
+}
+
+static nxe_ssize_t cache_capture_data_in_write(nxe_ostream* os, nxe_istream* is, int fd, nx_file_reader* fr, nxe_data ptr, nxe_size_t size, nxe_flags_t* flags) {
+  cache_capture* cc=OBJ_PTR_FROM_FLD_PTR(cache_capture, data_in, os);
+  nxe_loop* loop=os->super.loop;
+
+  nxe_ssize_t bytes_sent=0;
+  if (size>0 || *flags&NXEF_EOF) {
+    nxe_ostream* next_os=cc->data_out.pair;
+    if (next_os) {
+      nxe_flags_t wflags=*flags;
+      if (next_os->ready) {
+        bytes_sent=OSTREAM_CLASS(next_os)->write(next_os, &cc->data_out, fd, fr, ptr, size, &wflags);
+        if (bytes_sent>0 && cc->rec) cache_capture_append(cc, fd, *flags, ptr, bytes_sent);
+      }
+      if (!next_os->ready) {
+        nxe_ostream_unset_ready(os);
+        nxe_istream_set_ready(loop, &cc->data_out); // get notified when next_os becomes ready again
+      }
     }
     else {
-      // this is normal; just notification
-      nxweb_log_error("removed %s [%p] from cache while its ref_count=%d", key, rec, rec->ref_count);
+      nxe_ostream_unset_ready(os);
     }
   }
-  pthread_mutex_unlock(&_nxweb_cache_mutex);
-  return NXWEB_MISS;
+  if (*flags&NXEF_EOF && bytes_sent==size && cc->rec) {
+    cache_capture_store(cc, loop->current_time);
+  }
+  return bytes_sent;
+}
+
+static const nxe_istream_class cache_capture_data_out_class={.do_write=cache_capture_data_out_do_write};
+static const nxe_ostream_class cache_capture_data_in_class={.write=cache_capture_data_in_write};
+
+static void cache_capture_finalize(nxweb_http_server_connection* conn, nxweb_http_request* req, nxweb_http_response* resp, nxe_data data) {
+  cache_capture* cc=data.ptr;
+  if (cc->data_out.pair) nxe_disconnect_streams(&cc->data_out, cc->data_out.pair);
+  if (cc->data_in.pair) nxe_disconnect_streams(cc->data_in.pair, &cc->data_in);
+  cache_capture_abort(cc); // response has not been completed
+}
+
+static nxe_time_t cache_response_ttl(nxweb_http_server_connection* conn, nxweb_http_response* resp) {
+  // handler's ttl is upper limit; response's own max_age/expires can only shorten it
+  nxe_time_t ttl=conn->handler->memcache_ttl? conn->handler->memcache_ttl*1000LL : nxweb_server_config.memcache.ttl;
+  if (resp->no_cache || resp->cache_private || resp->max_age<0) return 0;
+  if (resp->cache_control && strcasestr(resp->cache_control, "no-store")) return 0;
+  if (resp->max_age>0) {
+    if (resp->max_age*1000000LL<ttl) ttl=resp->max_age*1000000LL;
+  }
+  else if (resp->expires) {
+    time_t cur_time=nxe_get_current_http_time(conn->tdata->loop);
+    if (resp->expires<=cur_time) return 0;
+    if ((resp->expires-cur_time)*1000000LL<ttl) ttl=(resp->expires-cur_time)*1000000LL;
+  }
+  return ttl;
+}
+
+static intptr_t cache_append_string(nxb_buffer* nxb, const char* str, int* size) {
+  intptr_t offset=*size;
+  int len=strlen(str)+1;
+  nxb_append(nxb, str, len);
+  *size+=len;
+  return offset;
+}
+
+// start copying response body (whatever its source) into memcache as it is being sent
+static void cache_capture_response(nxweb_http_server_connection* conn, nxweb_http_request* req, nxweb_http_response* resp) {
+  const char* key=resp->cache_key;
+  if (!req->get_method || req->head_method || *key==' ' || *key=='*') return;
+  if (resp->content_length>(nxe_ssize_t)nxweb_server_config.memcache.max_item_size) return;
+  if (nxweb_get_request_header(req, "Authorization")) return; // shared caches must not store these
+  if (resp->headers) {
+    if (nx_simple_map_get_nocase(resp->headers, "Set-Cookie")) return;
+    const char* vary=nx_simple_map_get_nocase(resp->headers, "Vary");
+    if (vary && nx_strcasecmp(vary, "Accept-Encoding")) return; // cache key knows nothing about other headers
+  }
+  nxe_time_t ttl=cache_response_ttl(conn, resp);
+  if (ttl<=0) return;
+  nxd_http_server_proto_setup_content_out(&conn->hsp, resp);
+  if (!resp->content_out) return;
+
+  nxb_buffer* nxb=req->nxb;
+  cache_capture* cc=nxb_calloc_obj(nxb, sizeof(cache_capture));
+  nxe_size_t capacity=resp->content_length>=0? resp->content_length : 4096;
+  if (capacity>nxweb_server_config.memcache.max_item_size) capacity=nxweb_server_config.memcache.max_item_size;
+
+  // keep strings along with content; their pointers are offsets until stored
+  int strings_size=0;
+  nxb_start_stream(nxb);
+  cache_append_string(nxb, key, &strings_size);
+  intptr_t content_type=resp->content_type? cache_append_string(nxb, resp->content_type, &strings_size) : 0;
+  intptr_t content_charset=resp->content_charset? cache_append_string(nxb, resp->content_charset, &strings_size) : 0;
+  intptr_t cache_control=resp->cache_control? cache_append_string(nxb, resp->cache_control, &strings_size) : 0;
+  intptr_t extra_raw_headers=0;
+  if (resp->headers || resp->extra_raw_headers) {
+    extra_raw_headers=strings_size;
+    if (resp->headers) _nxweb_add_extra_response_headers(nxb, resp->headers);
+    if (resp->extra_raw_headers) nxb_append_str(nxb, resp->extra_raw_headers);
+    nxb_append_char(nxb, '\0');
+  }
+  cc->strings=nxb_finish_stream(nxb, &strings_size);
+  cc->strings_size=strings_size;
+
+  nxweb_cache_rec* rec=nx_alloc(sizeof(nxweb_cache_rec)+capacity+1+strings_size);
+  memset(rec, 0, sizeof(nxweb_cache_rec));
+  rec->hash=hash_sdbm((const unsigned char*)key);
+  rec->ttl=ttl;
+  rec->generated=1;
+  rec->last_modified=resp->last_modified;
+  rec->gzip_encoded=resp->gzip_encoded;
+  rec->content_type=(const char*)content_type;
+  rec->content_charset=(const char*)content_charset;
+  rec->cache_control=(const char*)cache_control;
+  rec->extra_raw_headers=(const char*)extra_raw_headers;
+  rec->max_age=resp->max_age;
+  rec->expires=resp->expires;
+  cc->rec=rec;
+  cc->capacity=capacity;
+
+  cc->data_in.super.cls.os_cls=&cache_capture_data_in_class;
+  cc->data_out.super.cls.is_cls=&cache_capture_data_out_class;
+  cc->data_out.evt.cls=NXE_EV_STREAM;
+  cc->data_in.ready=1;
+  cc->data_out.ready=1;
+  nxe_connect_streams(conn->tdata->loop, resp->content_out, &cc->data_in);
+  resp->content_out=&cc->data_out;
+  nxweb_set_request_data(req, (nxe_data)(void*)cc, (nxe_data)(void*)cc, cache_capture_finalize);
 }
 
 nxweb_result nxweb_cache_store_response(nxweb_http_server_connection* conn, nxweb_http_response* resp) {
   nxe_time_t loop_time=nxweb_get_loop_time(conn);
+  const nxweb_memcache_config* mc=&nxweb_server_config.memcache;
   if (!resp->status_code) resp->status_code=200;
 
   if (resp->status_code==200 && resp->sendfile_path // only cache content from files
-      && resp->content_length>=0 && resp->content_length<=NXWEB_MAX_CACHED_ITEM_SIZE // must be small
+      && resp->content_length>=0 && resp->content_length<=mc->max_item_size // must be small
       && resp->sendfile_offset==0 && resp->sendfile_end==resp->content_length // whole file only
-      && resp->sendfile_end>=resp->sendfile_info.st_size // st_size could be zero if not initialized
-      && alignhash_size(_nxweb_cache)<NXWEB_MAX_CACHED_ITEMS+16) {
+      && resp->sendfile_end>=resp->sendfile_info.st_size) { // st_size could be zero if not initialized
 
     const char* fpath=resp->sendfile_path;
     const char* key=resp->cache_key;
-    if (nxweb_cache_try(conn, resp, key, 0, resp->last_modified)!=NXWEB_MISS) return NXWEB_OK;
+    if (cache_try(conn, resp, key, 0, resp->last_modified, 0)!=NXWEB_MISS) return NXWEB_OK; // access already counted
 
-    nxweb_cache_rec* rec=nx_calloc(sizeof(nxweb_cache_rec)+resp->content_length+1+strlen(key)+1);
+    size_t size=sizeof(nxweb_cache_rec)+resp->content_length+1+strlen(key)+1;
+    nxweb_cache_rec* rec=nx_calloc(size);
 
-    rec->expires_time=loop_time+NXWEB_DEFAULT_CACHED_TIME;
+    rec->size=size;
+    rec->hash=hash_sdbm((const unsigned char*)key);
+    rec->ttl=conn->handler && conn->handler->memcache_ttl? conn->handler->memcache_ttl*1000LL : mc->ttl;
+    rec->expires_time=loop_time+rec->ttl;
     rec->last_modified=resp->last_modified;
     rec->content_type=resp->content_type;       // assume content_type and content_charset come
     rec->content_charset=resp->content_charset; // from statically allocated memory, which won't go away
@@ -224,44 +685,42 @@ nxweb_result nxweb_cache_store_response(nxweb_http_server_connection* conn, nxwe
     strcpy(ptr, key);
     key=ptr;
 
+    nxweb_cache_shard* shard=cache_shard(rec->hash);
     int ret=0;
     ah_iter_t ci;
-    pthread_mutex_lock(&_nxweb_cache_mutex);
-    ci=alignhash_set(nxweb_cache, _nxweb_cache, key, &ret);
-    if (ci!=alignhash_end(_nxweb_cache)) {
+    pthread_rwlock_wrlock(&shard->lock);
+    ci=alignhash_set(nxweb_cache, shard->hash, key, &ret);
+    if (ci!=alignhash_end(shard->hash)) {
       if (ret!=AH_INS_ERR) {
-        alignhash_value(_nxweb_cache, ci)=rec;
-        cache_rec_link(rec);
-        rec->ref_count++;
-        cache_check_size();
-        pthread_mutex_unlock(&_nxweb_cache_mutex);
+        alignhash_value(shard->hash, ci)=rec;
+        rec->ref_count=2; // one for the cache, one for this request
+        rec->in_window=1;
+        cache_ring_insert(&shard->window_hand, rec);
+        shard->window_size+=size;
+        cache_evict(shard, loop_time);
+        pthread_rwlock_unlock(&shard->lock);
         nxweb_log_info("memcached %s", key);
-        conn->hsp.req_data=rec;
         assert(!conn->hsp.req_finalize);
-        conn->hsp.req_finalize=cache_rec_unref;
+        cache_serve_rec(conn, resp, rec);
         //nxweb_start_sending_response(conn, resp);
         return NXWEB_OK;
       }
       else { // AH_INS_ERR => key already exists (added by other thread)
         nx_free(rec);
-        rec=alignhash_value(_nxweb_cache, ci);
-        resp->content_length=rec->content_length;
-        resp->content=rec->content;
-        resp->content_type=rec->content_type;
-        resp->content_charset=rec->content_charset;
-        resp->last_modified=rec->last_modified;
-        resp->gzip_encoded=rec->gzip_encoded;
-        rec->ref_count++;
-        pthread_mutex_unlock(&_nxweb_cache_mutex);
-        conn->hsp.req_data=rec;
+        rec=alignhash_value(shard->hash, ci);
+        __sync_add_and_fetch(&rec->ref_count, 1);
+        pthread_rwlock_unlock(&shard->lock);
         assert(!conn->hsp.req_finalize);
-        conn->hsp.req_finalize=cache_rec_unref;
+        cache_serve_rec(conn, resp, rec);
         //nxweb_start_sending_response(conn, resp);
         return NXWEB_OK;
       }
     }
-    pthread_mutex_unlock(&_nxweb_cache_mutex);
+    pthread_rwlock_unlock(&shard->lock);
     nx_free(rec);
   }
+  else if (resp->status_code==200 && resp->cache_key && *resp->cache_key) {
+    cache_capture_response(conn, &conn->hsp.rq->req, resp);
+  }
   return NXWEB_OK;
-}
\ No newline at end of file
+}
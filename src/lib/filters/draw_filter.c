@@ -184,7 +184,7 @@ static nxweb_filter* draw_config(nxweb_filter* base, const nx_json* json) {
 static nxweb_filter_draw draw_filter={.base={
         .config=draw_config,
         .init=draw_init, .finalize=draw_finalize,
-        .do_filter=draw_do_filter}};
+        .do_filter=draw_do_filter, .needs_identity=1}};
 
 NXWEB_DEFINE_FILTER(draw, draw_filter.base);
 
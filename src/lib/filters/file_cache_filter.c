@@ -94,6 +94,7 @@ typedef struct fc_filter_data {
   struct stat cache_finfo;
   int input_fd;
   nxd_fbuffer fb;
+  int tee_fd[2]; // pipe receiving copy of spliced content
   fc_file_header hdr;
 } fc_filter_data;
 
@@ -281,6 +282,27 @@ static int fc_store_append(fc_filter_data* fcdata, const void* ptr, nxe_size_t s
   return 0;
 }
 
+// moves size bytes from tee pipe into cache file; drains extra bytes that have been teed but not consumed downstream
+static int fc_store_splice(fc_filter_data* fcdata, nxe_size_t size, nxe_size_t extra) {
+  while (size>0) {
+    nxe_ssize_t bytes_moved=splice(fcdata->tee_fd[0], 0, fcdata->fd, 0, size, SPLICE_F_MOVE);
+    if (bytes_moved<=0) {
+      nxweb_log_error("fc_store_splice(): can't splice %ld bytes into cache file %s", size, fcdata->tmp_fpath);
+      fc_store_abort(fcdata);
+      extra+=size;
+      break;
+    }
+    size-=bytes_moved;
+  }
+  char buf[4096];
+  while (extra>0) {
+    nxe_ssize_t bytes_read=read(fcdata->tee_fd[0], buf, extra<sizeof(buf)? extra : sizeof(buf));
+    if (bytes_read<=0) return -1;
+    extra-=bytes_read;
+  }
+  return 0;
+}
+
 static int fc_store_close(fc_filter_data* fcdata) {
   struct timeval mtimes[2]={
     {.tv_sec=fcdata->expires_time},
@@ -343,7 +365,31 @@ static nxe_ssize_t fc_data_in_write_or_sendfile(nxe_ostream* os, nxe_istream* is
     if (next_os) {
       nxe_flags_t wflags=*flags;
       if (next_os->ready) {
-        if (fd) { // invoked as sendfile
+        if (fd && *flags&NXEF_PIPE) { // content comes in pipe
+          nxe_ssize_t bytes_teed=0;
+          if (size>0 && fcdata->fd && fcdata->fd!=-1) {
+            if (!fcdata->tee_fd[0] && pipe2(fcdata->tee_fd, O_NONBLOCK|O_CLOEXEC)==-1) {
+              nxweb_log_error("fc_data_in_write_or_sendfile(): can't create tee pipe errno=%d", errno);
+              fcdata->tee_fd[0]=fcdata->tee_fd[1]=0;
+              fc_store_abort(fcdata);
+            }
+            else if ((bytes_teed=tee(fd, fcdata->tee_fd[1], size, SPLICE_F_NONBLOCK))<=0) {
+              nxweb_log_error("fc_data_in_write_or_sendfile(): tee() failed errno=%d", errno);
+              bytes_teed=0;
+              fc_store_abort(fcdata);
+            }
+          }
+          if (bytes_teed) { // only pass on what has been copied into tee pipe
+            if (bytes_teed<size) wflags&=~NXEF_EOF;
+            bytes_sent=OSTREAM_CLASS(next_os)->write(next_os, &fcdata->data_out, fd, fr, ptr, bytes_teed, &wflags);
+            if (bytes_sent<0) bytes_sent=0;
+            fc_store_splice(fcdata, bytes_sent, bytes_teed-bytes_sent);
+          }
+          else {
+            bytes_sent=OSTREAM_CLASS(next_os)->write(next_os, &fcdata->data_out, fd, fr, ptr, size, &wflags);
+          }
+        }
+        else if (fd) { // invoked as sendfile
           bytes_sent=OSTREAM_CLASS(next_os)->write(next_os, &fcdata->data_out, fd, fr, ptr, size, &wflags);
           if (bytes_sent>0 && fcdata->fd && fcdata->fd!=-1) {
             char* buf=malloc(bytes_sent);
@@ -414,6 +460,11 @@ void _nxweb_fc_finalize(fc_filter_data* fcdata) {
     if (fcdata->tmp_fpath) unlink(fcdata->tmp_fpath);
   }
   nxd_fbuffer_finalize(&fcdata->fb);
+  if (fcdata->tee_fd[0]) {
+    close(fcdata->tee_fd[0]);
+    close(fcdata->tee_fd[1]);
+    fcdata->tee_fd[0]=fcdata->tee_fd[1]=0;
+  }
   if (fcdata->input_fd && fcdata->input_fd!=-1) {
     close(fcdata->input_fd);
   }
@@ -625,7 +676,8 @@ static nxweb_filter_file_cache file_cache_filter={.base={
         .config=fc_config,
         .init=fc_init, .finalize=fc_finalize,
         .translate_cache_key=fc_translate_cache_key,
-        .serve_from_cache=fc_serve_from_cache, .do_filter=fc_do_filter}};
+        .serve_from_cache=fc_serve_from_cache, .do_filter=fc_do_filter,
+        .splice_passthrough=1}};
 
 NXWEB_DEFINE_FILTER(file_cache, file_cache_filter.base);
 
@@ -867,7 +867,7 @@ static nxweb_filter_image image_filter={.base={
         .config=img_config,
         .init=img_init, .finalize=img_finalize,
         .translate_cache_key=img_translate_cache_key,
-        .decode_uri=img_decode_uri, .do_filter=img_do_filter},
+        .decode_uri=img_decode_uri, .do_filter=img_do_filter, .needs_identity=1},
         .allowed_cmds=default_allowed_cmds, .sign_key=CMD_SIGN_SECRET_KEY};
 
 NXWEB_DEFINE_FILTER(image, image_filter.base);
@@ -439,6 +439,6 @@ static nxweb_result ssi_do_filter(nxweb_filter* filter, nxweb_http_server_connec
 }
 
 nxweb_filter ssi_filter={.init=ssi_init, .finalize=ssi_finalize,
-        .do_filter=ssi_do_filter};
+        .do_filter=ssi_do_filter, .needs_identity=1};
 
 NXWEB_DEFINE_FILTER(ssi, ssi_filter);
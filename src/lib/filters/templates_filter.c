@@ -68,7 +68,7 @@ static void tf_check_complete(tf_filter_data* tfdata) {
     nxt_serialize_to_cs(ctx, tfdata->cs);
     nxweb_composite_stream_close(tfdata->cs);
 
-    nxweb_http_request* req=&tfdata->conn->hsp.req;
+    nxweb_http_request* req=&tfdata->conn->hsp.rq->req;
     nxweb_http_response* resp=tfdata->conn->hsp.resp;
 
     resp->last_modified=tfdata->last_modified;
@@ -160,9 +160,9 @@ static void tf_on_subrequest_ready(nxweb_http_server_connection* subconn, nxe_da
 
   nxweb_log_debug("tf_on_subrequest_ready");
 
-  //nxweb_http_request* subreq=&subconn->hsp.req;
+  //nxweb_http_request* subreq=&subconn->hsp.rq->req;
   //nxweb_http_server_connection* conn=subconn->parent;
-  //nxweb_http_request* req=&conn->hsp.req;
+  //nxweb_http_request* req=&conn->hsp.rq->req;
   nxweb_http_response* resp=subconn->hsp.resp;
 
   tf_buffer* tfb=data.ptr;
@@ -187,7 +187,7 @@ static void tf_on_subrequest_ready(nxweb_http_server_connection* subconn, nxe_da
   else {
     // subrequest error
     // this might happen after first successful call to tf_on_subrequest_ready()
-    nxweb_log_warning("templates subrequest failed: %s%s ref: %s", subconn->hsp.req.host, subconn->hsp.req.uri, subconn->parent->hsp.req.uri);
+    nxweb_log_warning("templates subrequest failed: %s%s ref: %s", subconn->hsp.rq->req.host, subconn->hsp.rq->req.uri, subconn->parent->hsp.rq->req.uri);
     nxb_unfinish_stream(tfb->nxb); // clean up in case we have already started collecting response
     tfdata->ctx->files_pending--;
     tf_check_complete(tfdata);
@@ -213,7 +213,7 @@ static int tf_load(nxt_context* ctx, const char* uri, nxt_file* dst_file, nxt_bl
   }
   nxweb_http_server_connection* subconn=nxweb_http_server_subrequest_start(tfdata->conn, tf_on_subrequest_ready, (nxe_data)(void*)tfb, 0, uri);
   if (!subconn) return NXWEB_ERROR;
-  nxweb_http_request* subreq=&subconn->hsp.req;
+  nxweb_http_request* subreq=&subconn->hsp.rq->req;
   nxweb_set_request_data(subreq, (nxe_data)0, (nxe_data)(void*)tfb, tf_subreq_finalize);
   if (dst_file) subreq->templates_no_parse=1;
   return NXWEB_OK;
@@ -307,6 +307,6 @@ static nxweb_result tf_do_filter(nxweb_filter* filter, nxweb_http_server_connect
 }
 
 nxweb_filter templates_filter={.init=tf_init, .finalize=tf_finalize,
-        .translate_cache_key=tf_translate_cache_key, .do_filter=tf_do_filter};
+        .translate_cache_key=tf_translate_cache_key, .do_filter=tf_do_filter, .needs_identity=1};
 
 NXWEB_DEFINE_FILTER(templates, templates_filter);
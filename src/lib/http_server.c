@@ -26,6 +26,7 @@
 #include <pthread.h>
 #include <unistd.h>
 #include <errno.h>
+#include <limits.h>
 #include <signal.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -39,6 +40,15 @@
 
 struct nxweb_server_config nxweb_server_config={
   .shutdown_timeout=5,
+  .workers_per_thread=NXWEB_WORKERS_PER_FACTORY,
+  .admission={.fd_reserve=NXWEB_DEFAULT_FD_RESERVE},
+  .memcache={.size=NXWEB_DEFAULT_MEMCACHE_SIZE, .max_item_size=NXWEB_DEFAULT_MAX_CACHED_ITEM_SIZE, .ttl=NXWEB_DEFAULT_CACHED_TIME},
+  .http_proxy_pool_config={[0 ... NXWEB_MAX_PROXY_POOLS-1]={.health={
+    .max_fails=NXWEB_DEFAULT_PROXY_MAX_FAILS,
+    .fail_timeout=NXWEB_DEFAULT_PROXY_FAIL_TIMEOUT,
+    .slow_start=NXWEB_DEFAULT_PROXY_SLOW_START
+  }, .max_queue=NXWEB_DEFAULT_PROXY_MAX_QUEUE, .queue_timeout=NXWEB_DEFAULT_PROXY_QUEUE_TIMEOUT,
+    .max_local_idle=NXWEB_DEFAULT_PROXY_MAX_LOCAL_IDLE}},
   .access_log_on_request_received=nxweb_access_log_on_request_received,
   .access_log_on_request_complete=nxweb_access_log_on_request_complete,
   .access_log_on_proxy_response=nxweb_access_log_on_proxy_response
@@ -349,6 +359,7 @@ void _nxweb_register_handler(nxweb_handler* handler, nxweb_handler* base) {
     if (!handler->on_complete) handler->on_complete=base->on_complete;
     if (!handler->on_error) handler->on_error=base->on_error;
     if (!handler->flags) handler->flags=base->flags;
+    if (!handler->worker_class) handler->worker_class=base->worker_class;
   }
   int i;
   nxweb_filter* filter;
@@ -382,27 +393,25 @@ void _nxweb_register_handler(nxweb_handler* handler, nxweb_handler* base) {
 static void invoke_request_handler_in_worker(void* ptr) {
   nxweb_http_server_connection* conn=ptr;
   if (conn && conn->handler && conn->handler->on_request) {
-    conn->handler->on_request(conn, &conn->hsp.req, &conn->hsp._resp);
-    nxd_http_server_proto_finish_response(&conn->hsp._resp);
+    conn->handler->on_request(conn, &conn->hsp.rq->req, &conn->hsp.rq->_resp);
+    nxd_http_server_proto_finish_response(&conn->hsp.rq->_resp);
   }
   else {
     nxweb_log_error("invalid conn handler reached worker");
   }
 }
 
-static void nxweb_http_server_connection_worker_complete_on_message(nxe_subscriber* sub, nxe_publisher* pub, nxe_data data) {
-  nxweb_http_server_connection* conn=OBJ_PTR_FROM_FLD_PTR(nxweb_http_server_connection, worker_complete, sub);
-  nxe_unsubscribe(conn->worker_complete.pub, &conn->worker_complete);
-  __sync_synchronize(); // full memory barrier
+static void nxweb_http_server_connection_worker_complete(nxw_job* job) {
+  nxweb_http_server_connection* conn=OBJ_PTR_FROM_FLD_PTR(nxweb_http_server_connection, worker_job, job);
   conn->in_worker=0;
-  long cnt=0;
-  while (!conn->worker_job_done) cnt++;
-  if (cnt) nxweb_log_warning("job not done in %ld steps", cnt);
+  if (job->expired && !conn->connection_closing) { // handler has not been invoked; too long in worker class queue
+    nxweb_send_http_error(&conn->hsp.rq->_resp, 503, "Service Unavailable");
+  }
   if (conn->connection_closing) {
     nxweb_http_server_connection_finalize(conn, 0);
   }
   else {
-    nxweb_start_sending_response(conn, &conn->hsp._resp);
+    nxweb_start_sending_response(conn, &conn->hsp.rq->_resp);
   }
 }
 
@@ -415,14 +424,15 @@ static inline nxweb_result invoke_request_handler(nxweb_http_server_connection*
   nxweb_result res=NXWEB_OK;
   if (h->on_request) {
     if (flags&NXWEB_INWORKER) {
-      nxw_worker* w=nxw_get_worker(&conn->tdata->workers_factory);
-      if (!w) {
+      conn->worker_job.do_job=invoke_request_handler_in_worker;
+      conn->worker_job.on_complete=nxweb_http_server_connection_worker_complete;
+      conn->worker_job.job_param=conn;
+      conn->worker_job.job_class=h->worker_class;
+      if (nxw_submit_job(&conn->tdata->workers_factory, &conn->worker_job)) {
         nxweb_send_http_error(resp, 503, "Service Unavailable");
         nxweb_start_sending_response(conn, resp);
         return NXWEB_ERROR;
       }
-      nxe_subscribe(conn->tdata->loop, &w->complete_efs.data_notify, &conn->worker_complete);
-      nxw_start_worker(w, invoke_request_handler_in_worker, conn, &conn->worker_job_done);
       conn->in_worker=1;
     }
     else {
@@ -434,11 +444,54 @@ static inline nxweb_result invoke_request_handler(nxweb_http_server_connection*
   return res;
 }
 
+static _Bool nxweb_is_overloaded(nxweb_net_thread_data* tdata) {
+  const nxweb_admission_config* ac=&nxweb_server_config.admission;
+  if (ac->max_in_flight && tdata->in_flight>=ac->max_in_flight) return 1;
+  if (ac->max_worker_queue && nxw_queue_depth(&tdata->workers_factory)>=ac->max_worker_queue) return 1;
+  if (ac->max_loop_lag && tdata->loop_lag>ac->max_loop_lag) return 1;
+  return 0;
+}
+
+static const char overload_response_body[]="<html>\n<head><title>Service Unavailable</title></head>\n<body>\n"
+                                           "<h1>Service Unavailable</h1>\n<p>nxweb/" REVISION "</p>\n</body>\n</html>";
+
+static void nxweb_send_overload_response(nxweb_http_server_connection* conn, nxweb_http_response* resp) {
+  // no formatting, no handler callbacks, no filters
+  nxweb_set_response_status(resp, 503, "Service Unavailable");
+  resp->content=overload_response_body;
+  resp->content_length=sizeof(overload_response_body)-1;
+  resp->content_type="text/html";
+  resp->extra_raw_headers="Retry-After: 1\r\n";
+  resp->keep_alive=0; // shed connection as well
+  conn->tdata->requests_shed++;
+  nxweb_start_sending_response(conn, resp);
+}
+
+static void set_forwarded_remote_addr(nxweb_http_server_connection* conn, nxweb_http_request* req) {
+  // connection came through unix socket from local front end; it passes client address in a header
+  const char* hdr=nxweb_server_config.listen_config[conn->lconf_idx].forwarded_header;
+  const char* addr=hdr? nxweb_get_request_header(req, hdr) : 0;
+  if (!addr) {
+    strcpy(conn->remote_addr, "unix:"); // reset what previous request on this connection might have set
+    return;
+  }
+  // take last address: the one appended by our front end; earlier ones come from client and can't be trusted
+  const char* p=strrchr(addr, ',');
+  if (p) addr=p+1;
+  while (*addr==' ' || *addr=='\t') addr++;
+  int len=strlen(addr);
+  while (len && (addr[len-1]==' ' || addr[len-1]=='\t')) len--;
+  if (len>=sizeof(conn->remote_addr)) len=sizeof(conn->remote_addr)-1;
+  memcpy(conn->remote_addr, addr, len);
+  conn->remote_addr[len]='\0';
+}
+
 static void nxweb_http_server_connection_events_sub_on_message(nxe_subscriber* sub, nxe_publisher* pub, nxe_data data) {
   nxweb_http_server_connection* conn=(nxweb_http_server_connection*)((char*)sub-offsetof(nxweb_http_server_connection, events_sub));
   //nxe_loop* loop=sub->super.loop;
-  nxweb_http_request* req=&conn->hsp.req;
-  nxweb_http_response* resp=&conn->hsp._resp;
+  nxd_http_server_proto_request* rq=conn->hsp.rq; // null on idle connection
+  nxweb_http_request* req=rq? &rq->req : 0;
+  nxweb_http_response* resp=rq? &rq->_resp : 0;
   if (data.i==NXD_HSP_REQUEST_RECEIVED) {
     assert(nxweb_server_config.request_dispatcher);
     assert(nxweb_server_config.access_log_on_request_received);
@@ -446,7 +499,17 @@ static void nxweb_http_server_connection_events_sub_on_message(nxe_subscriber* s
     nxweb_log_debug("nxweb_http_server_connection_events_sub_on_message NXD_HSP_REQUEST_RECEIVED");
 
     req->received_time=nxweb_get_loop_time(conn);
+    if (!conn->parent && nxweb_server_config.listen_config[conn->lconf_idx].unix_socket) set_forwarded_remote_addr(conn, req);
     nxweb_server_config.access_log_on_request_received(conn, req);
+    if (!conn->parent) {
+      if (nxweb_is_overloaded(conn->tdata)) {
+        conn->handler=&nxweb_default_handler;
+        nxweb_send_overload_response(conn, resp);
+        return;
+      }
+      conn->admitted=1;
+      conn->tdata->in_flight++;
+    }
     nxweb_server_config.request_dispatcher(conn, req, resp);
     if (!conn->handler) conn->handler=&nxweb_default_handler;
 
@@ -488,8 +551,8 @@ static void nxweb_http_server_connection_events_sub_on_message(nxe_subscriber* s
           return;
         }
         nxe_loop* loop=conn->tdata->loop;
-        nxd_ibuffer_init(&conn->ib, conn->hsp.nxb, req->content_length>0? req->content_length+1 : NXWEB_MAX_REQUEST_BODY_SIZE);
-        conn->hsp.cls->connect_request_body_out(&conn->hsp, &conn->ib.data_in);
+        nxd_ibuffer_init(&conn->hsp.rq->ib, conn->hsp.nxb, req->content_length>0? req->content_length+1 : NXWEB_MAX_REQUEST_BODY_SIZE);
+        conn->hsp.cls->connect_request_body_out(&conn->hsp, &conn->hsp.rq->ib.data_in);
         conn->hsp.cls->start_receiving_request_body(&conn->hsp);
         req->buffering_to_memory=1;
       }
@@ -506,9 +569,9 @@ static void nxweb_http_server_connection_events_sub_on_message(nxe_subscriber* s
     nxweb_handler* h=conn->handler;
     nxweb_handler_flags flags=h->flags;
     if (h->on_post_data_complete) h->on_post_data_complete(conn, req, resp);
-    if (req->buffering_to_memory && conn->hsp.cls->get_request_body_out_pair(&conn->hsp)==&conn->ib.data_in) {
+    if (req->buffering_to_memory && conn->hsp.cls->get_request_body_out_pair(&conn->hsp)==&conn->hsp.rq->ib.data_in) {
       int size;
-      req->content=nxd_ibuffer_get_result(&conn->ib, &size);
+      req->content=nxd_ibuffer_get_result(&conn->hsp.rq->ib, &size);
       assert(req->content_received==size);
     }
     invoke_request_handler(conn, req, resp, h, flags);
@@ -517,6 +580,10 @@ static void nxweb_http_server_connection_events_sub_on_message(nxe_subscriber* s
 
     nxweb_log_debug("nxweb_http_server_connection_events_sub_on_message NXD_HSP_REQUEST_COMPLETE");
 
+    if (conn->admitted) {
+      conn->admitted=0;
+      conn->tdata->in_flight--;
+    }
     conn->hsp.cls->request_cleanup(sub->super.loop, &conn->hsp);
     assert(!conn->handler);
   }
@@ -543,7 +610,6 @@ static void nxweb_http_server_connection_events_sub_on_message(nxe_subscriber* s
 }
 
 static const nxe_subscriber_class nxweb_http_server_connection_events_sub_class={.on_message=nxweb_http_server_connection_events_sub_on_message};
-static const nxe_subscriber_class nxweb_http_server_connection_worker_complete_class={.on_message=nxweb_http_server_connection_worker_complete_on_message};
 
 void nxweb_start_sending_response(nxweb_http_server_connection* conn, nxweb_http_response* resp) {
 
@@ -552,7 +618,7 @@ void nxweb_start_sending_response(nxweb_http_server_connection* conn, nxweb_http
   if (conn->handler && conn->handler->num_filters) {
     // run filters
     int i;
-    nxweb_http_request* req=&conn->hsp.req;
+    nxweb_http_request* req=&conn->hsp.rq->req;
     nxweb_filter* filter;
     nxweb_filter_data* fdata;
     nxweb_filter** filters=conn->handler->filters;
@@ -576,24 +642,23 @@ void nxweb_start_sending_response(nxweb_http_server_connection* conn, nxweb_http
 }
 
 static void nxweb_http_server_connection_init(nxweb_http_server_connection* conn, nxweb_net_thread_data* tdata, int lconf_idx) {
-  memset(conn, 0, sizeof(nxweb_http_server_connection));
+  memset(conn, 0, NXWEB_PLAIN_CONNECTION_SIZE);
   conn->tdata=tdata;
   conn->lconf_idx=lconf_idx;
-  nxd_http_server_proto_init(&conn->hsp, tdata->free_conn_nxb_pool);
+  nxd_http_server_proto_init(&conn->hsp, tdata->free_conn_nxb_pool, tdata->free_conn_rq_pool);
 #ifdef WITH_SSL
   nxweb_server_listen_config* lconf=&nxweb_server_config.listen_config[conn->lconf_idx];
   if (lconf->secure) {
     conn->secure=1;
-    nxd_ssl_server_socket_init(&conn->sock, lconf->x509_cred, lconf->priority_cache, &lconf->session_ticket_key);
+    nxd_ssl_server_socket_init(&conn->ssl_sock, lconf->x509_cred, lconf->priority_cache, &lconf->session_ticket_key);
   }
   else {
-    nxd_socket_init((nxd_socket*)&conn->sock);
+    nxd_socket_init(&conn->sock);
   }
 #else
   nxd_socket_init(&conn->sock);
 #endif // WITH_SSL
   conn->events_sub.super.cls.sub_cls=&nxweb_http_server_connection_events_sub_class;
-  conn->worker_complete.super.cls.sub_cls=&nxweb_http_server_connection_worker_complete_class;
 }
 
 static void nxweb_http_server_connection_connect(nxweb_http_server_connection* conn, nxe_loop* loop, int fd) {
@@ -612,9 +677,15 @@ static void nxweb_http_server_connection_connect(nxweb_http_server_connection* c
 static void nxweb_http_server_connection_do_finalize(nxweb_http_server_connection* conn, int good) {
   //nxe_loop* loop=conn->sock.fs.data_is.super.loop;
   nxweb_http_server_connection_finalize_subrequests(conn, good);
-  if (conn->worker_complete.pub) nxe_unsubscribe(conn->worker_complete.pub, &conn->worker_complete);
+  if (conn->admitted) conn->tdata->in_flight--;
   conn->hsp.cls->finalize(&conn->hsp);
-  if (conn->sock.cls) conn->sock.cls->finalize((nxd_socket*)&conn->sock, good);
+  if (conn->sock.cls) conn->sock.cls->finalize(&conn->sock, good);
+#ifdef WITH_SSL
+  if (conn->secure && !conn->parent) {
+    nxp_free(conn->tdata->free_ssl_conn_pool, conn);
+    return;
+  }
+#endif // WITH_SSL
   nxp_free(conn->tdata->free_conn_pool, conn);
   //if (!__sync_sub_and_fetch(&num_connections, 1)) nxweb_log_info("all connections closed");
 }
@@ -666,7 +737,7 @@ nxweb_http_server_connection* nxweb_http_server_subrequest_start(nxweb_http_serv
   nxe_loop* loop=parent_conn->tdata->loop;
   nxweb_http_server_connection* conn=nxp_alloc(tdata->free_conn_pool);
   //nxweb_http_server_connection_init(conn, tdata, lconf_idx);
-  memset(conn, 0, sizeof(nxweb_http_server_connection));
+  memset(conn, 0, NXWEB_PLAIN_CONNECTION_SIZE);
   conn->uid=nxweb_generate_unique_id();
   conn->connected_time=loop->current_time;
   conn->secure=parent_conn->secure;
@@ -676,14 +747,13 @@ nxweb_http_server_connection* nxweb_http_server_subrequest_start(nxweb_http_serv
   parent_conn->subrequests=conn;
   conn->on_response_ready=on_response_ready;
   conn->on_response_ready_data=on_response_ready_data;
-  nxd_http_server_proto_subrequest_init(&conn->hsp, tdata->free_conn_nxb_pool);
+  nxd_http_server_proto_subrequest_init(&conn->hsp, tdata->free_conn_nxb_pool, tdata->free_conn_rq_pool);
   conn->events_sub.super.cls.sub_cls=&nxweb_http_server_connection_events_sub_class;
-  conn->worker_complete.super.cls.sub_cls=&nxweb_http_server_connection_worker_complete_class;
   memcpy(conn->remote_addr, parent_conn->remote_addr, sizeof(conn->remote_addr));
   //nxweb_http_server_connection_connect(conn, loop, client_fd);
   nxe_subscribe(loop, &conn->hsp.events_pub, &conn->events_sub);
-  if (!host) host=parent_conn->hsp.req.host;
-  nxweb_http_server_proto_subrequest_execute(&conn->hsp, host, uri, &parent_conn->hsp.req);
+  if (!host) host=parent_conn->hsp.rq->req.host;
+  nxweb_http_server_proto_subrequest_execute(&conn->hsp, host, uri, &parent_conn->hsp.rq->req);
   return conn;
 }
 
@@ -709,6 +779,7 @@ static void on_net_thread_shutdown(nxe_subscriber* sub, nxe_publisher* pub, nxe_
   nxe_finalize_eventfd_source(&tdata->shutdown_efs);
   nxe_unregister_eventfd_source(&tdata->diagnostics_efs);
   nxe_finalize_eventfd_source(&tdata->diagnostics_efs);
+  nxe_unset_timer(tdata->loop, 0, &tdata->lag_timer);
 
   nxw_finalize_factory(&tdata->workers_factory);
 
@@ -722,7 +793,11 @@ static void on_net_thread_shutdown(nxe_subscriber* sub, nxe_publisher* pub, nxe_
 
 static void on_net_thread_diagnostics(nxe_subscriber* sub, nxe_publisher* pub, nxe_data data) {
 
+  nxweb_net_thread_data* tdata=(nxweb_net_thread_data*)((char*)sub-offsetof(nxweb_net_thread_data, diagnostics_sub));
+
   nxweb_log_error("net thread diagnostics begin");
+  nxweb_log_error("in_flight=%d worker_queue=%d loop_lag=%ldus shed=%lu accept_paused=%d", tdata->in_flight,
+          nxw_queue_depth(&tdata->workers_factory), (long)tdata->loop_lag, tdata->requests_shed, (int)tdata->accept_paused);
 
   nxweb_module* mod=nxweb_server_config.module_list;
   while (mod) {
@@ -737,9 +812,12 @@ static void on_net_thread_diagnostics(nxe_subscriber* sub, nxe_publisher* pub, n
 static void on_net_thread_gc(nxe_subscriber* sub, nxe_publisher* pub, nxe_data data) {
   nxweb_net_thread_data* tdata=(nxweb_net_thread_data*)((char*)sub-offsetof(nxweb_net_thread_data, gc_sub));
   nxp_gc(tdata->free_conn_pool);
+#ifdef WITH_SSL
+  nxp_gc(tdata->free_ssl_conn_pool);
+#endif
   nxp_gc(tdata->free_conn_nxb_pool);
+  nxp_gc(tdata->free_conn_rq_pool);
   nxp_gc(tdata->free_rbuf_pool);
-  nxw_gc_factory(&tdata->workers_factory);
   nxweb_access_log_thread_flush();
 }
 
@@ -747,23 +825,44 @@ static void accept_connection(nxe_loop* loop, nxweb_http_server_listening_socket
   //static int next_net_thread_idx=0;
   //nxweb_accept accept_msg;
   int client_fd;
-  struct sockaddr_in client_addr;
+  struct sockaddr_storage client_addr;
   socklen_t client_len=sizeof(client_addr);
   nxe_unset_timer(loop, NXWEB_TIMER_ACCEPT_RETRY, &lsock->accept_retry_timer);
+  int lconf_idx=lsock->idx;
+  nxweb_net_thread_data* tdata=(nxweb_net_thread_data*)((char*)(lsock-lconf_idx)-offsetof(nxweb_net_thread_data, listening_sock));
+  tdata->accept_paused=0;
   while (!shutdown_in_progress) {
-    client_fd=accept4(lsock->listen_source.fd, (struct sockaddr *)&client_addr, &client_len, SOCK_NONBLOCK);
+    if (nxweb_is_overloaded(tdata)) {
+      // leave connections in listen queue (or to other net threads); retry after timeout
+      tdata->accept_paused=1;
+      nxe_set_timer(loop, NXWEB_TIMER_ACCEPT_RETRY, &lsock->accept_retry_timer);
+      break;
+    }
+    client_len=sizeof(client_addr);
+    client_fd=nxe_accept(&lsock->listen_source, (struct sockaddr *)&client_addr, &client_len);
     if (client_fd!=-1) {
-      if (/*_nxweb_set_non_block(client_fd) ||*/ _nxweb_setup_client_socket(client_fd)) {
+      if (/*_nxweb_set_non_block(client_fd) ||*/ (client_addr.ss_family!=AF_UNIX && _nxweb_setup_client_socket(client_fd))) {
         _nxweb_close_bad_socket(client_fd);
         nxweb_log_error("failed to setup client socket");
         continue;
       }
-      int lconf_idx=lsock->idx;
-      nxweb_net_thread_data* tdata=(nxweb_net_thread_data*)((char*)(lsock-lconf_idx)-offsetof(nxweb_net_thread_data, listening_sock));
+#ifdef WITH_SSL
+      nxweb_http_server_connection* conn=nxp_alloc(nxweb_server_config.listen_config[lconf_idx].secure? tdata->free_ssl_conn_pool : tdata->free_conn_pool);
+#else
       nxweb_http_server_connection* conn=nxp_alloc(tdata->free_conn_pool);
+#endif
       nxweb_http_server_connection_init(conn, tdata, lconf_idx);
-      inet_ntop(AF_INET, &client_addr.sin_addr, conn->remote_addr, sizeof(conn->remote_addr));
+      if (client_addr.ss_family==AF_INET6) inet_ntop(AF_INET6, &((struct sockaddr_in6*)&client_addr)->sin6_addr, conn->remote_addr, sizeof(conn->remote_addr));
+      else if (client_addr.ss_family==AF_INET) inet_ntop(AF_INET, &((struct sockaddr_in*)&client_addr)->sin_addr, conn->remote_addr, sizeof(conn->remote_addr));
+      else strcpy(conn->remote_addr, "unix:"); // real one comes with request headers; see set_forwarded_remote_addr()
       nxweb_http_server_connection_connect(conn, loop, client_fd);
+      if (nxweb_server_config.admission.fd_reserve && client_fd>=nxweb_server_config.max_fd-nxweb_server_config.admission.fd_reserve) {
+        // running out of file descriptors (new fd is always the lowest available)
+        nxweb_log_warning("fd limit is close (fd=%d); pausing accept", client_fd);
+        tdata->accept_paused=1;
+        nxe_set_timer(loop, NXWEB_TIMER_ACCEPT_RETRY, &lsock->accept_retry_timer);
+        break;
+      }
     }
     else {
       if (errno!=EAGAIN) {
@@ -782,12 +881,14 @@ static void on_listen_event(nxe_subscriber* sub, nxe_publisher* pub, nxe_data da
     return;
   }
   nxweb_http_server_listening_socket* lsock=OBJ_PTR_FROM_FLD_PTR(nxweb_http_server_listening_socket, listen_sub, sub);
+  if (lsock->accept_retry_timer.next) return; // accept paused or failed; wait for retry timer
   accept_connection(sub->super.loop, lsock);
 }
 
 static void accept_retry_on_timeout(nxe_timer* timer, nxe_data data) {
   nxweb_http_server_listening_socket* lsock=OBJ_PTR_FROM_FLD_PTR(nxweb_http_server_listening_socket, accept_retry_timer, timer);
-  nxweb_log_info("retrying accept after an error");
+  nxweb_net_thread_data* tdata=(nxweb_net_thread_data*)((char*)(lsock-lsock->idx)-offsetof(nxweb_net_thread_data, listening_sock));
+  if (!tdata->accept_paused) nxweb_log_info("retrying accept after an error");
   accept_connection(timer->super.loop, lsock);
 }
 
@@ -797,6 +898,18 @@ static const nxe_subscriber_class diagnostics_sub_class={.on_message=on_net_thre
 static const nxe_subscriber_class gc_sub_class={.on_message=on_net_thread_gc};
 static const nxe_timer_class accept_retry_timer_class={.on_timeout=accept_retry_on_timeout};
 
+static void lag_on_timeout(nxe_timer* timer, nxe_data data) {
+  nxweb_net_thread_data* tdata=OBJ_PTR_FROM_FLD_PTR(nxweb_net_thread_data, lag_timer, timer);
+  nxe_loop* loop=timer->super.loop;
+  nxe_time_t lag=loop->current_time>tdata->lag_check_time? loop->current_time-tdata->lag_check_time : 0;
+  tdata->loop_lag=(tdata->loop_lag*3+lag)/4; // smooth out
+  // keep checks on fixed time grid so they don't get in phase with blocking events
+  do tdata->lag_check_time+=NXWEB_LOOP_LAG_CHECK_INTERVAL; while (tdata->lag_check_time<=loop->current_time);
+  nxe_set_timer_usec(loop, timer, tdata->lag_check_time-loop->current_time);
+}
+
+static const nxe_timer_class lag_timer_class={.on_timeout=lag_on_timeout};
+
 static void* net_thread_main(void* ptr) {
   nxweb_net_thread_data* tdata=ptr;
   _nxweb_net_thread_data=tdata;
@@ -817,7 +930,7 @@ static void* net_thread_main(void* ptr) {
   for (i=0, lconf=nxweb_server_config.listen_config, lsock=tdata->listening_sock; i<NXWEB_MAX_LISTEN_SOCKETS; i++, lconf++, lsock++) {
     lsock->idx=i;
     if (lconf->listen_fd) {
-      nxe_init_listenfd_source(&lsock->listen_source, lconf->listen_fd, NXE_PUB_DEFAULT);
+      nxe_init_listenfd_source(&lsock->listen_source, lconf->reuseport? lconf->thread_fd[tdata->thread_num] : lconf->listen_fd, NXE_PUB_DEFAULT);
       nxe_register_listenfd_source(loop, &lsock->listen_source);
       nxe_init_subscriber(&lsock->listen_sub, &listen_sub_class);
       nxe_subscribe(loop, &lsock->listen_source.data_notify, &lsock->listen_sub);
@@ -836,18 +949,30 @@ static void* net_thread_main(void* ptr) {
   nxe_init_subscriber(&tdata->gc_sub, &gc_sub_class);
   nxe_subscribe(loop, &loop->gc_pub, &tdata->gc_sub);
 
-  tdata->free_conn_pool=nxp_create(sizeof(nxweb_http_server_connection), 8);
+  tdata->free_conn_pool=nxp_create(NXWEB_PLAIN_CONNECTION_SIZE, 8);
+#ifdef WITH_SSL
+  tdata->free_ssl_conn_pool=nxp_create(sizeof(nxweb_http_server_connection), 8);
+#endif
   tdata->free_conn_nxb_pool=nxp_create(NXWEB_CONN_NXB_SIZE, 8);
+  tdata->free_conn_rq_pool=nxp_create(sizeof(nxd_http_server_proto_request), 8);
   tdata->free_rbuf_pool=nxp_create(NXWEB_RBUF_SIZE, 2);
 
-  nxw_init_factory(&tdata->workers_factory, loop);
+  nxw_init_factory(&tdata->workers_factory, loop, nxweb_server_config.workers_per_thread);
+  nxe_init_timer(&tdata->lag_timer, &lag_timer_class);
+  if (nxweb_server_config.admission.max_loop_lag) {
+    tdata->lag_check_time=loop->current_time+NXWEB_LOOP_LAG_CHECK_INTERVAL;
+    nxe_set_timer_usec(loop, &tdata->lag_timer, NXWEB_LOOP_LAG_CHECK_INTERVAL);
+  }
+  for (i=1; i<NXWEB_MAX_WORKER_CLASSES; i++) {
+    nxweb_worker_class_config* wcc=&nxweb_server_config.worker_class_config[i];
+    if (wcc->name) nxw_setup_job_class(&tdata->workers_factory, i, wcc->max_concurrency, wcc->max_queue, wcc->queue_timeout);
+  }
 
   // initialize proxy pools:
   for (i=0; i<NXWEB_MAX_PROXY_POOLS; i++) {
-    if (nxweb_server_config.http_proxy_pool_config[i].host) {
-      nxd_http_proxy_pool_init(&tdata->proxy_pool[i], loop, tdata->free_conn_nxb_pool,
-              nxweb_server_config.http_proxy_pool_config[i].host,
-              nxweb_server_config.http_proxy_pool_config[i].saddr);
+    nxweb_http_proxy_pool_config* ppc=&nxweb_server_config.http_proxy_pool_config[i];
+    if (ppc->num_servers) {
+      nxd_http_proxy_pool_init(&tdata->proxy_pool[i], loop, tdata->free_conn_nxb_pool, ppc);
     }
   }
 
@@ -874,11 +999,15 @@ static void* net_thread_main(void* ptr) {
   }
 
   nxp_destroy(tdata->free_conn_pool);
+#ifdef WITH_SSL
+  nxp_destroy(tdata->free_ssl_conn_pool);
+#endif
   nxp_destroy(tdata->free_conn_nxb_pool);
+  nxp_destroy(tdata->free_conn_rq_pool);
   nxp_destroy(tdata->free_rbuf_pool);
 /*
   for (i=0; i<NXWEB_NUM_PROXY_POOLS; i++) {
-    if (nxweb_server_config.http_proxy_pool_config[i].host)
+    if (nxweb_server_config.http_proxy_pool_config[i].num_servers)
       nxd_http_proxy_pool_finalize(&tdata->proxy_pool[i]);
   }
 */
@@ -958,37 +1087,154 @@ void nxweb_set_timeout(enum nxweb_timers timer_idx, nxe_time_t timeout) {
   _nxe_timeouts[timer_idx]=timeout;
 }
 
+static void init_num_net_threads() {
+  if (_nxweb_num_net_threads) return;
+  _nxweb_num_net_threads=(int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (_nxweb_num_net_threads>NXWEB_MAX_NET_THREADS) _nxweb_num_net_threads=NXWEB_MAX_NET_THREADS;
+}
+
 int nxweb_listen(const char* host_and_port, int backlog) {
-  return nxweb_listen_ssl(host_and_port, backlog, 0, 0, 0, 0, 0);
+  return nxweb_listen_ex(host_and_port, backlog, 0, 0, 0, 0, 0, 0);
 }
 
 int nxweb_listen_ssl(const char* host_and_port, int backlog, _Bool secure, const char* cert_file, const char* key_file, const char* dh_params_file, const char* cipher_priority_string) {
+  return nxweb_listen_ex(host_and_port, backlog, 0, secure, cert_file, key_file, dh_params_file, cipher_priority_string);
+}
+
+static void listen_config_rollback(nxweb_server_listen_config* lconf) {
+  // close sockets bound so far; reuseport ones would otherwise get their share of connections nobody accepts
+  int i;
+  for (i=0; i<NXWEB_MAX_NET_THREADS; i++) {
+    if (lconf->thread_fd[i]>0 && lconf->thread_fd[i]!=lconf->listen_fd) close(lconf->thread_fd[i]);
+  }
+  if (lconf->listen_fd>0) close(lconf->listen_fd);
+  memset(lconf, 0, sizeof(nxweb_server_listen_config));
+}
+
+int nxweb_listen_ex(const char* host_and_port, int backlog, int flags, _Bool secure, const char* cert_file, const char* key_file, const char* dh_params_file, const char* cipher_priority_string) {
   assert(nxweb_server_config.listen_config_idx>=0 && nxweb_server_config.listen_config_idx<NXWEB_MAX_LISTEN_SOCKETS);
 
-  nxweb_log_error("nxweb binding %s for http%s", host_and_port, secure?"s":"");
+  _Bool unix_socket=!strncmp(host_and_port, "unix:", 5);
+  if (unix_socket && (flags & (NXWEB_LISTEN_REUSEPORT|NXWEB_LISTEN_CPU_STEERING))) {
+    nxweb_log_warning("reuseport/cpu_steering not supported for unix socket %s; ignored", host_and_port);
+    flags&=~(NXWEB_LISTEN_REUSEPORT|NXWEB_LISTEN_CPU_STEERING);
+  }
+  if (flags & NXWEB_LISTEN_CPU_STEERING) flags|=NXWEB_LISTEN_REUSEPORT;
 
-  nxweb_server_listen_config* lconf=&nxweb_server_config.listen_config[nxweb_server_config.listen_config_idx++];
+  nxweb_log_error("nxweb binding %s for http%s%s%s", host_and_port, secure?"s":"",
+                  (flags & NXWEB_LISTEN_REUSEPORT)?" [reuseport]":"", (flags & NXWEB_LISTEN_CPU_STEERING)?" [cpu_steering]":"");
 
-  lconf->listen_fd=_nxweb_bind_socket(host_and_port, backlog);
-  if (lconf->listen_fd==-1) {
-    return -1;
+  nxweb_server_listen_config* lconf=&nxweb_server_config.listen_config[nxweb_server_config.listen_config_idx]; // idx advances on success only
+
+  if (flags & NXWEB_LISTEN_REUSEPORT) {
+    // bind one socket per net thread; kernel balances connections between them
+    init_num_net_threads();
+    int i;
+    for (i=0; i<_nxweb_num_net_threads; i++) {
+      lconf->thread_fd[i]=_nxweb_bind_socket_ex(host_and_port, backlog, 1);
+      if (lconf->thread_fd[i]==-1) {
+        lconf->thread_fd[i]=0;
+        lconf->listen_fd=lconf->thread_fd[0];
+        listen_config_rollback(lconf);
+        return -1;
+      }
+      if ((flags & NXWEB_LISTEN_CPU_STEERING) && _nxweb_set_incoming_cpu(lconf->thread_fd[i], i)==-1) {
+        nxweb_log_warning("setsockopt(SO_INCOMING_CPU) failed %d", errno);
+      }
+    }
+    lconf->listen_fd=lconf->thread_fd[0];
+    lconf->reuseport=1;
+    if (flags & NXWEB_LISTEN_CPU_STEERING) {
+      // net thread i is pinned to CPU i and owns i-th socket of the group
+      if (_nxweb_attach_cpu_steering(lconf->listen_fd, _nxweb_num_net_threads)==-1) {
+        nxweb_log_warning("can't attach reuseport cpu steering program %d; relying on SO_INCOMING_CPU", errno);
+      }
+      lconf->cpu_steering=1;
+    }
+  }
+  else {
+    lconf->listen_fd=_nxweb_bind_socket(host_and_port, backlog);
+    if (lconf->listen_fd==-1) {
+      lconf->listen_fd=0;
+      return -1;
+    }
+  }
+  if (unix_socket) {
+    lconf->unix_socket=1;
+    lconf->forwarded_header="X-Forwarded-For";
   }
 #ifdef WITH_SSL
   lconf->secure=secure;
   if (secure) {
     if (nxd_ssl_socket_init_server_parameters(&lconf->x509_cred, &lconf->dh_params, &lconf->priority_cache,
-            &lconf->session_ticket_key, cert_file, key_file, dh_params_file, cipher_priority_string)==-1) return -1;
+            &lconf->session_ticket_key, cert_file, key_file, dh_params_file, cipher_priority_string)==-1) {
+      listen_config_rollback(lconf);
+      return -1;
+    }
   }
 #endif // WITH_SSL
+  nxweb_server_config.listen_config_idx++;
   return 0;
 }
 
+static void nxweb_free_http_proxy_pool_config(nxweb_http_proxy_pool_config* ppc) {
+  int i;
+  for (i=0; i<ppc->num_servers; i++) {
+    if (ppc->servers[i].saddr) _nxweb_free_addrinfo(ppc->servers[i].saddr);
+    if (ppc->servers[i].shared_idle) nxd_http_proxy_shared_idle_destroy(ppc->servers[i].shared_idle);
+  }
+  free(ppc->servers);
+  ppc->servers=0;
+  ppc->num_servers=0;
+}
+
 int nxweb_setup_http_proxy_pool(int idx, const char* host_and_port) {
   assert(idx>=0 && idx<NXWEB_MAX_PROXY_POOLS);
-  nxweb_log_error("proxy backend #%d: %s", idx, host_and_port);
-  nxweb_server_config.http_proxy_pool_config[idx].host=host_and_port;
-  nxweb_server_config.http_proxy_pool_config[idx].saddr=_nxweb_resolve_host(host_and_port, 0);
-  return !!nxweb_server_config.http_proxy_pool_config[idx].saddr;
+  nxweb_free_http_proxy_pool_config(&nxweb_server_config.http_proxy_pool_config[idx]);
+  return !nxweb_add_http_proxy_pool_server(idx, host_and_port, 1);
+}
+
+int nxweb_add_http_proxy_pool_server(int idx, const char* host_and_port, int weight) {
+  assert(idx>=0 && idx<NXWEB_MAX_PROXY_POOLS);
+  nxweb_http_proxy_pool_config* ppc=&nxweb_server_config.http_proxy_pool_config[idx];
+  nxweb_log_error("proxy backend #%d: %s weight=%d", idx, host_and_port, weight);
+  struct addrinfo* saddr=_nxweb_resolve_host(host_and_port, 0);
+  if (!saddr) {
+    nxweb_log_error("can't resolve proxy backend #%d server %s", idx, host_and_port);
+    return -1;
+  }
+  ppc->servers=realloc(ppc->servers, (ppc->num_servers+1)*sizeof(nxd_http_proxy_server_config));
+  nxd_http_proxy_server_config* srv=&ppc->servers[ppc->num_servers++];
+  srv->host=host_and_port;
+  srv->saddr=saddr;
+  srv->weight=weight>0? weight : 1;
+  srv->shared_idle=0;
+  return 0;
+}
+
+void nxweb_set_http_proxy_pool_balance(int idx, nxd_http_proxy_balance balance) {
+  assert(idx>=0 && idx<NXWEB_MAX_PROXY_POOLS);
+  nxweb_server_config.http_proxy_pool_config[idx].balance=balance;
+}
+
+int nxweb_setup_worker_class(int idx, const char* name, int max_concurrency, int max_queue, nxe_time_t queue_timeout) {
+  assert(idx>0 && idx<NXWEB_MAX_WORKER_CLASSES); // class 0 is reserved for default
+  nxweb_log_error("worker class #%d: %s max_concurrency=%d max_queue=%d queue_timeout=%ldms", idx, name,
+          max_concurrency, max_queue, (long)(queue_timeout/1000));
+  nxweb_worker_class_config* wcc=&nxweb_server_config.worker_class_config[idx];
+  wcc->name=name;
+  wcc->max_concurrency=max_concurrency;
+  wcc->max_queue=max_queue;
+  wcc->queue_timeout=queue_timeout;
+  return 0;
+}
+
+int nxweb_find_worker_class(const char* name) {
+  int i;
+  for (i=1; i<NXWEB_MAX_WORKER_CLASSES; i++) {
+    if (nxweb_server_config.worker_class_config[i].name && !strcmp(nxweb_server_config.worker_class_config[i].name, name)) return i;
+  }
+  return -1;
 }
 
 void nxweb_run() {
@@ -998,8 +1244,7 @@ void nxweb_run() {
 
   pid_t pid=getpid();
   main_thread_id=pthread_self();
-  _nxweb_num_net_threads=(int)sysconf(_SC_NPROCESSORS_ONLN);
-  if (_nxweb_num_net_threads>NXWEB_MAX_NET_THREADS) _nxweb_num_net_threads=NXWEB_MAX_NET_THREADS;
+  init_num_net_threads();
 
   pthread_mutex_init(&nxweb_server_config.access_log_start_mux, 0);
   nxweb_access_log_restart();
@@ -1008,6 +1253,7 @@ void nxweb_run() {
   struct rlimit rl_core;
   getrlimit(RLIMIT_NOFILE, &rl_fildes);
   getrlimit(RLIMIT_CORE, &rl_core);
+  nxweb_server_config.max_fd=rl_fildes.rlim_cur>INT_MAX? INT_MAX : (int)rl_fildes.rlim_cur;
 
   nxweb_log_error("NXWEB startup: pid=%d net_threads=%d pg=%d"
                   " short=%d int=%d long=%d size_t=%d evt=%d conn=%d req=%d td=%d max_fd=%d max_core=%d",
@@ -1060,6 +1306,18 @@ void nxweb_run() {
     exit(EXIT_SUCCESS); // simulate normal exit so nxweb is not respawned
   }
 
+  // idle backend connections can only be shared if there is someone to share with
+  if (_nxweb_num_net_threads>1) {
+    for (i=0; i<NXWEB_MAX_PROXY_POOLS; i++) {
+      nxweb_http_proxy_pool_config* ppc=&nxweb_server_config.http_proxy_pool_config[i];
+      int j;
+      if (ppc->max_local_idle<=0) continue;
+      for (j=0; j<ppc->num_servers; j++) {
+        ppc->servers[j].shared_idle=nxd_http_proxy_shared_idle_create();
+      }
+    }
+  }
+
   nxweb_net_thread_data* tdata;
   for (i=0, tdata=_nxweb_net_threads; i<_nxweb_num_net_threads; i++, tdata++) {
     tdata->thread_num=i;
@@ -1104,7 +1362,13 @@ void nxweb_run() {
   nxweb_server_listen_config* lconf;
   for (i=0, lconf=nxweb_server_config.listen_config; i<NXWEB_MAX_LISTEN_SOCKETS; i++, lconf++) {
     if (lconf->listen_fd) {
-      close(lconf->listen_fd);
+      if (lconf->reuseport) {
+        int j;
+        for (j=0; j<_nxweb_num_net_threads; j++) {
+          if (lconf->thread_fd[j]) close(lconf->thread_fd[j]);
+        }
+      }
+      else close(lconf->listen_fd);
 #ifdef WITH_SSL
       if (lconf->secure)
         nxd_ssl_socket_finalize_server_parameters(lconf->x509_cred, lconf->dh_params, lconf->priority_cache, &lconf->session_ticket_key);
@@ -1113,8 +1377,7 @@ void nxweb_run() {
   }
 
   for (i=0; i<NXWEB_MAX_PROXY_POOLS; i++) {
-    if (nxweb_server_config.http_proxy_pool_config[i].saddr)
-      _nxweb_free_addrinfo(nxweb_server_config.http_proxy_pool_config[i].saddr);
+    nxweb_free_http_proxy_pool_config(&nxweb_server_config.http_proxy_pool_config[i]);
   }
 
   nxweb_access_log_stop();
@@ -73,7 +73,7 @@ void nxweb_composite_stream_append_fd(nxweb_composite_stream* cs, int fd, off_t
 
 static void nxweb_composite_stream_subrequest_on_response_ready(nxweb_http_server_connection* subconn, nxe_data data) {
   nxweb_http_server_connection* conn=subconn->parent;
-  nxweb_http_request* req=&conn->hsp.req;
+  nxweb_http_request* req=&conn->hsp.rq->req;
   nxweb_composite_stream* cs=data.ptr;
   assert(cs);
   nxweb_composite_stream_node* csn=cs->first_node;
@@ -94,13 +94,13 @@ static void nxweb_composite_stream_subrequest_on_response_ready(nxweb_http_serve
     // this might happen after first successful call to on_response_ready()
     if (csn->snode.data_in.pair) {
       // response streaming have already started
-      nxweb_log_error("subrequest failed after response streaming started: %s%s ref: %s", subconn->hsp.req.host, subconn->hsp.req.uri, req->uri);
+      nxweb_log_error("subrequest failed after response streaming started: %s%s ref: %s", subconn->hsp.rq->req.host, subconn->hsp.rq->req.uri, req->uri);
       nxweb_http_server_connection_finalize(cs->conn, 0);
     }
     else {
       nxd_obuffer_init(&csn->buffer.ob, "<!--[ssi error]-->", sizeof("<!--[ssi error]-->")-1);
       nxe_connect_streams(conn->tdata->loop, &csn->buffer.ob.data_out, &csn->snode.data_in);
-      nxweb_log_warning("subrequest failed: %s%s ref: %s", subconn->hsp.req.host, subconn->hsp.req.uri, req->uri);
+      nxweb_log_warning("subrequest failed: %s%s ref: %s", subconn->hsp.rq->req.host, subconn->hsp.rq->req.uri, req->uri);
     }
   }
 }
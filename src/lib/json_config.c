@@ -109,19 +109,39 @@ int nxweb_load_config(const char* filename) {
       }
       int backlog=(int)nx_json_get(l, "backlog")->int_value;
       if (!backlog) backlog=1024;
+      int flags=0;
+      if (nx_json_get(l, "reuseport")->int_value) flags|=NXWEB_LISTEN_REUSEPORT;
+      if (nx_json_get(l, "cpu_steering")->int_value) flags|=NXWEB_LISTEN_CPU_STEERING;
       if (itf) {
+        int lconf_idx=nxweb_server_config.listen_config_idx;
         if (!secure) {
-          if (nxweb_listen(itf, backlog)) return -1;
+          if (nxweb_listen_ex(itf, backlog, flags, 0, 0, 0, 0, 0)) return -1;
           listen_http=1;
         }
 #ifdef WITH_SSL
         else {
           const char* priorities=nx_json_get(l, "priorities")->text_value;
           if (!priorities) priorities=DEFAULT_SSL_PRIORITIES;
-          if (nxweb_listen_ssl(itf, backlog, 1, nx_json_get(l, "cert")->text_value, nx_json_get(l, "key")->text_value, nx_json_get(l, "dh")->text_value, priorities)) return -1;
+          if (nxweb_listen_ex(itf, backlog, flags, 1, nx_json_get(l, "cert")->text_value, nx_json_get(l, "key")->text_value, nx_json_get(l, "dh")->text_value, priorities)) return -1;
           listen_https=1;
         }
 #endif // WITH_SSL
+        const char* forwarded_header=nx_json_get(l, "forwarded_header")->text_value;
+        if (forwarded_header && lconf_idx<nxweb_server_config.listen_config_idx) nxweb_server_config.listen_config[lconf_idx].forwarded_header=forwarded_header;
+        if (!strncmp(itf, "unix:", 5)) {
+          // by default socket file permissions follow umask; set these to let front end running under different user connect
+          const nx_json* mode=nx_json_get(l, "mode");
+          const char* user=nx_json_get(l, "user")->text_value;
+          const char* group=nx_json_get(l, "group")->text_value;
+          uid_t uid=user? nxweb_get_uid_by_name(user) : (uid_t)-1;
+          gid_t gid=group? nxweb_get_gid_by_name(group) : (gid_t)-1;
+          if ((user && uid==(uid_t)-1) || (group && gid==(gid_t)-1)) {
+            nxweb_log_error("unknown user/group for %s", itf);
+            return -1;
+          }
+          if ((mode->type!=NX_JSON_NULL || user || group)
+              && _nxweb_set_unix_socket_perms(itf, mode->type!=NX_JSON_NULL? (int)mode->int_value : -1, uid, gid)) return -1;
+        }
       }
     }
   }
@@ -186,17 +206,109 @@ int nxweb_load_config(const char* filename) {
     }
   }
 
+  const char* event_backend=nx_json_get(json, "event_backend")->text_value;
+  if (event_backend) {
+    if (!strcmp(event_backend, "io_uring")) nxe_default_backend=NXE_BACKEND_IO_URING;
+    else if (!strcmp(event_backend, "epoll")) nxe_default_backend=NXE_BACKEND_EPOLL;
+    else nxweb_log_error("unknown event_backend %s; using epoll", event_backend);
+    nxweb_log_error("event backend: %s", nxe_default_backend==NXE_BACKEND_IO_URING? "io_uring" : "epoll");
+  }
+
   const nx_json* backends=nx_json_get(json, "backends");
   if (backends->type!=NX_JSON_NULL) {
     for (i=0; i<backends->length; i++) {
       const nx_json* js=nx_json_item(backends, i);
+      if (i>=NXWEB_MAX_PROXY_POOLS) {
+        nxweb_log_error("too many backends; %s ignored", js->key);
+        break;
+      }
       const char* itf=nx_json_get(js, "connect")->text_value;
       if (itf) {
         nxweb_setup_http_proxy_pool(i, itf);
       }
+      const nx_json* servers=nx_json_get(js, "servers");
+      if (servers->type!=NX_JSON_NULL) {
+        int j;
+        for (j=0; j<servers->length; j++) {
+          const nx_json* srv=nx_json_item(servers, j);
+          if (srv->type==NX_JSON_STRING) nxweb_add_http_proxy_pool_server(i, srv->text_value, 1);
+          else if (nx_json_get(srv, "connect")->text_value) {
+            const nx_json* weight=nx_json_get(srv, "weight");
+            nxweb_add_http_proxy_pool_server(i, nx_json_get(srv, "connect")->text_value, weight->type==NX_JSON_NULL? 1 : (int)weight->int_value);
+          }
+        }
+      }
+      const char* balance=nx_json_get(js, "balance")->text_value;
+      if (balance) {
+        if (!strcmp(balance, "round_robin")) nxweb_set_http_proxy_pool_balance(i, NXD_BALANCE_ROUND_ROBIN);
+        else if (!strcmp(balance, "least_conn")) nxweb_set_http_proxy_pool_balance(i, NXD_BALANCE_LEAST_CONN);
+        else if (!strcmp(balance, "ewma")) nxweb_set_http_proxy_pool_balance(i, NXD_BALANCE_EWMA);
+        else if (!strcmp(balance, "uri_hash")) nxweb_set_http_proxy_pool_balance(i, NXD_BALANCE_URI_HASH);
+        else nxweb_log_error("unknown balance %s for backend %s; using round_robin", balance, js->key);
+      }
+      nxweb_http_proxy_pool_config* ppc=&nxweb_server_config.http_proxy_pool_config[i];
+      const nx_json* v;
+      ppc->max_conns=(int)nx_json_get(js, "max_conns")->int_value;
+      ppc->min_idle=(int)nx_json_get(js, "min_idle")->int_value;
+      if ((v=nx_json_get(js, "max_local_idle"))->type!=NX_JSON_NULL) ppc->max_local_idle=(int)v->int_value;
+      if ((v=nx_json_get(js, "max_queue"))->type!=NX_JSON_NULL) ppc->max_queue=(int)v->int_value;
+      if ((v=nx_json_get(js, "queue_timeout"))->type!=NX_JSON_NULL) ppc->queue_timeout=v->int_value*1000; // ms => usec
+      const nx_json* health=nx_json_get(js, "health");
+      if (health->type!=NX_JSON_NULL) {
+        nxd_http_proxy_health_config* hc=&ppc->health;
+        if ((v=nx_json_get(health, "max_fails"))->type!=NX_JSON_NULL) hc->max_fails=(int)v->int_value;
+        if ((v=nx_json_get(health, "fail_timeout"))->type!=NX_JSON_NULL) hc->fail_timeout=(int)v->int_value;
+        if ((v=nx_json_get(health, "slow_start"))->type!=NX_JSON_NULL) hc->slow_start=(int)v->int_value;
+        hc->check_interval=(int)nx_json_get(health, "check_interval")->int_value;
+        hc->check_uri=nx_json_get(health, "check_uri")->text_value;
+      }
     }
   }
 
+  int workers_per_thread=(int)nx_json_get(json, "workers_per_thread")->int_value;
+  if (workers_per_thread>0) {
+    if (workers_per_thread>NXWEB_MAX_WORKERS_PER_FACTORY) {
+      nxweb_log_error("workers_per_thread %d too big; using %d", workers_per_thread, NXWEB_MAX_WORKERS_PER_FACTORY);
+      workers_per_thread=NXWEB_MAX_WORKERS_PER_FACTORY;
+    }
+    nxweb_server_config.workers_per_thread=workers_per_thread;
+  }
+
+  const nx_json* worker_classes=nx_json_get(json, "worker_classes");
+  if (worker_classes->type!=NX_JSON_NULL) {
+    for (i=0; i<worker_classes->length; i++) {
+      const nx_json* js=nx_json_item(worker_classes, i);
+      const char* name=js->key;
+      if (i+1>=NXWEB_MAX_WORKER_CLASSES) {
+        nxweb_log_error("too many worker classes; %s ignored", name);
+        break;
+      }
+      nxweb_setup_worker_class(i+1, name, (int)nx_json_get(js, "max_concurrency")->int_value,
+              (int)nx_json_get(js, "max_queue")->int_value, nx_json_get(js, "queue_timeout")->int_value*1000); // ms => usec
+    }
+  }
+
+  const nx_json* admission=nx_json_get(json, "admission");
+  if (admission->type!=NX_JSON_NULL) {
+    nxweb_admission_config* ac=&nxweb_server_config.admission;
+    ac->max_in_flight=(int)nx_json_get(admission, "max_in_flight")->int_value;
+    ac->max_worker_queue=(int)nx_json_get(admission, "max_worker_queue")->int_value;
+    ac->max_loop_lag=nx_json_get(admission, "max_loop_lag")->int_value*1000; // ms => usec
+    const nx_json* fd_reserve=nx_json_get(admission, "fd_reserve");
+    if (fd_reserve->type!=NX_JSON_NULL) ac->fd_reserve=(int)fd_reserve->int_value;
+    nxweb_log_error("admission control: max_in_flight=%d max_worker_queue=%d max_loop_lag=%ldms fd_reserve=%d",
+            ac->max_in_flight, ac->max_worker_queue, (long)(ac->max_loop_lag/1000), ac->fd_reserve);
+  }
+
+  const nx_json* memcache=nx_json_get(json, "memcache");
+  if (memcache->type!=NX_JSON_NULL) {
+    nxweb_memcache_config* mc=&nxweb_server_config.memcache;
+    const nx_json* v;
+    if ((v=nx_json_get(memcache, "size"))->type!=NX_JSON_NULL) mc->size=v->int_value;
+    if ((v=nx_json_get(memcache, "max_item_size"))->type!=NX_JSON_NULL) mc->max_item_size=v->int_value;
+    if ((v=nx_json_get(memcache, "ttl"))->type!=NX_JSON_NULL) mc->ttl=v->int_value*1000; // ms => usec
+  }
+
   const nx_json* modules=nx_json_get(json, "modules");
   if (modules->type!=NX_JSON_NULL) {
     for (i=0; i<modules->length; i++) {
@@ -309,6 +421,7 @@ int nxweb_load_config(const char* filename) {
       new_handler->secure_only=!!nx_json_get(js, "secure_only")->int_value;
       new_handler->insecure_only=!!nx_json_get(js, "insecure_only")->int_value;
       new_handler->memcache=!!nx_json_get(js, "memcache")->int_value;
+      new_handler->memcache_ttl=(int)nx_json_get(js, "memcache_ttl")->int_value;
       new_handler->flags=(nxweb_handler_flags)nx_json_get(js, "flags")->int_value;
       new_handler->charset=nx_json_get(js, "charset")->text_value;
       new_handler->dir=nx_json_get(js, "dir")->text_value;
@@ -316,8 +429,21 @@ int nxweb_load_config(const char* filename) {
       new_handler->host=nx_json_get(js, "host")->text_value;
       new_handler->index_file=nx_json_get(js, "index_file")->text_value;
       new_handler->proxy_copy_host=!!nx_json_get(js, "proxy_copy_host")->int_value;
+      new_handler->proxy_buffering=!!nx_json_get(js, "proxy_buffering")->int_value;
+      new_handler->proxy_spool_request=!!nx_json_get(js, "proxy_spool_request")->int_value;
+      new_handler->proxy_buffer_size=nx_json_get(js, "proxy_buffer_size")->int_value;
+      new_handler->proxy_hedge=!!nx_json_get(js, "proxy_hedge")->int_value;
+      new_handler->proxy_hedge_delay=(int)nx_json_get(js, "proxy_hedge_delay")->int_value;
       new_handler->size=nx_json_get(js, "size")->int_value;
       new_handler->priority=(int)nx_json_get(js, "priority")->int_value;
+      const char* worker_class=nx_json_get(js, "worker_class")->text_value;
+      if (worker_class) {
+        new_handler->worker_class=nxweb_find_worker_class(worker_class);
+        if (new_handler->worker_class<0) {
+          nxweb_log_error("worker class %s not found for routing record #%d", worker_class, i);
+          new_handler->worker_class=0;
+        }
+      }
       if (!new_handler->priority) new_handler->priority=(i+1)*1000;
       if (base_handler->on_config) {
         nxweb_result r=base_handler->on_config(new_handler, js);
@@ -63,6 +63,9 @@ static void show_version(void) {
 #ifdef WITH_SSL
           "SSL support:         ON\n"
 #endif
+#ifdef WITH_IO_URING
+          "io_uring support:    ON\n"
+#endif
 #ifdef WITH_IMAGEMAGICK
           "ImageMagick support: ON\n"
 #endif
@@ -30,9 +30,13 @@
 #include <time.h>
 #include <stdarg.h>
 #include <pthread.h>
+#include <stddef.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <netdb.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <linux/filter.h>
 
 
 int nxweb_error_log_level=NXWEB_LOG_WARNING; // 0=nothing; 1=errors; 2=warnings; 3=info; 4=debug
@@ -177,7 +181,28 @@ void _nxweb_close_bad_socket(int fd) {
   close(fd);
 }
 
+// path is either filesystem path or @name for abstract namespace
+static struct addrinfo* resolve_unix_path(const char* path) {
+  struct sockaddr_un* sun;
+  size_t len=strlen(path);
+  if (!len || len>=sizeof(sun->sun_path)) return 0;
+  // single block, so it can be freed with free(); see _nxweb_free_addrinfo()
+  struct addrinfo* ai=calloc(1, sizeof(struct addrinfo)+sizeof(struct sockaddr_un));
+  if (!ai) return 0;
+  sun=(struct sockaddr_un*)(ai+1);
+  sun->sun_family=AF_UNIX;
+  memcpy(sun->sun_path, path, len);
+  if (*path=='@') sun->sun_path[0]='\0'; // abstract name is not null-terminated
+  ai->ai_family=AF_UNIX;
+  ai->ai_socktype=SOCK_STREAM;
+  ai->ai_addr=(struct sockaddr*)sun;
+  ai->ai_addrlen=offsetof(struct sockaddr_un, sun_path)+len+(*path=='@'? 0 : 1);
+  return ai;
+}
+
 struct addrinfo* _nxweb_resolve_host(const char *host_and_port, int passive) {
+  if (!strncmp(host_and_port, "unix:", 5)) return resolve_unix_path(host_and_port+5);
+
   char* host=strdup(host_and_port);
   char* port=strchr(host, ':');
   if (port) *port++='\0';
@@ -218,10 +243,15 @@ ERR1:
 }
 
 void _nxweb_free_addrinfo(struct addrinfo* ai) {
-  freeaddrinfo(ai);
+  if (ai->ai_family==AF_UNIX) free(ai);
+  else freeaddrinfo(ai);
 }
 
 int _nxweb_bind_socket(const char *host_and_port, int backlog) {
+  return _nxweb_bind_socket_ex(host_and_port, backlog, 0);
+}
+
+int _nxweb_bind_socket_ex(const char *host_and_port, int backlog, _Bool reuseport) {
   struct addrinfo* ai=_nxweb_resolve_host(host_and_port, 1);
   if (!ai) {
     nxweb_log_error("can't resolve IP/port %d", errno);
@@ -229,20 +259,43 @@ int _nxweb_bind_socket(const char *host_and_port, int backlog) {
   }
   int listen_fd;
   int reuseaddr_on=1;
-  listen_fd=socket(AF_INET, SOCK_STREAM, 0);
+  listen_fd=socket(ai->ai_family, SOCK_STREAM, 0);
   if (listen_fd<0) {
     nxweb_log_error("socket() failed %d", errno);
     return -1;
   }
-  if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuseaddr_on, sizeof(reuseaddr_on))==-1) {
-    nxweb_log_error("setsockopt() failed %d", errno);
-    return -1;
+  if (ai->ai_family==AF_UNIX) {
+    const char* path=((struct sockaddr_un*)ai->ai_addr)->sun_path;
+    struct stat st;
+    if (*path && stat(path, &st)!=-1 && S_ISSOCK(st.st_mode)) {
+      // only remove socket left from previous run; nobody must be listening on it
+      int probe_fd=socket(AF_UNIX, SOCK_STREAM, 0);
+      int in_use=probe_fd!=-1 && (connect(probe_fd, ai->ai_addr, ai->ai_addrlen)==0 || errno!=ECONNREFUSED);
+      if (probe_fd!=-1) close(probe_fd);
+      if (in_use) {
+        nxweb_log_error("unix socket %s is in use", path);
+        close(listen_fd);
+        _nxweb_free_addrinfo(ai);
+        return -1;
+      }
+      unlink(path);
+    }
+  }
+  else {
+    if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuseaddr_on, sizeof(reuseaddr_on))==-1) {
+      nxweb_log_error("setsockopt() failed %d", errno);
+      return -1;
+    }
+    if (reuseport && setsockopt(listen_fd, SOL_SOCKET, SO_REUSEPORT, &reuseaddr_on, sizeof(reuseaddr_on))==-1) {
+      nxweb_log_error("setsockopt(SO_REUSEPORT) failed %d", errno);
+      return -1;
+    }
   }
   if (bind(listen_fd, ai->ai_addr, ai->ai_addrlen)<0) {
-    nxweb_log_error("bind failed");
+    nxweb_log_error("bind failed %d", errno);
     return -1;
   }
-  freeaddrinfo(ai);
+  _nxweb_free_addrinfo(ai);
   if (listen(listen_fd, backlog)<0) {
     nxweb_log_error("listen() failed %d", errno);
     return -1;
@@ -258,6 +311,41 @@ int _nxweb_bind_socket(const char *host_and_port, int backlog) {
   return listen_fd;
 }
 
+int _nxweb_set_unix_socket_perms(const char* host_and_port, int mode, uid_t uid, gid_t gid) {
+  struct addrinfo* ai=_nxweb_resolve_host(host_and_port, 1);
+  if (!ai) return -1;
+  int result=0;
+  const char* path=ai->ai_family==AF_UNIX? ((struct sockaddr_un*)ai->ai_addr)->sun_path : "";
+  if (*path) { // abstract sockets have no file
+    if ((uid!=(uid_t)-1 || gid!=(gid_t)-1) && chown(path, uid, gid)==-1) {
+      nxweb_log_error("chown(%s) failed %d", path, errno);
+      result=-1;
+    }
+    if (mode>=0 && chmod(path, mode)==-1) {
+      nxweb_log_error("chmod(%s) failed %d", path, errno);
+      result=-1;
+    }
+  }
+  _nxweb_free_addrinfo(ai);
+  return result;
+}
+
+int _nxweb_set_incoming_cpu(int fd, int cpu) {
+  return setsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu));
+}
+
+int _nxweb_attach_cpu_steering(int fd, int group_size) {
+  // reuseport group program: socket index = cpu % group_size;
+  // sockets get their group index in the order they were bound
+  struct sock_filter code[]={
+    {BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU},
+    {BPF_ALU | BPF_MOD | BPF_K, 0, 0, (uint32_t)group_size},
+    {BPF_RET | BPF_A, 0, 0, 0}
+  };
+  struct sock_fprog prog={.len=sizeof(code)/sizeof(code[0]), .filter=code};
+  return setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog));
+}
+
 char* nxweb_trunc_space(char* str) { // does it inplace
   if (!str || !*str) return str;
 
@@ -37,24 +37,243 @@
 #include <sys/mman.h>
 #include <fcntl.h>
 
+#include <zlib.h>
+
+#define INFLATE_IN_SIZE 8192
+
 typedef struct nxweb_http_proxy_request_data {
   nxweb_http_server_connection* conn;
   nxd_http_proxy* hpx;
+  nxd_http_proxy_pool_waiter waiter; // waiting for backend connection
   nxe_subscriber proxy_events_sub;
   nxe_timer timer_backend;
+  nxd_http_proxy* hedge_hpx; // proxy_hedge: same request sent to another server; first response wins
+  nxe_subscriber hedge_events_sub;
+  nxe_timer timer_hedge;
   nxd_ibuffer ib;
   nxd_rbuffer rb_req;
   nxd_rbuffer rb_resp;
+  nxd_pbuffer pb_req; // splice() path for plain connections
+  nxd_pbuffer pb_resp;
+  nxd_sbuffer sb_req; // proxy_spool_request: whole request body, received before connecting to backend
+  nxd_sbuffer sb_resp; // proxy_buffering: whole response body, so backend connection can be released early
+  z_stream zs; // inflates gzipped backend response into rb_resp when client or filters need it plain
+  char* inflate_in; // compressed input pulled from backend connection
   int retry_count;
   char* rbuf;
   _Bool response_sending_started:1;
   _Bool proxy_request_complete:1;
   _Bool proxy_request_error:1;
+  _Bool waiting:1;
+  _Bool splice_req:1;
+  _Bool splice_resp:1;
+  _Bool buffer_resp:1;
+  _Bool spool_req:1;
+  _Bool hedged:1;
+  _Bool inflate_resp:1;
+  _Bool inflate_eof_in:1;
+  _Bool inflate_done:1;
+  _Bool inflate_error:1;
 } nxweb_http_proxy_request_data;
 
 static void nxweb_http_server_proxy_events_sub_on_message(nxe_subscriber* sub, nxe_publisher* pub, nxe_data data);
+static void nxweb_http_server_hedge_events_sub_on_message(nxe_subscriber* sub, nxe_publisher* pub, nxe_data data);
 
 static const nxe_subscriber_class nxweb_http_server_proxy_events_sub_class={.on_message=nxweb_http_server_proxy_events_sub_on_message};
+static const nxe_subscriber_class nxweb_http_server_hedge_events_sub_class={.on_message=nxweb_http_server_hedge_events_sub_on_message};
+
+// once hedged request wins it becomes rdata->hpx, but stays with the subscriber it has started with
+static void subscribe_proxy_events(nxe_loop* loop, nxweb_http_proxy_request_data* rdata, nxd_http_proxy* hpx) {
+  if (!rdata->proxy_events_sub.pub) {
+    nxe_init_subscriber(&rdata->proxy_events_sub, &nxweb_http_server_proxy_events_sub_class);
+    nxe_subscribe(loop, &hpx->hcp.events_pub, &rdata->proxy_events_sub);
+  }
+  else {
+    nxe_init_subscriber(&rdata->hedge_events_sub, &nxweb_http_server_hedge_events_sub_class);
+    nxe_subscribe(loop, &hpx->hcp.events_pub, &rdata->hedge_events_sub);
+  }
+}
+
+static void unsubscribe_proxy_events(nxweb_http_proxy_request_data* rdata, nxd_http_proxy* hpx) {
+  if (rdata->proxy_events_sub.pub==&hpx->hcp.events_pub) nxe_unsubscribe(&hpx->hcp.events_pub, &rdata->proxy_events_sub);
+  else if (rdata->hedge_events_sub.pub==&hpx->hcp.events_pub) nxe_unsubscribe(&hpx->hcp.events_pub, &rdata->hedge_events_sub);
+}
+
+static void disconnect_body_streams(nxweb_http_proxy_request_data* rdata) {
+  if (rdata->rb_resp.data_in.pair) nxe_disconnect_streams(rdata->rb_resp.data_in.pair, &rdata->rb_resp.data_in);
+  if (rdata->rb_resp.data_out.pair) nxe_disconnect_streams(&rdata->rb_resp.data_out, rdata->rb_resp.data_out.pair);
+  if (rdata->rb_req.data_in.pair) nxe_disconnect_streams(rdata->rb_req.data_in.pair, &rdata->rb_req.data_in);
+  if (rdata->rb_req.data_out.pair) nxe_disconnect_streams(&rdata->rb_req.data_out, rdata->rb_req.data_out.pair);
+  if (rdata->pb_resp.data_in.pair) nxe_disconnect_streams(rdata->pb_resp.data_in.pair, &rdata->pb_resp.data_in);
+  if (rdata->pb_resp.data_out.pair) nxe_disconnect_streams(&rdata->pb_resp.data_out, rdata->pb_resp.data_out.pair);
+  if (rdata->pb_req.data_in.pair) nxe_disconnect_streams(rdata->pb_req.data_in.pair, &rdata->pb_req.data_in);
+  if (rdata->pb_req.data_out.pair) nxe_disconnect_streams(&rdata->pb_req.data_out, rdata->pb_req.data_out.pair);
+  if (rdata->sb_req.data_in.pair) nxe_disconnect_streams(rdata->sb_req.data_in.pair, &rdata->sb_req.data_in);
+  if (rdata->sb_req.data_out.pair) nxe_disconnect_streams(&rdata->sb_req.data_out, rdata->sb_req.data_out.pair);
+  if (rdata->sb_resp.data_in.pair) nxe_disconnect_streams(rdata->sb_resp.data_in.pair, &rdata->sb_resp.data_in);
+  if (rdata->sb_resp.data_out.pair) nxe_disconnect_streams(&rdata->sb_resp.data_out, rdata->sb_resp.data_out.pair);
+}
+
+// buffered response outlives backend connection, so its strings must not stay in backend's nxb
+static void copy_response_headers(nxb_buffer* nxb, nxweb_http_response* resp) {
+  if (resp->status) resp->status=nxb_copy_str(nxb, resp->status);
+  if (resp->content_type) resp->content_type=nxb_copy_str(nxb, resp->content_type);
+  if (resp->cache_control) resp->cache_control=nxb_copy_str(nxb, resp->cache_control);
+  nxweb_http_header* h;
+  nxweb_http_header** link=&resp->headers;
+  for (h=resp->headers; h; h=h->next) {
+    nxweb_http_header* hc=nxb_alloc_obj(nxb, sizeof(nxweb_http_header));
+    hc->name=nxb_copy_str(nxb, h->name);
+    hc->value=h->value? nxb_copy_str(nxb, h->value) : 0;
+    hc->next=0;
+    *link=hc;
+    link=&hc->next;
+  }
+}
+
+// splice() is only possible between plain sockets with nothing but pass-through filters in between
+static int can_splice(nxweb_http_server_connection* conn, nxe_ssize_t content_length) {
+  if (!NXWEB_PROXY_SPLICE_MIN_SIZE || content_length<NXWEB_PROXY_SPLICE_MIN_SIZE) return 0;
+  if (conn->secure || conn->parent) return 0;
+  nxweb_handler* handler=conn->handler;
+  if (handler->memcache && content_length<=nxweb_server_config.memcache.max_item_size) return 0; // memcache has to see the body
+  int i;
+  for (i=0; i<handler->num_filters; i++) {
+    if (!handler->filters[i]->splice_passthrough) return 0;
+  }
+  return 1;
+}
+
+// backend gzip is passed through to client unless some filter has to parse the body
+static int want_backend_gzip(nxweb_http_server_connection* conn, nxweb_http_request* req) {
+  if (!req->accept_gzip_encoding) return 0;
+  nxweb_handler* handler=conn->handler;
+  int i;
+  for (i=0; i<handler->num_filters; i++) {
+    if (handler->filters[i]->needs_identity) return 0;
+  }
+  return 1;
+}
+
+// inflates input zlib has got into rb_resp; returns 1 if more output might be pending
+static int inflate_resp_step(nxweb_http_proxy_request_data* rdata) {
+  nxd_rbuffer* rb=&rdata->rb_resp;
+  z_stream* zs=&rdata->zs;
+  int pending=0;
+  if (!rdata->inflate_done && !rdata->inflate_error) {
+    nxe_size_t size_avail;
+    zs->next_out=(void*)nxd_rbuffer_get_write_ptr(rb, &size_avail);
+    zs->avail_out=size_avail;
+    if (!size_avail) return 1;
+    if (!zs->next_in) zs->next_in=(void*)""; // inflate does not like nulls even when size is zero
+    int r=inflate(zs, Z_SYNC_FLUSH);
+    if (r==Z_STREAM_END) {
+      rdata->inflate_done=1;
+      inflateEnd(zs);
+    }
+    else if (r!=Z_OK && r!=Z_BUF_ERROR) {
+      nxweb_log_error("proxy request conn=%p: can't inflate backend response; inflate() error %d", rdata->conn, r);
+      rdata->inflate_error=1;
+      // response can't be completed (backend might be released already if buffering); let client know by closing connection
+      nxe_publish(&rdata->conn->hsp.events_pub, (nxe_data)NXE_ERROR);
+    }
+    else if (!zs->avail_out) pending=1;
+    if (!rdata->inflate_error) nxd_rbuffer_write(rb, size_avail - zs->avail_out);
+  }
+  if (rdata->inflate_done || rdata->inflate_error) zs->avail_in=0; // swallow trailing garbage or the rest after error
+  return pending;
+}
+
+static void inflate_resp_check_eof(nxweb_http_proxy_request_data* rdata, nxe_loop* loop) {
+  nxd_rbuffer* rb=&rdata->rb_resp;
+  if (!rdata->inflate_eof_in || rdata->zs.avail_in || rb->eof || rdata->inflate_error) return;
+  if (!rdata->inflate_done) nxweb_log_warning("proxy request conn=%p: gzipped backend response is truncated", rdata->conn);
+  rb->eof=1;
+  nxe_ostream_unset_ready(&rb->data_in);
+  nxe_istream_set_ready(loop, &rb->data_out); // even when no bytes received make sure we signal readiness on EOF
+}
+
+static void inflate_data_in_do_read(nxe_ostream* os, nxe_istream* is) {
+  nxd_rbuffer* rb=OBJ_PTR_FROM_FLD_PTR(nxd_rbuffer, data_in, os);
+  nxweb_http_proxy_request_data* rdata=OBJ_PTR_FROM_FLD_PTR(nxweb_http_proxy_request_data, rb_resp, rb);
+
+  nxweb_log_debug("inflate_data_in_do_read");
+
+  z_stream* zs=&rdata->zs;
+  if (!zs->avail_in && !rdata->inflate_eof_in) {
+    nxe_flags_t flags=0;
+    zs->next_in=(void*)rdata->inflate_in;
+    zs->avail_in=ISTREAM_CLASS(is)->read(is, os, rdata->inflate_in, INFLATE_IN_SIZE, &flags);
+    if (flags&NXEF_EOF) rdata->inflate_eof_in=1;
+  }
+  if (!inflate_resp_step(rdata)) inflate_resp_check_eof(rdata, os->super.loop);
+}
+
+static nxe_ssize_t inflate_data_in_write(nxe_ostream* os, nxe_istream* is, int fd, nx_file_reader* fr, nxe_data ptr, nxe_size_t size, nxe_flags_t* _flags) {
+  nxd_rbuffer* rb=OBJ_PTR_FROM_FLD_PTR(nxd_rbuffer, data_in, os);
+  nxweb_http_proxy_request_data* rdata=OBJ_PTR_FROM_FLD_PTR(nxweb_http_proxy_request_data, rb_resp, rb);
+
+  nxweb_log_debug("inflate_data_in_write");
+
+  z_stream* zs=&rdata->zs;
+  nxe_loop* loop=os->super.loop;
+  nxe_flags_t flags=*_flags;
+  nx_file_reader_to_mem_ptr(fd, fr, &ptr, &size, &flags);
+  zs->next_in=ptr.ptr;
+  zs->avail_in=size;
+  int pending=inflate_resp_step(rdata);
+  nxe_ssize_t bytes_sent=size - zs->avail_in;
+  zs->next_in=0; // caller's data; what is left will be offered again
+  zs->avail_in=0;
+  if (bytes_sent<size) {
+    nxe_ostream_unset_ready(os);
+    nxe_istream_set_ready(loop, &rb->data_out); // please read out inflated data
+  }
+  else if (flags&NXEF_EOF) {
+    rdata->inflate_eof_in=1;
+    if (!pending) inflate_resp_check_eof(rdata, loop);
+  }
+  return bytes_sent;
+}
+
+static void inflate_data_out_do_write(nxe_istream* is, nxe_ostream* os) {
+  nxd_rbuffer* rb=OBJ_PTR_FROM_FLD_PTR(nxd_rbuffer, data_out, is);
+  nxweb_http_proxy_request_data* rdata=OBJ_PTR_FROM_FLD_PTR(nxweb_http_proxy_request_data, rb_resp, rb);
+
+  nxweb_log_debug("inflate_data_out_do_write");
+
+  nxe_size_t size;
+  const void* ptr;
+  nxe_flags_t flags=0;
+  ptr=nxd_rbuffer_get_read_ptr(rb, &size, &flags);
+  if (size>0 || flags&NXEF_EOF) {
+    nxe_ssize_t bytes_sent=OSTREAM_CLASS(os)->write(os, is, 0, 0, (nxe_data)ptr, size, &flags);
+    if (bytes_sent>0) nxd_rbuffer_read(rb, bytes_sent);
+  }
+  if (rdata->inflate_eof_in && !rb->eof) { // input is over; drain what zlib still holds
+    if (!inflate_resp_step(rdata)) inflate_resp_check_eof(rdata, is->super.loop);
+  }
+  else if (!size && !(flags&NXEF_EOF)) {
+    nxe_istream_unset_ready(is);
+  }
+}
+
+static const nxe_ostream_class inflate_data_in_class={.do_read=inflate_data_in_do_read, .write=inflate_data_in_write};
+static const nxe_istream_class inflate_data_out_class={.do_write=inflate_data_out_do_write};
+
+static int init_inflate_resp(nxweb_http_proxy_request_data* rdata) {
+  nxd_rbuffer_init(&rdata->rb_resp, rdata->rbuf, NXWEB_RBUF_SIZE);
+  rdata->rb_resp.data_in.super.cls.os_cls=&inflate_data_in_class;
+  rdata->rb_resp.data_out.super.cls.is_cls=&inflate_data_out_class;
+  rdata->inflate_in=nxb_alloc_obj(rdata->conn->hsp.nxb, INFLATE_IN_SIZE);
+  memset(&rdata->zs, 0, sizeof(z_stream));
+  if (inflateInit2(&rdata->zs, 15 + 16)!=Z_OK) { // gzip wrapper only
+    nxweb_log_error("inflateInit2() failed");
+    return -1;
+  }
+  rdata->inflate_resp=1;
+  return 0;
+}
 
 static void nxweb_http_proxy_request_finalize(nxd_http_server_proto* hsp, void* req_data) {
 
@@ -64,11 +283,39 @@ static void nxweb_http_proxy_request_finalize(nxd_http_server_proto* hsp, void*
   nxweb_http_server_connection* conn=rdata->conn;
   nxe_loop* loop=conn->tdata->loop;
   nxe_unset_timer(loop, NXWEB_TIMER_BACKEND, &rdata->timer_backend);
-  if (rdata->rb_resp.data_in.pair) nxe_disconnect_streams(rdata->rb_resp.data_in.pair, &rdata->rb_resp.data_in);
-  if (rdata->rb_resp.data_out.pair) nxe_disconnect_streams(&rdata->rb_resp.data_out, rdata->rb_resp.data_out.pair);
-  if (rdata->rb_req.data_in.pair) nxe_disconnect_streams(rdata->rb_req.data_in.pair, &rdata->rb_req.data_in);
-  if (rdata->rb_req.data_out.pair) nxe_disconnect_streams(&rdata->rb_req.data_out, rdata->rb_req.data_out.pair);
+  nxe_unset_timer(loop, 0, &rdata->timer_hedge);
+  disconnect_body_streams(rdata);
+  if (rdata->splice_req) {
+    nxd_pbuffer_finalize(&rdata->pb_req);
+    rdata->splice_req=0;
+  }
+  if (rdata->splice_resp) {
+    nxd_pbuffer_finalize(&rdata->pb_resp);
+    rdata->splice_resp=0;
+  }
+  if (rdata->spool_req) {
+    nxd_sbuffer_finalize(&rdata->sb_req);
+    rdata->spool_req=0;
+  }
+  if (rdata->buffer_resp) {
+    nxd_sbuffer_finalize(&rdata->sb_resp);
+    rdata->buffer_resp=0;
+  }
+  if (rdata->inflate_resp) {
+    if (!rdata->inflate_done) inflateEnd(&rdata->zs);
+    rdata->inflate_resp=0;
+  }
+  if (rdata->hedge_hpx) {
+    unsubscribe_proxy_events(rdata, rdata->hedge_hpx);
+    nxd_http_proxy_pool_return(rdata->hedge_hpx, 1);
+    rdata->hedge_hpx=0;
+  }
   if (rdata->proxy_events_sub.pub) nxe_unsubscribe(rdata->proxy_events_sub.pub, &rdata->proxy_events_sub);
+  if (rdata->hedge_events_sub.pub) nxe_unsubscribe(rdata->hedge_events_sub.pub, &rdata->hedge_events_sub);
+  if (rdata->waiting) {
+    nxd_http_proxy_pool_cancel_wait(&conn->tdata->proxy_pool[conn->handler->idx], &rdata->waiter);
+    rdata->waiting=0;
+  }
   if (rdata->hpx) {
     nxd_http_proxy_pool_return(rdata->hpx, rdata->proxy_request_error);
     rdata->hpx=0;
@@ -79,77 +326,175 @@ static void nxweb_http_proxy_request_finalize(nxd_http_server_proto* hsp, void*
   }
 }
 
-static nxweb_result start_proxy_request(nxweb_http_server_connection* conn, nxweb_http_request* req, nxweb_http_proxy_request_data* rdata) {
-
-  nxweb_log_debug("start_proxy_request");
-
+static void start_backend_request(nxweb_http_server_connection* conn, nxweb_http_request* req, nxweb_http_proxy_request_data* rdata, nxd_http_proxy* hpx) {
   nxe_loop* loop=conn->tdata->loop;
   nxweb_handler* handler=conn->handler;
-  assert(handler->idx>=0 && handler->idx<NXWEB_MAX_PROXY_POOLS);
-  nxd_http_proxy* hpx=nxd_http_proxy_pool_connect(&conn->tdata->proxy_pool[handler->idx]);
-  rdata->proxy_request_complete=0;
-  rdata->proxy_request_error=0;
-  rdata->response_sending_started=0;
-  if (hpx) {
-    rdata->hpx=hpx;
-    nxweb_http_request* preq=nxd_http_proxy_prepare(hpx);
-    if (handler->proxy_copy_host) preq->host=req->host;
-    preq->method=req->method;
-    preq->head_method=req->head_method;
-    preq->content_length=req->content_length;
-    preq->content_type=req->content_type;
-    /// Do not forward Accept-Encoding header if you want to process results (eg SSI)
-    // preq->accept_encoding=req->accept_encoding;
-    preq->expect_100_continue=!!req->content_length;
-    if (handler->uri) {
-      const char* path_info=req->path_info? req->path_info : req->uri;
-      if (*handler->uri) {
-        char* uri=nxb_alloc_obj(conn->hsp.nxb, strlen(handler->uri)+strlen(path_info)+1);
-        strcat(strcpy(uri, handler->uri), path_info);
-        preq->uri=uri;
-      }
-      else {
-        preq->uri=path_info;
-      }
+  nxweb_http_request* preq=nxd_http_proxy_prepare(hpx);
+  if (handler->proxy_copy_host) preq->host=req->host;
+  preq->method=req->method;
+  preq->head_method=req->head_method;
+  preq->content_length=rdata->spool_req? (nxe_ssize_t)rdata->sb_req.size : req->content_length;
+  preq->content_type=req->content_type;
+  // ask for gzip only when it can go to client as is; filters that process results (eg SSI) get it plain
+  if (want_backend_gzip(conn, req)) preq->accept_encoding="gzip";
+  preq->expect_100_continue=!rdata->spool_req && !!req->content_length; // spooled body follows headers right away
+  if (handler->uri) {
+    const char* path_info=req->path_info? req->path_info : req->uri;
+    if (*handler->uri) {
+      char* uri=nxb_alloc_obj(conn->hsp.nxb, strlen(handler->uri)+strlen(path_info)+1);
+      strcat(strcpy(uri, handler->uri), path_info);
+      preq->uri=uri;
     }
     else {
-      preq->uri=req->uri;
+      preq->uri=path_info;
     }
-    preq->http11=1;
-    preq->keep_alive=1;
-    preq->user_agent=req->user_agent;
-    preq->cookie=req->cookie;
-    preq->if_modified_since=req->if_modified_since + nxd_http_proxy_pool_get_backend_time_delta(hpx->pool);
-    preq->x_forwarded_for=conn->remote_addr;
-    preq->x_forwarded_host=req->host;
-    preq->x_forwarded_ssl=nxweb_server_config.listen_config[conn->lconf_idx].secure;
-    preq->uid=req->uid;
-    preq->parent_req=req->parent_req;
-    preq->headers=req->headers; // need to filter these???
-    nxd_http_proxy_start_request(hpx, preq);
-    nxe_init_subscriber(&rdata->proxy_events_sub, &nxweb_http_server_proxy_events_sub_class);
-    nxe_subscribe(loop, &hpx->hcp.events_pub, &rdata->proxy_events_sub);
-    nxd_rbuffer_init(&rdata->rb_resp, rdata->rbuf, NXWEB_RBUF_SIZE);
-    nxe_connect_streams(loop, &hpx->hcp.resp_body_out, &rdata->rb_resp.data_in);
+  }
+  else {
+    preq->uri=req->uri;
+  }
+  preq->http11=1;
+  preq->keep_alive=1;
+  preq->user_agent=req->user_agent;
+  preq->cookie=req->cookie;
+  preq->if_modified_since=req->if_modified_since + nxd_http_proxy_pool_get_backend_time_delta(hpx->pool);
+  preq->x_forwarded_for=conn->remote_addr;
+  preq->x_forwarded_host=req->host;
+  preq->x_forwarded_ssl=nxweb_server_config.listen_config[conn->lconf_idx].secure;
+  preq->uid=req->uid;
+  preq->parent_req=req->parent_req;
+  preq->headers=req->headers; // need to filter these???
+  nxd_http_proxy_start_request(hpx, preq);
+  subscribe_proxy_events(loop, rdata, hpx);
+}
 
-    if (req->content_length) { // receive body
+static int can_hedge(nxweb_http_server_connection* conn, nxweb_http_request* req, nxd_http_proxy* hpx) {
+  // only idempotent requests without body can be sent twice
+  return conn->handler->proxy_hedge && req->get_method && !req->content_length && hpx->pool->num_servers>1;
+}
+
+static nxe_time_t hedge_delay(nxweb_handler* handler, nxd_http_proxy_pool* pp) {
+  if (handler->proxy_hedge_delay>0) return (nxe_time_t)handler->proxy_hedge_delay*1000;
+  nxe_time_t p95=nxd_http_proxy_pool_get_response_time_p95(pp);
+  if (!p95) return NXWEB_DEFAULT_PROXY_HEDGE_DELAY;
+  return p95<NXWEB_PROXY_HEDGE_MIN_DELAY? NXWEB_PROXY_HEDGE_MIN_DELAY : p95;
+}
+
+static void send_proxy_request(nxweb_http_server_connection* conn, nxweb_http_request* req, nxweb_http_proxy_request_data* rdata, nxd_http_proxy* hpx) {
+
+  nxweb_log_debug("send_proxy_request");
+
+  nxe_loop* loop=conn->tdata->loop;
+  rdata->hpx=hpx;
+  start_backend_request(conn, req, rdata, hpx);
+
+  if (rdata->spool_req) { // body already received
+    if (rdata->sb_req.size) nxe_connect_streams(loop, &rdata->sb_req.data_out, &hpx->hcp.req_body_in);
+  }
+  else if (req->content_length) { // receive body
+    // on retry the pipe keeps whatever has been received so far
+    if (!rdata->splice_req && !req->chunked_encoding && can_splice(conn, req->content_length)
+        && !nxd_pbuffer_init(&rdata->pb_req)) rdata->splice_req=1;
+    if (rdata->splice_req) {
+      conn->hsp.cls->connect_request_body_out(&conn->hsp, &rdata->pb_req.data_in);
+      nxe_connect_streams(loop, &rdata->pb_req.data_out, &hpx->hcp.req_body_in);
+    }
+    else {
       nxd_rbuffer_init(&rdata->rb_req, rdata->rbuf, NXWEB_RBUF_SIZE); // use same buffer area for request and response bodies, as they do not overlap in time
       conn->hsp.cls->connect_request_body_out(&conn->hsp, &rdata->rb_req.data_in);
       nxe_connect_streams(loop, &rdata->rb_req.data_out, &hpx->hcp.req_body_in);
-      req->cdstate.monitor_only=1;
-
-      conn->hsp.cls->start_receiving_request_body(&conn->hsp);
     }
-    nxe_set_timer(loop, NXWEB_TIMER_BACKEND, &rdata->timer_backend);
-    return NXWEB_OK;
+    req->cdstate.monitor_only=1;
+
+    conn->hsp.cls->start_receiving_request_body(&conn->hsp);
+  }
+  nxe_set_timer(loop, NXWEB_TIMER_BACKEND, &rdata->timer_backend);
+  if (!rdata->hedged && can_hedge(conn, req, hpx)) nxe_set_timer_usec(loop, &rdata->timer_hedge, hedge_delay(conn->handler, hpx->pool));
+}
+
+static void timer_hedge_on_timeout(nxe_timer* timer, nxe_data data) {
+
+  nxweb_log_debug("timer_hedge_on_timeout");
+
+  nxweb_http_proxy_request_data* rdata=OBJ_PTR_FROM_FLD_PTR(nxweb_http_proxy_request_data, timer_hedge, timer);
+  nxweb_http_server_connection* conn=rdata->conn;
+  nxd_http_proxy* hpx=rdata->hpx;
+  if (!hpx || rdata->hedge_hpx || rdata->response_sending_started || rdata->proxy_request_complete) return;
+  nxd_http_proxy* hedge=nxd_http_proxy_pool_connect_other(hpx->pool, conn->hsp.rq->req.uri, hpx->server);
+  if (!hedge) return; // no other server available right now; keep waiting for the first one
+  nxweb_log_debug("proxy request conn=%p: no response from %s; hedging to %s", conn, hpx->server->host, hedge->server->host);
+  rdata->hedge_hpx=hedge;
+  rdata->hedged=1;
+  start_backend_request(conn, &conn->hsp.rq->req, rdata, hedge);
+}
+
+static const nxe_timer_class timer_hedge_class={.on_timeout=timer_hedge_on_timeout};
+
+static void cancel_hedge(nxweb_http_proxy_request_data* rdata) {
+  nxd_http_proxy* hedge=rdata->hedge_hpx;
+  nxe_unset_timer(rdata->conn->tdata->loop, 0, &rdata->timer_hedge);
+  if (!hedge) return;
+  unsubscribe_proxy_events(rdata, hedge);
+  rdata->hedge_hpx=0;
+  nxd_http_proxy_pool_return(hedge, 1); // request is in flight; connection can't be reused
+}
+
+static void promote_hedge(nxweb_http_proxy_request_data* rdata) {
+  // hedged request takes over; original one is abandoned and its connection closed
+  nxd_http_proxy* hpx=rdata->hpx;
+  unsubscribe_proxy_events(rdata, hpx);
+  nxd_http_proxy_pool_return(hpx, 1);
+  rdata->hpx=rdata->hedge_hpx;
+  rdata->hedge_hpx=0;
+}
+
+static void proxy_on_connection(nxd_http_proxy_pool_waiter* w, nxd_http_proxy* hpx) {
+
+  nxweb_log_debug("proxy_on_connection");
+
+  nxweb_http_proxy_request_data* rdata=OBJ_PTR_FROM_FLD_PTR(nxweb_http_proxy_request_data, waiter, w);
+  nxweb_http_server_connection* conn=rdata->conn;
+  rdata->waiting=0;
+  if (hpx) {
+    send_proxy_request(conn, &conn->hsp.rq->req, rdata, hpx);
   }
   else {
-    nxweb_http_response* resp=&conn->hsp._resp;
-    nxweb_send_http_error(resp, 502, "Bad Gateway");
-    return NXWEB_ERROR;
+    nxweb_log_warning("proxy request conn=%p timed out waiting for backend connection", conn);
+    nxweb_http_response* resp=&conn->hsp.rq->_resp;
+    nxweb_send_http_error(resp, 503, "Service Unavailable");
+    nxweb_start_sending_response(conn, resp);
+    rdata->response_sending_started=1;
+    rdata->proxy_request_complete=1;
   }
 }
 
+static nxweb_result start_proxy_request(nxweb_http_server_connection* conn, nxweb_http_request* req, nxweb_http_proxy_request_data* rdata) {
+
+  nxweb_log_debug("start_proxy_request");
+
+  nxweb_handler* handler=conn->handler;
+  assert(handler->idx>=0 && handler->idx<NXWEB_MAX_PROXY_POOLS);
+  nxd_http_proxy_pool* pp=&conn->tdata->proxy_pool[handler->idx];
+  nxd_http_proxy* hpx=nxd_http_proxy_pool_connect(pp, req->uri);
+  rdata->proxy_request_complete=0;
+  rdata->proxy_request_error=0;
+  rdata->response_sending_started=0;
+  if (hpx) {
+    send_proxy_request(conn, req, rdata, hpx);
+    return NXWEB_OK;
+  }
+  rdata->waiter.on_connection=proxy_on_connection;
+  rdata->waiter.uri=req->uri;
+  int r=nxd_http_proxy_pool_wait(pp, &rdata->waiter);
+  if (!r) {
+    rdata->waiting=1;
+    return NXWEB_OK;
+  }
+  nxweb_http_response* resp=&conn->hsp.rq->_resp;
+  if (r>0) nxweb_send_http_error(resp, 503, "Service Unavailable"); // backends at capacity
+  else nxweb_send_http_error(resp, 502, "Bad Gateway");
+  return NXWEB_ERROR;
+}
+
 static void retry_proxy_request(nxweb_http_proxy_request_data* rdata) {
 
   nxweb_log_debug("retry_proxy_request");
@@ -161,14 +506,15 @@ static void retry_proxy_request(nxweb_http_proxy_request_data* rdata) {
   assert(state==HSP_RECEIVING_HEADERS || state==HSP_RECEIVING_BODY || state==HSP_HANDLING);
 
   nxd_http_proxy_pool_return(hpx, 1);
-  if (rdata->rb_resp.data_in.pair) nxe_disconnect_streams(rdata->rb_resp.data_in.pair, &rdata->rb_resp.data_in);
-  if (rdata->rb_resp.data_out.pair) nxe_disconnect_streams(&rdata->rb_resp.data_out, rdata->rb_resp.data_out.pair);
-  if (rdata->rb_req.data_in.pair) nxe_disconnect_streams(rdata->rb_req.data_in.pair, &rdata->rb_req.data_in);
-  if (rdata->rb_req.data_out.pair) nxe_disconnect_streams(&rdata->rb_req.data_out, rdata->rb_req.data_out.pair);
-  if (rdata->proxy_events_sub.pub) nxe_unsubscribe(rdata->proxy_events_sub.pub, &rdata->proxy_events_sub);
+  disconnect_body_streams(rdata);
+  unsubscribe_proxy_events(rdata, hpx);
   rdata->hpx=0;
   rdata->retry_count++;
-  start_proxy_request(conn, &conn->hsp.req, rdata);
+  if (start_proxy_request(conn, &conn->hsp.rq->req, rdata)!=NXWEB_OK) { // no backend available
+    nxweb_start_sending_response(conn, &conn->hsp.rq->_resp);
+    rdata->response_sending_started=1;
+    rdata->proxy_request_complete=1; // ignore further backend errors
+  }
 }
 
 static void fail_proxy_request(nxweb_http_proxy_request_data* rdata) {
@@ -180,7 +526,7 @@ static void fail_proxy_request(nxweb_http_proxy_request_data* rdata) {
     nxweb_http_server_connection_finalize(conn, 0);
   }
   else {
-    nxweb_http_response* resp=&conn->hsp._resp;
+    nxweb_http_response* resp=&conn->hsp.rq->_resp;
     nxweb_send_http_error(resp, 504, "Gateway Timeout");
     nxweb_start_sending_response(conn, resp);
     rdata->response_sending_started=1;
@@ -199,18 +545,49 @@ static void timer_backend_on_timeout(nxe_timer* timer, nxe_data data) {
     // do nothing, continue processing until parent connection times out
     nxweb_log_warning("backend connection %p timeout; backend responded; post=%d resp=%d", conn, (int)rdata->hpx->hcp.req_body_sending_started, (int)rdata->response_sending_started);
   }
-  else if (rdata->retry_count>=NXWEB_PROXY_RETRY_COUNT) {
-    nxweb_log_error("backend connection %p timeout; retry count exceeded", conn);
-    fail_proxy_request(rdata);
-  }
   else {
-    nxweb_log_info("backend connection %p timeout; retrying", conn);
-    retry_proxy_request(rdata);
+    nxd_http_proxy_pool_report_failure(rdata->hpx);
+    if (rdata->hedge_hpx) {
+      nxweb_log_info("backend connection %p timeout; hedged request takes over", conn);
+      promote_hedge(rdata);
+      nxe_set_timer(timer->super.loop, NXWEB_TIMER_BACKEND, &rdata->timer_backend);
+    }
+    else if (rdata->retry_count>=NXWEB_PROXY_RETRY_COUNT) {
+      nxweb_log_error("backend connection %p timeout; retry count exceeded", conn);
+      fail_proxy_request(rdata);
+    }
+    else {
+      nxweb_log_info("backend connection %p timeout; retrying", conn);
+      retry_proxy_request(rdata);
+    }
   }
 }
 
 static const nxe_timer_class timer_backend_class={.on_timeout=timer_backend_on_timeout};
 
+static nxweb_result spool_request_body(nxweb_http_server_connection* conn, nxweb_http_request* req, nxweb_http_proxy_request_data* rdata) {
+
+  nxweb_log_debug("spool_request_body");
+
+  nxweb_handler* handler=conn->handler;
+  nxe_ssize_t max_size=handler->size>0? handler->size : NXWEB_DEFAULT_PROXY_MAX_SPOOL_SIZE;
+  nxe_ssize_t mem_size=handler->proxy_buffer_size>0? handler->proxy_buffer_size : NXWEB_DEFAULT_PROXY_BUFFER_SIZE;
+  if (!handler->dir) { // nowhere to spill => whole body must fit in memory buffer
+    if (max_size>mem_size) max_size=mem_size;
+    mem_size=max_size+1; // +1 makes sure EFBIG is raised before sbuffer would throttle
+  }
+  if (req->content_length>max_size) {
+    nxweb_send_http_error(&conn->hsp.rq->_resp, 413, "Request Entity Too Large");
+    return NXWEB_ERROR;
+  }
+  nxd_sbuffer_init(&rdata->sb_req, mem_size, handler->dir);
+  rdata->sb_req.max_size=max_size; // chunked bodies are checked as they arrive
+  rdata->spool_req=1;
+  conn->hsp.cls->connect_request_body_out(&conn->hsp, &rdata->sb_req.data_in);
+  conn->hsp.cls->start_receiving_request_body(&conn->hsp);
+  return NXWEB_OK; // backend connection is acquired in on_post_data_complete
+}
+
 static nxweb_result nxweb_http_proxy_handler_on_headers(nxweb_http_server_connection* conn, nxweb_http_request* req, nxweb_http_response* resp) {
 
   nxweb_log_debug("nxweb_http_proxy_handler_on_headers");
@@ -223,37 +600,79 @@ static nxweb_result nxweb_http_proxy_handler_on_headers(nxweb_http_server_connec
   conn->hsp.req_finalize=nxweb_http_proxy_request_finalize;
   rdata->rbuf=nxp_alloc(conn->tdata->free_rbuf_pool);
   rdata->timer_backend.super.cls.timer_cls=&timer_backend_class;
+  rdata->timer_hedge.super.cls.timer_cls=&timer_hedge_class;
+  if (conn->handler->proxy_spool_request && req->content_length) return spool_request_body(conn, req, rdata);
   return start_proxy_request(conn, req, rdata);
 }
 
+static nxweb_result nxweb_http_proxy_handler_on_post_data_complete(nxweb_http_server_connection* conn, nxweb_http_request* req, nxweb_http_response* resp) {
+
+  nxweb_log_debug("nxweb_http_proxy_handler_on_post_data_complete");
+
+  nxweb_http_proxy_request_data* rdata=conn->hsp.req_data;
+  if (!rdata->spool_req) return NXWEB_OK; // body has been streamed to backend
+  if (rdata->sb_req.error) {
+    if (rdata->sb_req.error==EFBIG) nxweb_send_http_error(resp, 413, "Request Entity Too Large");
+    else nxweb_send_http_error(resp, 500, "Internal Server Error");
+    nxweb_start_sending_response(conn, resp);
+    return NXWEB_ERROR;
+  }
+  if (start_proxy_request(conn, req, rdata)!=NXWEB_OK) {
+    nxweb_start_sending_response(conn, resp);
+    return NXWEB_ERROR;
+  }
+  return NXWEB_OK;
+}
+
 static nxweb_result proxy_generate_cache_key(nxweb_http_server_connection* conn, nxweb_http_request* req, nxweb_http_response* resp) {
   if (!req->get_method || req->content_length) return NXWEB_OK; // do not cache POST requests, etc.
   nxb_start_stream(req->nxb);
   _nxb_append_encode_file_path(req->nxb, req->host);
   if (conn->secure) nxb_append_str(req->nxb, "_s");
   _nxb_append_encode_file_path(req->nxb, req->uri);
+  if (want_backend_gzip(conn, req)) nxb_append_str(req->nxb, "$gzip"); // backend response is cached compressed
   nxb_append_char(req->nxb, '\0');
   resp->cache_key=nxb_finish_stream(req->nxb, 0);
   return NXWEB_OK;
 }
 
 NXWEB_DEFINE_HANDLER(http_proxy, .on_headers=nxweb_http_proxy_handler_on_headers,
+        .on_post_data_complete=nxweb_http_proxy_handler_on_post_data_complete,
         .on_generate_cache_key=proxy_generate_cache_key,
         .flags=NXWEB_HANDLE_ANY|NXWEB_ACCEPT_CONTENT);
 
-static void nxweb_http_server_proxy_events_sub_on_message(nxe_subscriber* sub, nxe_publisher* pub, nxe_data data) {
-
-  nxweb_log_debug("nxweb_http_server_proxy_events_sub_on_message");
+static int is_reused_connection_closed(nxd_http_proxy* hpx, int err) {
+  // reused keep-alive connection closed by backend is not a backend failure
+  return hpx->hcp.request_count && (err==NXE_ERROR || err==NXE_HUP || err==NXE_RDHUP || err==NXE_RDCLOSED);
+}
 
-  nxweb_http_proxy_request_data* rdata=(nxweb_http_proxy_request_data*)((char*)sub-offsetof(nxweb_http_proxy_request_data, proxy_events_sub));
+static void proxy_events_on_message(nxweb_http_proxy_request_data* rdata, nxe_subscriber* sub, nxe_publisher* pub, nxe_data data) {
   nxweb_http_server_connection* conn=rdata->conn;
   nxe_loop* loop=sub->super.loop;
+  if (rdata->hedge_hpx && pub==&rdata->hedge_hpx->hcp.events_pub) {
+    nxd_http_proxy* hedge=rdata->hedge_hpx;
+    if (data.i==NXD_HCP_RESPONSE_RECEIVED) {
+      nxweb_log_info("proxy request conn=%p: hedged request to %s answered before %s", conn, hedge->server->host, rdata->hpx->server->host);
+      nxd_http_proxy_pool_report_cancelled(rdata->hpx);
+      promote_hedge(rdata); // and proceed with its response below
+    }
+    else {
+      if (data.i<0) { // original request is still running; just drop the hedge
+        nxweb_log_info("proxy request conn=%p: hedged request to %s failed error=%d", conn, hedge->server->host, data.i);
+        if (!is_reused_connection_closed(hedge, data.i)) nxd_http_proxy_pool_report_failure(hedge);
+        cancel_hedge(rdata);
+      }
+      return;
+    }
+  }
   if (data.i==NXD_HCP_RESPONSE_RECEIVED) {
     nxe_unset_timer(loop, NXWEB_TIMER_BACKEND, &rdata->timer_backend);
-    //nxweb_http_request* req=&conn->hsp.req;
+    cancel_hedge(rdata); // if any; original request answered first
+    //nxweb_http_request* req=&conn->hsp.rq->req;
     nxd_http_proxy* hpx=rdata->hpx;
+    nxd_http_proxy_pool_report_response(hpx);
     nxweb_http_response* presp=&hpx->hcp.resp;
-    nxweb_http_response* resp=&conn->hsp._resp;
+    nxweb_http_response* resp=&conn->hsp.rq->_resp;
     resp->status=presp->status;
     resp->status_code=presp->status_code;
     resp->content_type=presp->content_type;
@@ -272,14 +691,80 @@ static void nxweb_http_server_proxy_events_sub_on_message(nxe_subscriber* sub, n
     resp->max_age=presp->max_age;
     resp->no_cache=presp->no_cache;
     resp->cache_private=presp->cache_private;
-    resp->content_out=&rdata->rb_resp.data_out;
+    nxweb_handler* handler=conn->handler;
+    nxweb_http_request* req=&conn->hsp.rq->req;
+    int inflate_resp=0;
+    const char* content_encoding=nx_simple_map_get_nocase(presp->headers, "Content-Encoding");
+    if (content_encoding && (!nx_strcasecmp(content_encoding, "gzip") || !nx_strcasecmp(content_encoding, "x-gzip"))) {
+      nx_simple_map_remove_nocase(&resp->headers, "Content-Encoding"); // gzip_encoded flag puts it back
+      if (want_backend_gzip(conn, req)) {
+        resp->gzip_encoded=1; // pass through; gzip filter leaves it alone
+      }
+      else if (!req->head_method && presp->content_length && presp->status_code!=204 && presp->status_code!=304) {
+        // backend sent gzip though we did not ask for it
+        if (init_inflate_resp(rdata)) {
+          nxweb_send_http_error(resp, 502, "Bad Gateway");
+          nxweb_start_sending_response(conn, resp);
+          rdata->response_sending_started=1;
+          rdata->proxy_request_error=1;
+          return;
+        }
+        inflate_resp=1;
+        resp->content_length=-1;
+        resp->chunked_autoencode=1;
+      }
+    }
+    if (handler->proxy_buffering) {
+      // read backend response at full speed regardless of client; backend connection is released on REQUEST_COMPLETE
+      rdata->buffer_resp=1;
+      copy_response_headers(conn->hsp.nxb, resp);
+      nxd_sbuffer_init(&rdata->sb_resp, handler->proxy_buffer_size>0? handler->proxy_buffer_size : NXWEB_DEFAULT_PROXY_BUFFER_SIZE, handler->dir);
+      nxe_connect_streams(loop, &hpx->hcp.resp_body_out, &rdata->sb_resp.data_in);
+      if (inflate_resp) { // buffer it compressed
+        nxe_connect_streams(loop, &rdata->sb_resp.data_out, &rdata->rb_resp.data_in);
+        resp->content_out=&rdata->rb_resp.data_out;
+      }
+      else {
+        resp->content_out=&rdata->sb_resp.data_out;
+      }
+    }
+    else if (inflate_resp) {
+      nxe_connect_streams(loop, &hpx->hcp.resp_body_out, &rdata->rb_resp.data_in);
+      resp->content_out=&rdata->rb_resp.data_out;
+    }
+    else if (!presp->chunked_encoding && !req->head_method && can_splice(conn, presp->content_length)
+        && !nxd_pbuffer_init(&rdata->pb_resp)) {
+      // move body from backend socket to client socket through pipe instead of rb_resp
+      // (body stream is only connected now, so nothing has been read into rb_resp yet)
+      rdata->splice_resp=1;
+      nxe_connect_streams(loop, &hpx->hcp.resp_body_out, &rdata->pb_resp.data_in);
+      resp->content_out=&rdata->pb_resp.data_out;
+    }
+    else {
+      nxd_rbuffer_init(&rdata->rb_resp, rdata->rbuf, NXWEB_RBUF_SIZE);
+      nxe_connect_streams(loop, &hpx->hcp.resp_body_out, &rdata->rb_resp.data_in);
+      resp->content_out=&rdata->rb_resp.data_out;
+    }
     nxweb_start_sending_response(conn, resp);
     rdata->response_sending_started=1;
-    nxweb_server_config.access_log_on_proxy_response(&conn->hsp.req, hpx, presp);
+    nxweb_server_config.access_log_on_proxy_response(req, hpx, presp);
     //nxweb_log_error("proxy request [%d] start sending response", conn->hpx->hcp.request_count);
   }
   else if (data.i==NXD_HCP_REQUEST_COMPLETE) {
     rdata->proxy_request_complete=1;
+    if (rdata->buffer_resp) {
+      // whole body is in sb_resp now; backend connection can serve other requests while client downloads
+      nxd_http_proxy* hpx=rdata->hpx;
+      if (rdata->sb_resp.data_in.pair) nxe_disconnect_streams(rdata->sb_resp.data_in.pair, &rdata->sb_resp.data_in);
+      unsubscribe_proxy_events(rdata, hpx);
+      rdata->hpx=0;
+      nxd_http_proxy_pool_return(hpx, 0);
+      if (rdata->sb_resp.error) {
+        nxweb_log_error("proxy request conn=%p: can't buffer response for %s; temp file error=%d", conn, conn->hsp.rq->req.uri, rdata->sb_resp.error);
+        nxweb_http_server_connection_finalize(conn, 0);
+        return;
+      }
+    }
     //nxweb_log_error("proxy request [%d] complete", conn->hpx->hcp.request_count);
   }
   else if (data.i<0) {
@@ -296,7 +781,13 @@ static void nxweb_http_server_proxy_events_sub_on_message(nxe_subscriber* sub, n
     }
     else {
       nxe_unset_timer(loop, NXWEB_TIMER_BACKEND, &rdata->timer_backend);
-      if (rdata->retry_count>=NXWEB_PROXY_RETRY_COUNT || rdata->hpx->hcp.req_body_sending_started /*|| rdata->response_sending_started*/) {
+      if (!is_reused_connection_closed(rdata->hpx, data.i)) nxd_http_proxy_pool_report_failure(rdata->hpx);
+      if (rdata->hedge_hpx) {
+        nxweb_log_info("proxy request conn=%p rc=%d error=%d; hedged request takes over", conn, rdata->hpx->hcp.request_count, data.i);
+        promote_hedge(rdata);
+        nxe_set_timer(loop, NXWEB_TIMER_BACKEND, &rdata->timer_backend);
+      }
+      else if (rdata->retry_count>=NXWEB_PROXY_RETRY_COUNT || rdata->hpx->hcp.req_body_sending_started /*|| rdata->response_sending_started*/) {
         nxweb_log_error("proxy request conn=%p rc=%d retry=%d error=%d; failed", conn, rdata->hpx->hcp.request_count, rdata->retry_count, data.i);
         fail_proxy_request(rdata);
       }
@@ -309,3 +800,19 @@ static void nxweb_http_server_proxy_events_sub_on_message(nxe_subscriber* sub, n
     }
   }
 }
+
+static void nxweb_http_server_proxy_events_sub_on_message(nxe_subscriber* sub, nxe_publisher* pub, nxe_data data) {
+
+  nxweb_log_debug("nxweb_http_server_proxy_events_sub_on_message");
+
+  nxweb_http_proxy_request_data* rdata=OBJ_PTR_FROM_FLD_PTR(nxweb_http_proxy_request_data, proxy_events_sub, sub);
+  proxy_events_on_message(rdata, sub, pub, data);
+}
+
+static void nxweb_http_server_hedge_events_sub_on_message(nxe_subscriber* sub, nxe_publisher* pub, nxe_data data) {
+
+  nxweb_log_debug("nxweb_http_server_hedge_events_sub_on_message");
+
+  nxweb_http_proxy_request_data* rdata=OBJ_PTR_FROM_FLD_PTR(nxweb_http_proxy_request_data, hedge_events_sub, sub);
+  proxy_events_on_message(rdata, sub, pub, data);
+}
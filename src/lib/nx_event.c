@@ -17,6 +17,7 @@
  * License along with NXWEB. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE
 #define _FILE_OFFSET_BITS 64
 
 #include "nx_event.h"
@@ -33,6 +34,20 @@
 // #define IS_IN_LOOP(loop, evt) ((evt)->loop==(loop))
 #define IS_IN_LOOP(evt) ((evt)->loop)
 
+enum nxe_backend nxe_default_backend=NXE_BACKEND_EPOLL;
+
+static inline int nxe_ctl_add(nxe_loop* loop, int fd, uint32_t events, void* ptr) {
+  if (loop->uring) return _nxe_uring_add(loop, fd, events, ptr);
+  struct epoll_event ev={events, {.ptr=ptr}};
+  return epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+static inline int nxe_ctl_del(nxe_loop* loop, int fd) {
+  if (loop->uring) return _nxe_uring_del(loop, fd);
+  struct epoll_event ev={0};
+  return epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, fd, &ev);
+}
+
 void nxe_link(nxe_loop* loop, nxe_event* evt) {
   //if (IS_IN_LOOP(loop, evt)) return; // already linked
   assert(loop);
@@ -94,63 +109,140 @@ void nxe_eventfd_close(int* fd) {
 
 void nxe_set_timer_queue_timeout(nxe_loop* loop, int queue_idx, nxe_time_t usec_interval) {
   assert(queue_idx>=0 && queue_idx<NXE_NUMBER_OF_TIMER_QUEUES);
-  loop->timers[queue_idx].timeout=usec_interval;
+  loop->timer_timeouts[queue_idx]=usec_interval;
+}
+
+/*
+ * Timers are kept in hierarchical timing wheel: NXE_TIMER_WHEEL_LEVELS levels
+ * of NXE_TIMER_WHEEL_SIZE slots each. Level L slot covers 2^(BITS*L) msec.
+ * When lower level completes full turn next slot of upper level gets cascaded down.
+ * Insert and cancel are O(1).
+ *
+ * Rearming timer to later time does not relink it: only abs_time gets updated;
+ * timer is rehashed when its slot comes up (lazy rearm).
+ */
+
+#define WHEEL_SLOT_TICKS(level) ((nxe_time_t)1<<(NXE_TIMER_WHEEL_BITS*(level)))
+#define WHEEL_SLOT_IDX(tick, level) (((tick)>>(NXE_TIMER_WHEEL_BITS*(level))) & (NXE_TIMER_WHEEL_SIZE-1))
+#define TIMER_TICK(abs_time) (((abs_time)+999)/1000) // round up; never fire early
+
+static inline void nxe_timer_link(nxe_timer* head, nxe_timer* timer) {
+  timer->next=head;
+  timer->prev=head->prev;
+  head->prev->next=timer;
+  head->prev=timer;
+}
+
+static inline void nxe_timer_unlink(nxe_timer* timer) {
+  timer->prev->next=timer->next;
+  timer->next->prev=timer->prev;
+  timer->next=0;
+  timer->prev=0;
+}
+
+static void nxe_timer_hash(nxe_loop* loop, nxe_timer* timer) {
+  nxe_time_t base=loop->timer_wheel_tick; // ticks up to base have been processed
+  nxe_time_t tick=TIMER_TICK(timer->abs_time);
+  if (tick<=base) tick=base+1;
+  nxe_time_t idx=tick-base-1;
+  int level;
+  for (level=0; level<NXE_TIMER_WHEEL_LEVELS-1; level++) {
+    if (idx<WHEEL_SLOT_TICKS(level+1)) break;
+  }
+  if (idx>=WHEEL_SLOT_TICKS(NXE_TIMER_WHEEL_LEVELS)) tick=base+WHEEL_SLOT_TICKS(NXE_TIMER_WHEEL_LEVELS); // too far; will be rehashed
+  timer->wheel_tick=tick;
+  nxe_timer_link(&loop->timer_wheel[level][WHEEL_SLOT_IDX(tick, level)], timer);
+}
+
+void nxe_set_timer_usec(nxe_loop* loop, nxe_timer* timer, nxe_time_t usec_interval) {
+  timer->super.loop=loop;
+  timer->abs_time=loop->current_time+usec_interval;
+  if (timer->next) {
+    if (TIMER_TICK(timer->abs_time)>=timer->wheel_tick) return; // lazy rearm
+    nxe_timer_unlink(timer);
+  }
+  else {
+    loop->num_timers++;
+  }
+  nxe_timer_hash(loop, timer);
 }
 
-// NOTE: setting the same timer twice leads to unpredictable results; make sure to unset first
 void nxe_set_timer(nxe_loop* loop, int queue_idx, nxe_timer* timer) {
   assert(queue_idx>=0 && queue_idx<NXE_NUMBER_OF_TIMER_QUEUES);
-  assert(timer->abs_time==0 && timer->next==0 && timer->prev==0);
-  nxe_timer_queue* tq=&loop->timers[queue_idx];
-  timer->super.loop=loop;
-  timer->abs_time=loop->current_time+tq->timeout;
-  timer->next=0;
-  timer->prev=tq->timer_last;
-  if (tq->timer_last) tq->timer_last->next=timer;
-  else tq->timer_first=timer;
-  tq->timer_last=timer;
+  nxe_set_timer_usec(loop, timer, loop->timer_timeouts[queue_idx]);
 }
 
 void nxe_unset_timer(nxe_loop* loop, int queue_idx, nxe_timer* timer) {
-  if (!timer->abs_time) return;
-  assert(queue_idx>=0 && queue_idx<NXE_NUMBER_OF_TIMER_QUEUES);
-  nxe_timer_queue* tq=&loop->timers[queue_idx];
-  if (timer->prev) timer->prev->next=timer->next;
-  else tq->timer_first=timer->next;
-  if (timer->next) timer->next->prev=timer->prev;
-  else tq->timer_last=timer->prev;
-  timer->next=0;
-  timer->prev=0;
+  if (!timer->next) return;
+  nxe_timer_unlink(timer);
   timer->abs_time=0;
+  loop->num_timers--;
 }
 
-static void nxe_process_timers(nxe_loop* loop) {
+static void nxe_timer_cascade(nxe_loop* loop, int level, nxe_time_t tick) {
+  nxe_timer* head=&loop->timer_wheel[level][WHEEL_SLOT_IDX(tick, level)];
   nxe_timer* t;
-  int i;
-  nxe_timer_queue* tq;
-  for (i=NXE_NUMBER_OF_TIMER_QUEUES, tq=loop->timers; i--; tq++) {
-    while (tq->timer_first && tq->timer_first->abs_time-250000 <= loop->current_time) { // 0.25 sec precision
-      t=tq->timer_first;
-      tq->timer_first=t->next;
-      if (tq->timer_first) tq->timer_first->prev=0;
-      else tq->timer_last=0;
-      t->next=0;
-      t->prev=0;
-      t->abs_time=0;
-      TIMER_CLASS(t)->on_timeout(t, t->data);
+  while ((t=head->next)!=head) {
+    nxe_timer_unlink(t);
+    nxe_timer_hash(loop, t);
+  }
+}
+
+static nxe_time_t nxe_next_timer_tick(nxe_loop* loop) { // returns 0 if no timers set
+  if (!loop->num_timers) return 0;
+  nxe_time_t base=loop->timer_wheel_tick;
+  nxe_time_t next=0;
+  int level, i;
+  for (level=0; level<NXE_TIMER_WHEEL_LEVELS; level++) {
+    nxe_time_t slot=base>>(NXE_TIMER_WHEEL_BITS*level);
+    for (i=1; i<=NXE_TIMER_WHEEL_SIZE; i++) {
+      nxe_timer* head=&loop->timer_wheel[level][(slot+i) & (NXE_TIMER_WHEEL_SIZE-1)];
+      if (head->next!=head) {
+        nxe_time_t tick=(slot+i)<<(NXE_TIMER_WHEEL_BITS*level); // level 0 => exact tick; upper levels => cascade time
+        if (!next || tick<next) next=tick;
+        break;
+      }
     }
   }
+  return next;
 }
 
-static nxe_timer_queue* nxe_closest_tq(nxe_loop* loop) {
-  int i;
-  nxe_timer_queue* tq;
-  nxe_timer_queue* closest_tq=0;
-  for (i=NXE_NUMBER_OF_TIMER_QUEUES, tq=loop->timers; i--; tq++) {
-    if (tq->timer_first && (!closest_tq || tq->timer_first->abs_time < closest_tq->timer_first->abs_time))
-      closest_tq=tq;
+static void nxe_process_timers(nxe_loop* loop) {
+  nxe_time_t now=loop->current_time/1000;
+  nxe_timer* t;
+  nxe_timer expired;
+  int level;
+  while (loop->timer_wheel_tick<now) {
+    nxe_time_t tick=nxe_next_timer_tick(loop);
+    if (!tick || tick>now) {
+      loop->timer_wheel_tick=now;
+      break;
+    }
+    // nothing is due before tick; cascade upper levels that complete their slot on this tick
+    loop->timer_wheel_tick=tick-1;
+    for (level=NXE_TIMER_WHEEL_LEVELS-1; level>0; level--) {
+      if (!(tick & (WHEEL_SLOT_TICKS(level)-1))) nxe_timer_cascade(loop, level, tick);
+    }
+    loop->timer_wheel_tick=tick;
+    // move slot contents to separate list as callbacks could set new timers
+    nxe_timer* head=&loop->timer_wheel[0][WHEEL_SLOT_IDX(tick, 0)];
+    if (head->next==head) continue;
+    expired.next=head->next;
+    expired.prev=head->prev;
+    expired.next->prev=&expired;
+    expired.prev->next=&expired;
+    head->next=head->prev=head;
+    while ((t=expired.next)!=&expired) {
+      nxe_timer_unlink(t);
+      if (TIMER_TICK(t->abs_time)>tick) { // has been rearmed
+        nxe_timer_hash(loop, t);
+        continue;
+      }
+      t->abs_time=0;
+      loop->num_timers--;
+      TIMER_CLASS(t)->on_timeout(t, t->data);
+    }
   }
-  return closest_tq;
 }
 
 static void nxe_process_loop(nxe_loop* loop) {
@@ -181,7 +273,7 @@ void nxe_break(nxe_loop* loop) {
 void nxe_run(nxe_loop* loop) {
   int i;
   int time_to_wait;
-  nxe_timer_queue* closest_tq=0;
+  nxe_time_t next_tick;
 
   loop->current_time=nxe_get_time_usec();
 
@@ -196,14 +288,15 @@ void nxe_run(nxe_loop* loop) {
         nxe_process_loop(loop);
       }
     }
-    closest_tq=nxe_closest_tq(loop);
-    if (!loop->first && !closest_tq && loop->ref_count<=0) break;
+    next_tick=nxe_next_timer_tick(loop);
+    if (!loop->first && !next_tick && loop->ref_count<=0) break;
 
     // now do epoll_wait
-    time_to_wait=closest_tq? (int)((closest_tq->timer_first->abs_time - loop->current_time)/1000) : 1000;
+    time_to_wait=next_tick? (int)(next_tick - loop->current_time/1000) : 1000;
     if (time_to_wait>1000) time_to_wait=1000; // for gc
     if (time_to_wait<0) time_to_wait=0;
-    loop->num_epoll_events=epoll_wait(loop->epoll_fd, loop->epoll_events, loop->max_epoll_events, time_to_wait);
+    loop->num_epoll_events=loop->uring? _nxe_uring_wait(loop, time_to_wait)
+                                      : epoll_wait(loop->epoll_fd, loop->epoll_events, loop->max_epoll_events, time_to_wait);
     loop->current_time=nxe_get_time_usec();
     if (loop->num_epoll_events<0) {
       if (errno!=EINTR) nxweb_log_error("epoll_wait error: %d", errno);
@@ -262,8 +355,9 @@ const nxe_event_source_class* const NXE_ES_LFD=&_NXE_ES_LFD;
 void nxe_register_fd_source(nxe_loop* loop, nxe_fd_source* fs) {
   assert(!fs->data_is.super.loop); // not registered yet
   // add event to epoll
-  struct epoll_event ev={EPOLLIN|EPOLLOUT|EPOLLRDHUP|EPOLLHUP|EPOLLET, {.ptr=fs}};
-  if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fs->fd, &ev)==-1) {
+  uint32_t events=EPOLLIN|EPOLLOUT|EPOLLRDHUP|EPOLLHUP|EPOLLET;
+  if (fs->uring_io && !(loop->uring && _nxe_uring_add_socket(loop, fs->fd, events, fs)==0)) fs->uring_io=0;
+  if (!fs->uring_io && nxe_ctl_add(loop, fs->fd, events, fs)==-1) {
     nxweb_log_error("epoll_ctl ADD error: %d", errno);
     return;
   }
@@ -275,8 +369,7 @@ void nxe_unregister_fd_source(nxe_fd_source* fs) { // removes nxe_event's
   nxe_loop* loop=fs->data_is.super.loop;
   assert(loop);
   // remove event from epoll
-  struct epoll_event ev={0};
-  if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, fs->fd, &ev)==-1) {
+  if (nxe_ctl_del(loop, fs->fd)==-1) {
     nxweb_log_error("epoll_ctl DEL error: %d", errno);
     return;
   }
@@ -290,8 +383,7 @@ void nxe_unregister_fd_source(nxe_fd_source* fs) { // removes nxe_event's
 void nxe_register_eventfd_source(nxe_loop* loop, nxe_eventfd_source* efs) {
   assert(!efs->data_notify.super.loop); // not registered yet
   // add event to epoll
-  struct epoll_event ev={EPOLLIN|/*EPOLLOUT|*/EPOLLRDHUP|EPOLLHUP|EPOLLET, {.ptr=efs}};
-  if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, efs->fd[0], &ev)==-1) {
+  if (nxe_ctl_add(loop, efs->fd[0], EPOLLIN|/*EPOLLOUT|*/EPOLLRDHUP|EPOLLHUP|EPOLLET, efs)==-1) {
     nxweb_log_error("epoll_ctl ADD error: %d", errno);
     close(efs->fd[0]);
     efs->fd[0]=0;
@@ -306,8 +398,7 @@ void nxe_unregister_eventfd_source(nxe_eventfd_source* efs) {
   assert(loop);
   if (efs->fd[0]) {
     // remove event from epoll
-    struct epoll_event ev={0};
-    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, efs->fd[0], &ev)==-1) {
+    if (nxe_ctl_del(loop, efs->fd[0])==-1) {
       nxweb_log_error("epoll_ctl DEL error: %d", errno);
     }
   }
@@ -323,8 +414,9 @@ void nxe_trigger_eventfd(nxe_eventfd_source* efs) {
 void nxe_register_listenfd_source(nxe_loop* loop, nxe_listenfd_source* lfs) {
   assert(!lfs->data_notify.super.loop); // not registered yet
   // add event to epoll
-  struct epoll_event ev={EPOLLIN|/*EPOLLOUT|*/EPOLLRDHUP|EPOLLHUP|EPOLLET, {.ptr=lfs}};
-  if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, lfs->fd, &ev)==-1) {
+  uint32_t events=EPOLLIN|/*EPOLLOUT|*/EPOLLRDHUP|EPOLLHUP|EPOLLET;
+  lfs->uring_accept=loop->uring && _nxe_uring_add_listener(loop, lfs->fd, events, lfs)==0;
+  if (!lfs->uring_accept && nxe_ctl_add(loop, lfs->fd, events, lfs)==-1) {
     nxweb_log_error("epoll_ctl ADD error: %d", errno);
     return;
   }
@@ -336,8 +428,7 @@ void nxe_unregister_listenfd_source(nxe_listenfd_source* lfs) {
   nxe_loop* loop=lfs->data_notify.super.loop;
   assert(loop);
   // remove event from epoll
-  struct epoll_event ev={0};
-  if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, lfs->fd, &ev)==-1) {
+  if (nxe_ctl_del(loop, lfs->fd)==-1) {
     nxweb_log_error("epoll_ctl DEL error: %d", errno);
   }
   while (lfs->data_notify.sub) nxe_unsubscribe(&lfs->data_notify, lfs->data_notify.sub);
@@ -345,6 +436,11 @@ void nxe_unregister_listenfd_source(nxe_listenfd_source* lfs) {
   loop->ref_count--;
 }
 
+int nxe_accept(nxe_listenfd_source* lfs, struct sockaddr* addr, socklen_t* addrlen) {
+  if (lfs->uring_accept) return _nxe_uring_accept(lfs->data_notify.super.loop, lfs->fd, addr, addrlen);
+  return accept4(lfs->fd, addr, addrlen, SOCK_NONBLOCK);
+}
+
 void nxe_unref(nxe_loop* loop) {
   loop->ref_count--;
 }
@@ -556,11 +652,22 @@ nxe_loop* nxe_create(int max_epoll_events) {
   loop->gc_pub.super.cls.pub_cls=NXE_PUB_DEFAULT;
 
   loop->current_time=nxe_get_time_usec();
-  loop->epoll_fd=epoll_create(1); // size ignored
+  loop->timer_wheel_tick=loop->current_time/1000;
+  int i, j;
+  for (i=0; i<NXE_TIMER_WHEEL_LEVELS; i++) {
+    for (j=0; j<NXE_TIMER_WHEEL_SIZE; j++) {
+      loop->timer_wheel[i][j].next=loop->timer_wheel[i][j].prev=&loop->timer_wheel[i][j];
+    }
+  }
+  if (nxe_default_backend==NXE_BACKEND_IO_URING) {
+    if (_nxe_uring_create(loop)==-1) nxweb_log_warning("io_uring backend not available; using epoll");
+  }
+  if (!loop->uring) loop->epoll_fd=epoll_create(1); // size ignored
   return loop;
 }
 
 void nxe_destroy(nxe_loop* loop) {
+  if (loop->uring) _nxe_uring_destroy(loop);
   nxp_finalize(&loop->free_event_pool);
   nx_free(loop);
 }
@@ -0,0 +1,1129 @@
+/*
+ * Copyright (c) 2011-2012 Yaroslav Stavnichiy <yarosla@gmail.com>
+ *
+ * This file is part of NXWEB.
+ *
+ * NXWEB is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * NXWEB is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with NXWEB. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include "nx_event.h"
+#include "misc.h"
+
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+/*
+ * io_uring event backend.
+ *
+ * Each registered source gets a multishot POLL_ADD request, which behaves like
+ * EPOLLET registration: a completion is posted on every readiness change.
+ * Completions are translated into loop->epoll_events[] so event sources,
+ * streams and their emit() methods work exactly as with epoll.
+ *
+ * Registrations and removals are not submitted immediately; they are queued
+ * in SQ ring and submitted by the same io_uring_enter() call that waits
+ * for completions.
+ *
+ * Plain sockets (nxd_socket) also do their I/O through the ring:
+ *  - instead of POLLIN they get multishot RECV into provided buffer ring
+ *    shared by the loop; received buffers are queued per socket and handed
+ *    to data_is reader by _nxe_uring_recv(); POLLIN-like event is emitted
+ *    on every completion;
+ *  - _nxe_uring_send() copies data into per-socket send buffer; all sockets
+ *    that got data during loop iteration are flushed with non-blocking SEND
+ *    requests submitted by the same io_uring_enter() that waits for events;
+ *  - socket close is postponed until its send buffer is flushed.
+ * Reader falls back to plain recv() whenever multishot RECV is not armed
+ * (out of buffers, or cancelled as reader is too slow) and rearms it once
+ * socket is drained. Files (sendfile) and pipes (splice) go directly to socket
+ * after send buffer has been flushed.
+ *
+ * Listening sockets get multishot ACCEPT instead of POLLIN; accepted fds are
+ * queued per listener and handed out by _nxe_uring_accept(). POLLIN-like event
+ * is emitted when the queue becomes non-empty. Same as with recv, accept4()
+ * is used while multishot ACCEPT is not armed (cancelled as too many accepted
+ * connections are waiting, or failed with an error). Kernels without multishot
+ * accept (pre 5.19) fail it with EINVAL; listeners fall back to poll + accept4() then.
+ *
+ * user_data = (generation<<32 | op<<30 | fd). Slot generation is bumped on every
+ * registration, so completions from removed requests are recognized and dropped
+ * even if the fd number has been reused in the meantime. SEND completions
+ * do not need that as socket is never closed while SEND is in flight.
+ */
+
+#ifdef WITH_IO_URING
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define NXE_URING_SQ_ENTRIES 256
+#define NXE_URING_CQ_ENTRIES 4096
+
+#define NXE_URING_OP_POLL 0
+#define NXE_URING_OP_RECV 1
+#define NXE_URING_OP_SEND 2
+#define NXE_URING_OP_ACCEPT 3
+#define NXE_URING_FD_MASK 0x3fffffff
+
+#ifdef IORING_RECV_MULTISHOT
+#define NXE_URING_SOCKET_IO
+#define NXE_URING_BUFFER_GROUP 0
+#define NXE_URING_RECV_BUFFERS 1024 // provided buffer ring size; must be power of 2
+#define NXE_URING_RECV_BUFFER_SIZE 4096
+#define NXE_URING_MAX_RECV_PENDING 65536 // per socket; multishot recv gets cancelled above that until reader catches up
+#define NXE_URING_SPLICE_IOV 16 // receive buffers passed to pipe per call
+#define NXE_URING_SEND_BUFFER_SIZE 32768 // allocated for sockets with unsent data only
+#define NXE_URING_MAX_FREE_SEND_BUFFERS 64
+#define NXE_URING_DRAIN_TIMEOUT 10000000 // usec; unsent data of closed socket is dropped after that
+#define NXE_URING_MAX_ACCEPT_PENDING 64 // per listener; multishot accept gets cancelled above that until caller takes them
+#endif // IORING_RECV_MULTISHOT
+
+typedef struct nxe_uring_fd_list {
+  int* fds;
+  int count;
+  int size;
+} nxe_uring_fd_list;
+
+typedef struct nxe_uring_slot {
+  void* ptr; // registered event source; null if not registered
+  uint32_t events;
+  uint32_t gen;
+  _Bool poll_armed:1;
+#ifdef NXE_URING_SOCKET_IO
+  _Bool socket_io:1; // recv/send go through the ring
+  _Bool recv_armed:1; // multishot recv is active (or being cancelled)
+  _Bool recv_cancelling:1;
+  _Bool recv_eof:1;
+  _Bool send_queued:1; // listed in send_fds for flushing
+  _Bool send_blocked:1; // writer got short count; emit EPOLLOUT when there is room again
+  _Bool shut_wr_pending:1;
+  _Bool close_pending:1;
+  _Bool close_good:1;
+  _Bool listener:1; // connections are accepted through the ring
+  _Bool accept_armed:1; // multishot accept is active (or being cancelled)
+  _Bool accept_cancelling:1;
+  int recv_error;
+  int send_error;
+  unsigned recv_head; // chain of received buffers; bid+1, 0 if empty
+  unsigned recv_tail;
+  unsigned recv_offs; // bytes consumed from head buffer
+  unsigned recv_bytes; // bytes received, not consumed yet
+  char* send_buf;
+  unsigned send_offs; // sent up to here
+  unsigned send_size; // filled up to here
+  unsigned send_inflight; // bytes submitted by SEND waiting for completion
+  nxe_time_t drain_deadline;
+  nxe_uring_fd_list accept_fds; // accepted connections not taken yet
+  int accept_head; // next one to take
+#endif
+} nxe_uring_slot;
+
+typedef struct nxe_uring {
+  int ring_fd;
+  unsigned sq_entries;
+  unsigned* sq_head;
+  unsigned* sq_tail;
+  unsigned* sq_mask;
+  unsigned* sq_array;
+  struct io_uring_sqe* sqes;
+  unsigned sq_local_tail;
+  unsigned to_submit;
+  unsigned* cq_head;
+  unsigned* cq_tail;
+  unsigned* cq_mask;
+  struct io_uring_cqe* cqes;
+  void* sq_ring;
+  size_t sq_ring_size;
+  void* cq_ring;
+  size_t cq_ring_size;
+  size_t sqes_size;
+  int max_slots;
+  nxe_uring_slot* slots;
+#ifdef NXE_URING_SOCKET_IO
+  struct io_uring_buf_ring* buf_ring; // null if socket I/O is not supported by kernel
+  unsigned short buf_ring_tail;
+  char* bufs;
+  uint32_t* buf_len; // bytes received into buffer; indexed by bid
+  uint16_t* buf_next; // next buffer in socket's recv chain; bid+1
+  nxe_uring_fd_list send_fds; // sockets to flush before waiting
+  nxe_uring_fd_list drain_fds; // closed sockets waiting for their data to be sent
+  char* free_send_bufs; // list linked through first bytes of each buffer
+  int num_free_send_bufs;
+  _Bool no_multishot_accept; // kernel has rejected it; listeners use poll
+#endif
+} nxe_uring;
+
+static int uring_setup(unsigned entries, struct io_uring_params* p) {
+  return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, void* arg, size_t argsz) {
+  return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static inline uint64_t uring_user_data(uint32_t gen, int op, int fd) {
+  return ((uint64_t)gen<<32)|((uint32_t)op<<30)|((uint32_t)fd & NXE_URING_FD_MASK);
+}
+
+static void uring_unmap(nxe_uring* r) {
+  if (r->sqes && r->sqes!=MAP_FAILED) munmap(r->sqes, r->sqes_size);
+  if (r->cq_ring && r->cq_ring!=MAP_FAILED && r->cq_ring!=r->sq_ring) munmap(r->cq_ring, r->cq_ring_size);
+  if (r->sq_ring && r->sq_ring!=MAP_FAILED) munmap(r->sq_ring, r->sq_ring_size);
+}
+
+#ifdef NXE_URING_SOCKET_IO
+
+static void uring_recycle_buffer(nxe_uring* r, unsigned bid) {
+  struct io_uring_buf* buf=&r->buf_ring->bufs[r->buf_ring_tail & (NXE_URING_RECV_BUFFERS-1)];
+  buf->addr=(uint64_t)(uintptr_t)(r->bufs+(size_t)bid*NXE_URING_RECV_BUFFER_SIZE);
+  buf->len=NXE_URING_RECV_BUFFER_SIZE;
+  buf->bid=(uint16_t)bid;
+  r->buf_ring_tail++;
+  __atomic_store_n(&r->buf_ring->tail, r->buf_ring_tail, __ATOMIC_RELEASE);
+}
+
+static void uring_setup_buffers(nxe_uring* r, struct io_uring_params* p) {
+#ifdef IORING_FEAT_REG_REG_RING
+  // multishot recv needs 6.0+, provided buffer rings 5.19+; this feature flag is the nearest marker (6.3)
+  if (!(p->features & IORING_FEAT_REG_REG_RING)) return;
+#else
+  return;
+#endif
+  size_t ring_size=NXE_URING_RECV_BUFFERS*sizeof(struct io_uring_buf);
+  void* ring=mmap(0, ring_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if (ring==MAP_FAILED) return;
+  struct io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr=(uint64_t)(uintptr_t)ring;
+  reg.ring_entries=NXE_URING_RECV_BUFFERS;
+  reg.bgid=NXE_URING_BUFFER_GROUP;
+  if (syscall(__NR_io_uring_register, r->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1)) {
+    nxweb_log_warning("io_uring provided buffer ring not available %d; sockets use poll only", errno);
+    munmap(ring, ring_size);
+    return;
+  }
+  r->buf_ring=ring;
+  r->bufs=nx_alloc((size_t)NXE_URING_RECV_BUFFERS*NXE_URING_RECV_BUFFER_SIZE);
+  r->buf_len=nx_calloc(NXE_URING_RECV_BUFFERS*sizeof(uint32_t));
+  r->buf_next=nx_calloc(NXE_URING_RECV_BUFFERS*sizeof(uint16_t));
+  unsigned bid;
+  for (bid=0; bid<NXE_URING_RECV_BUFFERS; bid++) uring_recycle_buffer(r, bid);
+}
+
+static void uring_fd_list_add(nxe_uring_fd_list* l, int fd) {
+  if (l->count>=l->size) {
+    int size=l->size? l->size*2 : 64;
+    int* fds=nx_alloc(size*sizeof(int));
+    if (l->fds) {
+      memcpy(fds, l->fds, l->count*sizeof(int));
+      nx_free(l->fds);
+    }
+    l->fds=fds;
+    l->size=size;
+  }
+  l->fds[l->count++]=fd;
+}
+
+#endif // NXE_URING_SOCKET_IO
+
+int _nxe_uring_create(nxe_loop* loop) {
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  p.flags=IORING_SETUP_CQSIZE;
+  p.cq_entries=NXE_URING_CQ_ENTRIES;
+#if defined(IORING_SETUP_SINGLE_ISSUER) && defined(IORING_SETUP_DEFER_TASKRUN)
+  // loop is owned by single thread, which is also the one that waits for completions
+  p.flags|=IORING_SETUP_SINGLE_ISSUER|IORING_SETUP_DEFER_TASKRUN;
+#endif
+  int fd=uring_setup(NXE_URING_SQ_ENTRIES, &p);
+  if (fd<0 && errno==EINVAL) { // older kernel
+    memset(&p, 0, sizeof(p));
+    p.flags=IORING_SETUP_CQSIZE;
+    p.cq_entries=NXE_URING_CQ_ENTRIES;
+    fd=uring_setup(NXE_URING_SQ_ENTRIES, &p);
+  }
+  if (fd<0) {
+    nxweb_log_error("io_uring_setup() failed %d", errno);
+    return -1;
+  }
+  if (!(p.features & IORING_FEAT_EXT_ARG) || !(p.features & IORING_FEAT_NODROP)) {
+    nxweb_log_error("io_uring backend requires kernel 5.11+");
+    close(fd);
+    return -1;
+  }
+
+  nxe_uring* r=nx_calloc(sizeof(nxe_uring));
+  r->ring_fd=fd;
+  r->sq_entries=p.sq_entries;
+  r->sq_ring_size=p.sq_off.array+p.sq_entries*sizeof(unsigned);
+  r->cq_ring_size=p.cq_off.cqes+p.cq_entries*sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (r->cq_ring_size>r->sq_ring_size) r->sq_ring_size=r->cq_ring_size;
+    r->cq_ring_size=r->sq_ring_size;
+  }
+  r->sq_ring=mmap(0, r->sq_ring_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (r->sq_ring==MAP_FAILED) goto ERR;
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    r->cq_ring=r->sq_ring;
+  }
+  else {
+    r->cq_ring=mmap(0, r->cq_ring_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (r->cq_ring==MAP_FAILED) goto ERR;
+  }
+  r->sqes_size=p.sq_entries*sizeof(struct io_uring_sqe);
+  r->sqes=mmap(0, r->sqes_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (r->sqes==MAP_FAILED) goto ERR;
+
+  r->sq_head=(unsigned*)((char*)r->sq_ring+p.sq_off.head);
+  r->sq_tail=(unsigned*)((char*)r->sq_ring+p.sq_off.tail);
+  r->sq_mask=(unsigned*)((char*)r->sq_ring+p.sq_off.ring_mask);
+  r->sq_array=(unsigned*)((char*)r->sq_ring+p.sq_off.array);
+  r->sq_local_tail=*r->sq_tail;
+  r->cq_head=(unsigned*)((char*)r->cq_ring+p.cq_off.head);
+  r->cq_tail=(unsigned*)((char*)r->cq_ring+p.cq_off.tail);
+  r->cq_mask=(unsigned*)((char*)r->cq_ring+p.cq_off.ring_mask);
+  r->cqes=(struct io_uring_cqe*)((char*)r->cq_ring+p.cq_off.cqes);
+
+#ifdef NXE_URING_SOCKET_IO
+  uring_setup_buffers(r, &p);
+#endif
+
+  loop->uring=r;
+  return 0;
+
+ERR:
+  nxweb_log_error("io_uring mmap() failed %d", errno);
+  uring_unmap(r);
+  close(fd);
+  nx_free(r);
+  return -1;
+}
+
+void _nxe_uring_destroy(nxe_loop* loop) {
+  nxe_uring* r=loop->uring;
+  if (!r) return;
+  uring_unmap(r);
+  close(r->ring_fd);
+#ifdef NXE_URING_SOCKET_IO
+  int i;
+  for (i=0; i<r->max_slots; i++) {
+    nxe_uring_slot* slot=&r->slots[i];
+    if (!slot->accept_fds.fds) continue;
+    while (slot->accept_head<slot->accept_fds.count) _nxweb_close_bad_socket(slot->accept_fds.fds[slot->accept_head++]);
+    nx_free(slot->accept_fds.fds);
+  }
+  if (r->buf_ring) {
+    for (i=0; i<r->drain_fds.count; i++) { // loop is going away; don't wait any more
+      int fd=r->drain_fds.fds[i];
+      if (r->slots[fd].close_pending) _nxweb_close_bad_socket(fd);
+    }
+    for (i=0; i<r->max_slots; i++) {
+      if (r->slots[i].send_buf) nx_free(r->slots[i].send_buf);
+    }
+    while (r->free_send_bufs) {
+      char* buf=r->free_send_bufs;
+      r->free_send_bufs=*(char**)buf;
+      nx_free(buf);
+    }
+    if (r->send_fds.fds) nx_free(r->send_fds.fds);
+    if (r->drain_fds.fds) nx_free(r->drain_fds.fds);
+    munmap(r->buf_ring, NXE_URING_RECV_BUFFERS*sizeof(struct io_uring_buf));
+    nx_free(r->bufs);
+    nx_free(r->buf_len);
+    nx_free(r->buf_next);
+  }
+#endif
+  if (r->slots) nx_free(r->slots);
+  nx_free(r);
+  loop->uring=0;
+}
+
+static int uring_submit(nxe_uring* r, unsigned min_complete, unsigned flags, void* arg, size_t argsz) {
+  __atomic_store_n(r->sq_tail, r->sq_local_tail, __ATOMIC_RELEASE);
+  int ret=uring_enter(r->ring_fd, r->to_submit, min_complete, flags, arg, argsz);
+  if (ret>=0) r->to_submit-=(unsigned)ret;
+  return ret;
+}
+
+static struct io_uring_sqe* uring_get_sqe(nxe_uring* r) {
+  if (r->sq_local_tail-__atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE)>=r->sq_entries) {
+    // SQ ring is full; flush it now
+    if (uring_submit(r, 0, 0, 0, 0)<0 || r->sq_local_tail-__atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE)>=r->sq_entries) {
+      nxweb_log_error("io_uring SQ ring overflow %d", errno);
+      return 0;
+    }
+  }
+  unsigned idx=r->sq_local_tail & *r->sq_mask;
+  struct io_uring_sqe* sqe=&r->sqes[idx];
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+  r->sq_array[idx]=idx;
+  r->sq_local_tail++;
+  r->to_submit++;
+  return sqe;
+}
+
+static int uring_poll_add(nxe_uring* r, int fd, nxe_uring_slot* slot) {
+  struct io_uring_sqe* sqe=uring_get_sqe(r);
+  if (!sqe) return -1;
+  sqe->opcode=IORING_OP_POLL_ADD;
+  sqe->fd=fd;
+  sqe->poll32_events=slot->events & ~EPOLLET; // multishot poll is edge-triggered by default
+  sqe->len=IORING_POLL_ADD_MULTI;
+  sqe->user_data=uring_user_data(slot->gen, NXE_URING_OP_POLL, fd);
+  return 0;
+}
+
+static int uring_poll_remove(nxe_uring* r, uint64_t user_data) {
+  struct io_uring_sqe* sqe=uring_get_sqe(r);
+  if (!sqe) return -1;
+  sqe->opcode=IORING_OP_POLL_REMOVE;
+  sqe->fd=-1;
+  sqe->addr=user_data;
+  sqe->user_data=0; // ignore its completion
+  return 0;
+}
+
+#ifdef NXE_URING_SOCKET_IO
+static int uring_recv_arm(nxe_uring* r, int fd, nxe_uring_slot* slot) {
+  struct io_uring_sqe* sqe=uring_get_sqe(r);
+  if (!sqe) return -1;
+  sqe->opcode=IORING_OP_RECV;
+  sqe->fd=fd;
+  sqe->ioprio=IORING_RECV_MULTISHOT;
+  sqe->flags=IOSQE_BUFFER_SELECT;
+  sqe->buf_group=NXE_URING_BUFFER_GROUP;
+  sqe->user_data=uring_user_data(slot->gen, NXE_URING_OP_RECV, fd);
+  slot->recv_armed=1;
+  return 0;
+}
+
+static int uring_accept_arm(nxe_uring* r, int fd, nxe_uring_slot* slot) {
+  struct io_uring_sqe* sqe=uring_get_sqe(r);
+  if (!sqe) return -1;
+  sqe->opcode=IORING_OP_ACCEPT;
+  sqe->fd=fd;
+  sqe->ioprio=IORING_ACCEPT_MULTISHOT; // address is not reported; see _nxe_uring_accept()
+  sqe->accept_flags=SOCK_NONBLOCK;
+  sqe->user_data=uring_user_data(slot->gen, NXE_URING_OP_ACCEPT, fd);
+  slot->accept_armed=1;
+  return 0;
+}
+
+#endif
+
+static int uring_add(nxe_loop* loop, int fd, uint32_t events, void* ptr, _Bool socket_io, _Bool listener) {
+  nxe_uring* r=loop->uring;
+  if (fd>=r->max_slots) {
+    int n=r->max_slots? r->max_slots : 1024;
+    while (n<=fd) n<<=1;
+    nxe_uring_slot* slots=nx_calloc(n*sizeof(nxe_uring_slot));
+    if (r->slots) {
+      memcpy(slots, r->slots, r->max_slots*sizeof(nxe_uring_slot));
+      nx_free(r->slots);
+    }
+    r->slots=slots;
+    r->max_slots=n;
+  }
+  nxe_uring_slot* slot=&r->slots[fd];
+  if (slot->ptr) {
+    errno=EEXIST;
+    return -1;
+  }
+  // socket registered again while its previous registration is still flushing send buffer;
+  // keep unsent data (it goes first), replace poll request
+  if (slot->poll_armed) uring_poll_remove(r, uring_user_data(slot->gen, NXE_URING_OP_POLL, fd));
+  slot->poll_armed=0;
+  slot->gen++;
+  if (!slot->gen) slot->gen++; // user_data must never be zero
+  slot->ptr=ptr;
+  slot->events=events;
+#ifdef NXE_URING_SOCKET_IO
+  if (socket_io) {
+    slot->socket_io=1;
+    slot->events&=~EPOLLIN; // multishot recv reports incoming data
+  }
+  if (listener) {
+    slot->listener=1;
+    if (uring_accept_arm(r, fd, slot)) {
+      slot->ptr=0;
+      slot->listener=0;
+      errno=EAGAIN;
+      return -1;
+    }
+    return 0;
+  }
+#endif
+  if (uring_poll_add(r, fd, slot)) {
+    slot->ptr=0;
+    errno=EAGAIN;
+    return -1;
+  }
+  slot->poll_armed=1;
+#ifdef NXE_URING_SOCKET_IO
+  if (socket_io && uring_recv_arm(r, fd, slot)) slot->recv_error=EIO;
+#endif
+  return 0;
+}
+
+int _nxe_uring_add(nxe_loop* loop, int fd, uint32_t events, void* ptr) {
+  return uring_add(loop, fd, events, ptr, 0, 0);
+}
+
+#ifdef NXE_URING_SOCKET_IO
+
+static int uring_cancel(nxe_uring* r, uint64_t user_data) {
+  struct io_uring_sqe* sqe=uring_get_sqe(r);
+  if (!sqe) return -1;
+  sqe->opcode=IORING_OP_ASYNC_CANCEL;
+  sqe->fd=-1;
+  sqe->addr=user_data;
+  sqe->user_data=0; // ignore its completion
+  return 0;
+}
+
+static void uring_recv_consume(nxe_uring* r, nxe_uring_slot* slot, unsigned size) {
+  unsigned bid=slot->recv_head-1;
+  slot->recv_offs+=size;
+  slot->recv_bytes-=size;
+  if (slot->recv_offs>=r->buf_len[bid]) {
+    slot->recv_head=r->buf_next[bid];
+    if (!slot->recv_head) slot->recv_tail=0;
+    slot->recv_offs=0;
+    uring_recycle_buffer(r, bid);
+  }
+}
+
+static void uring_recv_drop(nxe_uring* r, nxe_uring_slot* slot) {
+  while (slot->recv_head) {
+    unsigned bid=slot->recv_head-1;
+    slot->recv_head=r->buf_next[bid];
+    uring_recycle_buffer(r, bid);
+  }
+  slot->recv_tail=0;
+  slot->recv_offs=0;
+  slot->recv_bytes=0;
+}
+
+static void uring_send_buf_free(nxe_uring* r, nxe_uring_slot* slot) {
+  if (!slot->send_buf) return;
+  if (r->num_free_send_bufs<NXE_URING_MAX_FREE_SEND_BUFFERS) {
+    *(char**)slot->send_buf=r->free_send_bufs;
+    r->free_send_bufs=slot->send_buf;
+    r->num_free_send_bufs++;
+  }
+  else {
+    nx_free(slot->send_buf);
+  }
+  slot->send_buf=0;
+  slot->send_offs=0;
+  slot->send_size=0;
+}
+
+static inline _Bool uring_send_pending(nxe_uring_slot* slot) {
+  return slot->send_inflight || (slot->send_size>slot->send_offs && !slot->send_error);
+}
+
+static inline void uring_send_queue(nxe_uring* r, int fd, nxe_uring_slot* slot) {
+  if (slot->send_queued) return;
+  slot->send_queued=1;
+  uring_fd_list_add(&r->send_fds, fd);
+}
+
+// unregistered socket has nothing more to send (or sending has failed)
+static void uring_socket_release(nxe_uring* r, int fd, nxe_uring_slot* slot) {
+  if (slot->send_inflight) return; // its completion calls here again
+  if (slot->poll_armed) uring_poll_remove(r, uring_user_data(slot->gen, NXE_URING_OP_POLL, fd));
+  uring_send_buf_free(r, slot);
+  uring_recv_drop(r, slot);
+  if (slot->close_pending) {
+    if (slot->close_good && !slot->send_error) _nxweb_close_good_socket(fd);
+    else _nxweb_close_bad_socket(fd);
+  }
+  uint32_t gen=slot->gen;
+  memset(slot, 0, sizeof(nxe_uring_slot));
+  slot->gen=gen;
+}
+
+static void uring_flush_sends(nxe_loop* loop, nxe_uring* r) {
+  int i, j;
+  for (i=0; i<r->send_fds.count; i++) {
+    int fd=r->send_fds.fds[i];
+    nxe_uring_slot* slot=&r->slots[fd];
+    if (!slot->send_queued) continue;
+    slot->send_queued=0;
+    if (slot->send_inflight || slot->send_offs>=slot->send_size || slot->send_error) continue;
+    struct io_uring_sqe* sqe=uring_get_sqe(r);
+    if (!sqe) {
+      slot->send_error=EIO;
+      continue;
+    }
+    sqe->opcode=IORING_OP_SEND;
+    sqe->fd=fd;
+    sqe->addr=(uint64_t)(uintptr_t)(slot->send_buf+slot->send_offs);
+    sqe->len=slot->send_size-slot->send_offs;
+    sqe->msg_flags=MSG_DONTWAIT; // fail with EAGAIN instead of waiting; POLLOUT tells when to retry
+    sqe->user_data=uring_user_data(0, NXE_URING_OP_SEND, fd);
+    slot->send_inflight=sqe->len;
+  }
+  r->send_fds.count=0;
+  for (i=0, j=0; i<r->drain_fds.count; i++) {
+    int fd=r->drain_fds.fds[i];
+    nxe_uring_slot* slot=&r->slots[fd];
+    if (!slot->close_pending) continue; // released already
+    if (loop->current_time>=slot->drain_deadline) {
+      // peer does not read; give up
+      slot->close_good=0;
+      slot->send_offs=slot->send_size=0;
+      uring_socket_release(r, fd, slot);
+      if (slot->close_pending) r->drain_fds.fds[j++]=fd; // SEND in flight; release on its completion
+    }
+    else {
+      r->drain_fds.fds[j++]=fd;
+    }
+  }
+  r->drain_fds.count=j;
+}
+
+// SEND completion; returns epoll events to emit
+static uint32_t uring_send_complete(nxe_uring* r, int fd, nxe_uring_slot* slot, int res) {
+  _Bool partial=res<(int)slot->send_inflight;
+  slot->send_inflight=0;
+  if (res>0) {
+    slot->send_offs+=res;
+    if (slot->send_offs>=slot->send_size) slot->send_offs=slot->send_size=0;
+  }
+  else if (res!=-EAGAIN) {
+    slot->send_error=-res;
+  }
+  if (!slot->ptr) { // unregistered; just flushing
+    if (slot->send_error || slot->send_offs>=slot->send_size) uring_socket_release(r, fd, slot);
+    else if (!partial) uring_send_queue(r, fd, slot);
+    return 0;
+  }
+  if (slot->send_offs>=slot->send_size && slot->shut_wr_pending) {
+    slot->shut_wr_pending=0;
+    shutdown(fd, SHUT_WR);
+  }
+  // partial send means socket buffer is full; poll reports when it is not
+  if (!partial && slot->send_offs<slot->send_size) uring_send_queue(r, fd, slot);
+  if (slot->send_blocked && (slot->send_error || res>0)) {
+    slot->send_blocked=0;
+    return slot->send_error? EPOLLERR : EPOLLOUT;
+  }
+  return 0;
+}
+
+// RECV completion; returns epoll events to emit
+static uint32_t uring_recv_complete(nxe_uring* r, int fd, nxe_uring_slot* slot, struct io_uring_cqe* cqe) {
+  int res=cqe->res;
+  if (cqe->flags & IORING_CQE_F_BUFFER) {
+    unsigned bid=cqe->flags>>IORING_CQE_BUFFER_SHIFT;
+    if (res>0) {
+      r->buf_len[bid]=(uint32_t)res;
+      r->buf_next[bid]=0;
+      if (slot->recv_tail) r->buf_next[slot->recv_tail-1]=bid+1;
+      else slot->recv_head=bid+1;
+      slot->recv_tail=bid+1;
+      slot->recv_bytes+=res;
+    }
+    else {
+      uring_recycle_buffer(r, bid);
+    }
+  }
+  if (!(cqe->flags & IORING_CQE_F_MORE)) {
+    slot->recv_armed=0;
+    slot->recv_cancelling=0;
+    if (res==0) slot->recv_eof=1;
+    else if (res<0 && res!=-ENOBUFS && res!=-ECANCELED) slot->recv_error=-res;
+    // otherwise reader goes on with plain recv() and rearms when socket is drained
+  }
+  else if (slot->recv_bytes>=NXE_URING_MAX_RECV_PENDING && !slot->recv_cancelling) {
+    // reader is slow; stop taking buffers from other sockets
+    if (!uring_cancel(r, uring_user_data(slot->gen, NXE_URING_OP_RECV, fd))) slot->recv_cancelling=1;
+  }
+  return EPOLLIN;
+}
+
+int _nxe_uring_add_socket(nxe_loop* loop, int fd, uint32_t events, void* ptr) {
+  if (!loop->uring->buf_ring) {
+    errno=ENOTSUP;
+    return -1;
+  }
+  return uring_add(loop, fd, events, ptr, 1, 0);
+}
+
+nxe_ssize_t _nxe_uring_recv(nxe_loop* loop, int fd, void* ptr, nxe_size_t size) {
+  nxe_uring* r=loop->uring;
+  nxe_uring_slot* slot=&r->slots[fd];
+  nxe_size_t n=0;
+  while (slot->recv_head && n<size) {
+    unsigned bid=slot->recv_head-1;
+    unsigned avail=r->buf_len[bid]-slot->recv_offs;
+    unsigned len=size-n<avail? (unsigned)(size-n) : avail;
+    memcpy((char*)ptr+n, r->bufs+(size_t)bid*NXE_URING_RECV_BUFFER_SIZE+slot->recv_offs, len);
+    n+=len;
+    uring_recv_consume(r, slot, len);
+  }
+  if (n==size || slot->recv_armed) {
+    if (n) return n;
+    errno=EAGAIN;
+    return -1;
+  }
+  if (slot->recv_error) {
+    if (n) return n;
+    errno=slot->recv_error;
+    return -1;
+  }
+  if (slot->recv_eof) return n;
+  // multishot recv is not armed; socket might have more data
+  nxe_ssize_t bytes_received=read(fd, (char*)ptr+n, size-n);
+  if (bytes_received<0) {
+    if (errno==EAGAIN && uring_recv_arm(r, fd, slot)) slot->recv_error=EIO;
+    if (n) return n;
+    return -1;
+  }
+  if (bytes_received==0) slot->recv_eof=1;
+  return n+bytes_received;
+}
+
+nxe_ssize_t _nxe_uring_recv_splice(nxe_loop* loop, int fd, int pipe_fd, nxe_size_t size) {
+  nxe_uring* r=loop->uring;
+  nxe_uring_slot* slot=&r->slots[fd];
+  if (slot->recv_head) { // pass over what has been received already
+    struct iovec iov[NXE_URING_SPLICE_IOV];
+    int cnt=0;
+    nxe_size_t n=0;
+    unsigned bid, offs=slot->recv_offs;
+    for (bid=slot->recv_head; bid && cnt<NXE_URING_SPLICE_IOV && n<size; bid=r->buf_next[bid-1], offs=0) {
+      unsigned avail=r->buf_len[bid-1]-offs;
+      if (avail>size-n) avail=(unsigned)(size-n);
+      iov[cnt].iov_base=r->bufs+(size_t)(bid-1)*NXE_URING_RECV_BUFFER_SIZE+offs;
+      iov[cnt++].iov_len=avail;
+      n+=avail;
+    }
+    nxe_ssize_t bytes_written=writev(pipe_fd, iov, cnt);
+    for (n=bytes_written>0? bytes_written : 0; n>0;) {
+      unsigned avail=r->buf_len[slot->recv_head-1]-slot->recv_offs;
+      unsigned len=n<avail? (unsigned)n : avail;
+      uring_recv_consume(r, slot, len);
+      n-=len;
+    }
+    return bytes_written;
+  }
+  if (slot->recv_armed) {
+    errno=EAGAIN;
+    return -1;
+  }
+  if (slot->recv_error) {
+    errno=slot->recv_error;
+    return -1;
+  }
+  if (slot->recv_eof) return 0;
+  nxe_ssize_t bytes_received=splice(fd, 0, pipe_fd, 0, size, SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+  if (bytes_received<0 && errno==EAGAIN) {
+    // pipe might be full as well; rearming is harmless then
+    if (uring_recv_arm(r, fd, slot)) slot->recv_error=EIO;
+    errno=EAGAIN;
+  }
+  if (bytes_received==0) slot->recv_eof=1;
+  return bytes_received;
+}
+
+nxe_ssize_t _nxe_uring_send(nxe_loop* loop, int fd, const void* ptr, nxe_size_t size) {
+  nxe_uring* r=loop->uring;
+  nxe_uring_slot* slot=&r->slots[fd];
+  if (slot->send_error) {
+    errno=slot->send_error;
+    return -1;
+  }
+  if (!slot->send_buf) {
+    if (r->free_send_bufs) {
+      slot->send_buf=r->free_send_bufs;
+      r->free_send_bufs=*(char**)slot->send_buf;
+      r->num_free_send_bufs--;
+    }
+    else {
+      slot->send_buf=nx_alloc(NXE_URING_SEND_BUFFER_SIZE);
+    }
+  }
+  else if (slot->send_size==NXE_URING_SEND_BUFFER_SIZE && slot->send_offs && !slot->send_inflight) {
+    memmove(slot->send_buf, slot->send_buf+slot->send_offs, slot->send_size-slot->send_offs);
+    slot->send_size-=slot->send_offs;
+    slot->send_offs=0;
+  }
+  nxe_size_t room=NXE_URING_SEND_BUFFER_SIZE-slot->send_size;
+  if (!room) {
+    slot->send_blocked=1;
+    errno=EAGAIN;
+    return -1;
+  }
+  if (size>room) {
+    size=room;
+    slot->send_blocked=1;
+  }
+  memcpy(slot->send_buf+slot->send_size, ptr, size);
+  slot->send_size+=size;
+  uring_send_queue(r, fd, slot);
+  return size;
+}
+
+int _nxe_uring_send_flush(nxe_loop* loop, int fd, int more) {
+  nxe_uring* r=loop->uring;
+  nxe_uring_slot* slot=&r->slots[fd];
+  if (slot->send_error) {
+    errno=slot->send_error;
+    return -1;
+  }
+  if (slot->send_inflight) {
+    slot->send_blocked=1;
+    errno=EAGAIN;
+    return -1;
+  }
+  while (slot->send_offs<slot->send_size) {
+    nxe_ssize_t bytes_sent=send(fd, slot->send_buf+slot->send_offs, slot->send_size-slot->send_offs, more? MSG_MORE : 0);
+    if (bytes_sent<0) {
+      if (errno==EAGAIN) slot->send_blocked=1;
+      else slot->send_error=errno;
+      return -1;
+    }
+    slot->send_offs+=bytes_sent;
+  }
+  slot->send_offs=slot->send_size=0;
+  return 0;
+}
+
+void _nxe_uring_shutdown(nxe_loop* loop, int fd) {
+  nxe_uring_slot* slot=&loop->uring->slots[fd];
+  if (uring_send_pending(slot)) slot->shut_wr_pending=1;
+  else shutdown(fd, SHUT_WR);
+}
+
+void _nxe_uring_close_socket(nxe_loop* loop, int fd, int good) {
+  nxe_uring* r=loop->uring;
+  nxe_uring_slot* slot=fd<r->max_slots? &r->slots[fd] : 0;
+  if (!slot || !slot->socket_io || slot->ptr) { // nothing left behind
+    if (good) _nxweb_close_good_socket(fd);
+    else _nxweb_close_bad_socket(fd);
+    return;
+  }
+  slot->close_pending=1;
+  slot->close_good=good;
+  if (!good) slot->send_offs=slot->send_size=0; // drop unsent data
+  if (uring_send_pending(slot)) {
+    slot->drain_deadline=loop->current_time+NXE_URING_DRAIN_TIMEOUT;
+    uring_fd_list_add(&r->drain_fds, fd);
+    return;
+  }
+  uring_socket_release(r, fd, slot);
+}
+
+// closes accepted connections nobody is going to take
+static void uring_accept_drop(nxe_uring_slot* slot) {
+  while (slot->accept_head<slot->accept_fds.count) _nxweb_close_bad_socket(slot->accept_fds.fds[slot->accept_head++]);
+  if (slot->accept_fds.fds) nx_free(slot->accept_fds.fds);
+  memset(&slot->accept_fds, 0, sizeof(slot->accept_fds));
+  slot->accept_head=0;
+}
+
+// ACCEPT completion; returns epoll events to emit
+static uint32_t uring_accept_complete(nxe_uring* r, int fd, nxe_uring_slot* slot, uint64_t user_data, struct io_uring_cqe* cqe) {
+  int res=cqe->res;
+  if (!slot->ptr || slot->gen!=(uint32_t)(user_data>>32)) { // stale
+    if (res>=0) _nxweb_close_bad_socket(res);
+    return 0;
+  }
+  if (res>=0) uring_fd_list_add(&slot->accept_fds, res);
+  int pending=slot->accept_fds.count-slot->accept_head;
+  if (!(cqe->flags & IORING_CQE_F_MORE)) {
+    slot->accept_armed=0;
+    slot->accept_cancelling=0;
+    if (res==-EINVAL) {
+      // multishot accept is not supported by kernel (5.19+); poll instead
+      if (!r->no_multishot_accept) nxweb_log_warning("io_uring multishot accept not available; listening sockets use poll");
+      r->no_multishot_accept=1;
+      slot->events=EPOLLIN|EPOLLRDHUP|EPOLLHUP;
+      if (!uring_poll_add(r, fd, slot)) slot->poll_armed=1;
+    }
+    // otherwise caller goes on with plain accept4() (which reports the error if any) and rearms once listen queue is drained
+  }
+  else if (pending>=NXE_URING_MAX_ACCEPT_PENDING && !slot->accept_cancelling) {
+    // caller does not take them (eg. accept paused); leave the rest in listen queue
+    if (!uring_cancel(r, uring_user_data(slot->gen, NXE_URING_OP_ACCEPT, fd))) slot->accept_cancelling=1;
+  }
+  // notify once queue becomes non-empty, or when there is nothing queued and multishot accept is over
+  if (res>=0? pending>1 : pending>0) return 0;
+  return EPOLLIN;
+}
+
+int _nxe_uring_add_listener(nxe_loop* loop, int fd, uint32_t events, void* ptr) {
+  if (loop->uring->no_multishot_accept) {
+    errno=ENOTSUP;
+    return -1;
+  }
+  return uring_add(loop, fd, events, ptr, 0, 1);
+}
+
+int _nxe_uring_accept(nxe_loop* loop, int fd, struct sockaddr* addr, socklen_t* addrlen) {
+  nxe_uring* r=loop->uring;
+  nxe_uring_slot* slot=&r->slots[fd];
+  while (slot->accept_head<slot->accept_fds.count) {
+    int client_fd=slot->accept_fds.fds[slot->accept_head++];
+    if (slot->accept_head==slot->accept_fds.count) slot->accept_head=slot->accept_fds.count=0;
+    // multishot accept has single address buffer for all connections, so address is not requested
+    if (!addr || !getpeername(client_fd, addr, addrlen)) return client_fd;
+    _nxweb_close_bad_socket(client_fd); // connection is gone already
+  }
+  if (slot->accept_armed) {
+    errno=EAGAIN;
+    return -1;
+  }
+  // multishot accept is not armed; take connections right from listen queue
+  int client_fd=accept4(fd, addr, addrlen, SOCK_NONBLOCK);
+  if (client_fd==-1 && errno==EAGAIN && !slot->poll_armed) {
+    if (uring_accept_arm(r, fd, slot)) nxweb_log_error("can't arm io_uring accept on fd %d", fd);
+    errno=EAGAIN;
+  }
+  return client_fd;
+}
+
+#endif // NXE_URING_SOCKET_IO
+
+int _nxe_uring_del(nxe_loop* loop, int fd) {
+  nxe_uring* r=loop->uring;
+  if (fd<0 || fd>=r->max_slots || !r->slots[fd].ptr) {
+    errno=ENOENT;
+    return -1;
+  }
+  nxe_uring_slot* slot=&r->slots[fd];
+  slot->ptr=0; // from now on completions for this slot generation get dropped
+#ifdef NXE_URING_SOCKET_IO
+  if (slot->listener) {
+    if (slot->accept_armed) {
+      // cancel right away, so no more connections get accepted on behalf of this loop
+      uring_cancel(r, uring_user_data(slot->gen, NXE_URING_OP_ACCEPT, fd));
+      slot->accept_armed=0;
+      slot->accept_cancelling=0;
+      uring_submit(r, 0, 0, 0, 0);
+    }
+    uring_accept_drop(slot);
+    slot->listener=0;
+    if (!slot->poll_armed) return 0;
+  }
+  if (slot->socket_io) {
+    if (slot->recv_armed) {
+      // cancel right away: fd might get handed over to another loop (parked proxy connection)
+      uring_cancel(r, uring_user_data(slot->gen, NXE_URING_OP_RECV, fd));
+      slot->recv_armed=0;
+      uring_submit(r, 0, 0, 0, 0);
+    }
+    if (slot->recv_head) {
+      // unread data is lost; make sure nobody trusts this connection after us
+      uring_recv_drop(r, slot);
+      shutdown(fd, SHUT_RD);
+    }
+    if (uring_send_pending(slot)) return 0; // keep poll armed until data is sent
+    uring_socket_release(r, fd, slot);
+    return 0;
+  }
+#endif
+  slot->poll_armed=0;
+  return uring_poll_remove(r, uring_user_data(slot->gen, NXE_URING_OP_POLL, fd));
+}
+
+int _nxe_uring_wait(nxe_loop* loop, int timeout_ms) {
+  nxe_uring* r=loop->uring;
+#ifdef NXE_URING_SOCKET_IO
+  if (r->send_fds.count || r->drain_fds.count) uring_flush_sends(loop, r);
+#endif
+  unsigned head=*r->cq_head;
+  if (head==__atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE) || r->to_submit) {
+    struct __kernel_timespec ts={.tv_sec=timeout_ms/1000, .tv_nsec=(timeout_ms%1000)*1000000L};
+    struct io_uring_getevents_arg arg={.ts=(uint64_t)(uintptr_t)&ts};
+    unsigned min_complete=(timeout_ms>0 && head==__atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))? 1 : 0;
+    for (;;) {
+      int ret=uring_submit(r, min_complete, IORING_ENTER_GETEVENTS|IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+      if (ret>=0 || errno==ETIME || errno==EBUSY) break;
+      // interrupted by signal before anything got submitted; wait again
+      if (errno!=EINTR) return -1;
+    }
+  }
+
+  int n=0;
+  struct epoll_event* ev=loop->epoll_events;
+  unsigned tail=__atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+  while (head!=tail && n<loop->max_epoll_events) {
+    struct io_uring_cqe* cqe=&r->cqes[head & *r->cq_mask];
+    head++;
+    uint64_t user_data=cqe->user_data;
+    if (!user_data) continue;
+    int fd=(int)(user_data & NXE_URING_FD_MASK);
+    int op=(int)((user_data>>30) & 3);
+    if (fd>=r->max_slots) continue;
+    nxe_uring_slot* slot=&r->slots[fd];
+    uint32_t events=0;
+#ifdef NXE_URING_SOCKET_IO
+    if (op==NXE_URING_OP_SEND) {
+      events=uring_send_complete(r, fd, slot, cqe->res);
+      if (events) {
+        ev->events=events;
+        ev->data.ptr=slot->ptr;
+        ev++; n++;
+      }
+      continue;
+    }
+    if (op==NXE_URING_OP_RECV) {
+      if (!slot->ptr || slot->gen!=(uint32_t)(user_data>>32)) { // stale; just give buffer back
+        if (cqe->flags & IORING_CQE_F_BUFFER) uring_recycle_buffer(r, cqe->flags>>IORING_CQE_BUFFER_SHIFT);
+        continue;
+      }
+      ev->events=uring_recv_complete(r, fd, slot, cqe);
+      ev->data.ptr=slot->ptr;
+      ev++; n++;
+      continue;
+    }
+    if (op==NXE_URING_OP_ACCEPT) {
+      events=uring_accept_complete(r, fd, slot, user_data, cqe);
+      if (events) {
+        ev->events=events;
+        ev->data.ptr=slot->ptr;
+        ev++; n++;
+      }
+      continue;
+    }
+#endif
+    if (!slot->poll_armed || slot->gen!=(uint32_t)(user_data>>32)) { // stale
+      // POLL_REMOVE fails with EALREADY if poll was just being triggered; request is still armed
+      // and holds reference to (already closed) file, so the socket never gets released; remove again
+      if (cqe->flags & IORING_CQE_F_MORE) uring_poll_remove(r, user_data);
+      continue;
+    }
+    if (cqe->res<0) {
+      // poll request has failed and is not active any more
+      nxweb_log_error("io_uring poll error %d on fd %d", -cqe->res, fd);
+      slot->poll_armed=0;
+#ifdef NXE_URING_SOCKET_IO
+      if (!slot->ptr) { // unregistered socket waiting to flush its data
+        slot->send_error=-cqe->res;
+        uring_socket_release(r, fd, slot);
+        continue;
+      }
+#endif
+      ev->events=EPOLLERR;
+      ev->data.ptr=slot->ptr;
+      ev++; n++;
+      continue;
+    }
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+      // multishot poll terminated by kernel (eg. CQ overflow); rearm
+      uring_poll_add(r, fd, slot);
+    }
+    events=(uint32_t)cqe->res;
+#ifdef NXE_URING_SOCKET_IO
+    if (slot->socket_io && (events & (EPOLLOUT|EPOLLERR|EPOLLHUP)) && !slot->send_inflight && slot->send_offs<slot->send_size) {
+      uring_send_queue(r, fd, slot); // resume flushing
+    }
+#endif
+    if (events && slot->ptr) {
+      ev->events=events;
+      ev->data.ptr=slot->ptr;
+      ev++; n++;
+    }
+  }
+  __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+  return n;
+}
+
+#else // !WITH_IO_URING
+
+int _nxe_uring_create(nxe_loop* loop) {
+  nxweb_log_error("nxweb compiled without io_uring support");
+  return -1;
+}
+
+void _nxe_uring_destroy(nxe_loop* loop) {
+}
+
+int _nxe_uring_add(nxe_loop* loop, int fd, uint32_t events, void* ptr) {
+  errno=ENOSYS;
+  return -1;
+}
+
+int _nxe_uring_del(nxe_loop* loop, int fd) {
+  errno=ENOSYS;
+  return -1;
+}
+
+int _nxe_uring_wait(nxe_loop* loop, int timeout_ms) {
+  errno=ENOSYS;
+  return -1;
+}
+
+#endif // WITH_IO_URING
+
+#ifndef NXE_URING_SOCKET_IO
+
+int _nxe_uring_add_socket(nxe_loop* loop, int fd, uint32_t events, void* ptr) {
+  errno=ENOTSUP;
+  return -1;
+}
+
+int _nxe_uring_add_listener(nxe_loop* loop, int fd, uint32_t events, void* ptr) {
+  errno=ENOTSUP;
+  return -1;
+}
+
+// never called as no socket gets registered for socket I/O
+
+nxe_ssize_t _nxe_uring_recv(nxe_loop* loop, int fd, void* ptr, nxe_size_t size) {
+  errno=ENOTSUP;
+  return -1;
+}
+
+nxe_ssize_t _nxe_uring_recv_splice(nxe_loop* loop, int fd, int pipe_fd, nxe_size_t size) {
+  errno=ENOTSUP;
+  return -1;
+}
+
+nxe_ssize_t _nxe_uring_send(nxe_loop* loop, int fd, const void* ptr, nxe_size_t size) {
+  errno=ENOTSUP;
+  return -1;
+}
+
+int _nxe_uring_send_flush(nxe_loop* loop, int fd, int more) {
+  return 0;
+}
+
+int _nxe_uring_accept(nxe_loop* loop, int fd, struct sockaddr* addr, socklen_t* addrlen) {
+  errno=ENOTSUP;
+  return -1;
+}
+
+void _nxe_uring_shutdown(nxe_loop* loop, int fd) {
+  shutdown(fd, SHUT_WR);
+}
+
+void _nxe_uring_close_socket(nxe_loop* loop, int fd, int good) {
+  if (good) _nxweb_close_good_socket(fd);
+  else _nxweb_close_bad_socket(fd);
+}
+
+#endif // !NXE_URING_SOCKET_IO
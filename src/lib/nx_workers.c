@@ -18,6 +18,7 @@
  */
 
 #include <assert.h>
+#include <stdlib.h>
 #include <pthread.h>
 #include <errno.h>
 #include <unistd.h>
@@ -30,163 +31,320 @@
 
 __thread nxw_worker* _nxweb_worker_thread_data;
 
+// all factories of the process; workers of idle factories steal jobs from busy ones
+static nxw_factory* volatile _nxw_factories[NXWEB_MAX_WORKER_FACTORIES];
+static volatile int _nxw_num_factories;
+
 static void* nxw_worker_main(void* ptr);
-static nxw_worker* nxw_create_worker(nxw_factory* f);
-static void nxw_destroy_worker(nxw_worker* w);
+static void nxw_dispatch_queued(nxw_factory* f, nxw_job_class* jc);
+static void nxw_release_factory(nxe_data data);
 
-static inline void link_worker(nxw_worker* w) {
-  w->next=w->factory->list;
-  if (w->factory->list) w->factory->list->prev=w;
-  w->factory->list=w;
-  w->prev=0;
+static void nxw_complete_on_message(nxe_subscriber* sub, nxe_publisher* pub, nxe_data data) {
+  nxw_factory* f=OBJ_PTR_FROM_FLD_PTR(nxw_factory, complete_sub, sub);
+  // grab whole stack at once; producers pushing after this point will trigger eventfd again
+  nxw_job* job=__sync_lock_test_and_set(&f->complete_head, 0);
+  __sync_synchronize(); // full memory barrier
+  // reverse to get completion order
+  nxw_job* list=0;
+  nxw_job* next;
+  while (job) {
+    next=job->next;
+    job->next=list;
+    list=job;
+    job=next;
+  }
+  nxw_job_class* jc;
+  while (list) {
+    next=list->next;
+    list->next=0;
+    jc=&f->classes[list->job_class];
+    jc->running--;
+    f->in_flight--;
+    list->on_complete(list);
+    if (jc->queue_head) nxw_dispatch_queued(f, jc);
+    list=next;
+  }
+  // finalized factory waits for its last job; can't unsubscribe from within own message
+  if (f->shutdown_in_progress && !f->in_flight) nxe_schedule_callback(f->loop, nxw_release_factory, (nxe_data)(void*)f);
 }
 
-static inline void unlink_worker(nxw_worker* w) {
-  if (w->prev) w->prev->next=w->next;
-  else w->factory->list=w->next;
-  if (w->next) w->next->prev=w->prev;
-  w->next=0;
-  w->prev=0;
+static const nxe_subscriber_class nxw_complete_sub_class={.on_message=nxw_complete_on_message};
+
+static inline void nxw_push_complete(nxw_factory* f, nxw_job* job) {
+  nxw_job* head;
+  do {
+    head=f->complete_head;
+    job->next=head;
+  } while (!__sync_bool_compare_and_swap(&f->complete_head, head, job));
+  if (!head) nxe_trigger_eventfd(&f->complete_efs); // first in batch => wake up factory thread
 }
 
-void nxw_init_factory(nxw_factory* f, nxe_loop* loop) {
-  f->loop=loop;
-  nx_queue_workers_init(&f->queue);
-  pthread_mutex_init(&f->queue_mux, 0);
-  int i;
-  for (i=NXWEB_START_WORKERS_IN_QUEUE; i--; ) {
-    nxw_create_worker(f);
+static inline int nxw_queue_push(nxw_job_queue* q, nxw_job* job) { // factory thread only
+  unsigned tail=q->tail;
+  if (tail-q->head>=NXWEB_MAX_QUEUED_JOBS) return -1; // full
+  q->jobs[tail&(NXWEB_MAX_QUEUED_JOBS-1)]=job;
+  __sync_synchronize(); // full memory barrier
+  q->tail=tail+1;
+  return 0;
+}
+
+static inline nxw_job* nxw_queue_pop(nxw_job_queue* q) { // any thread
+  unsigned head;
+  nxw_job* job;
+  do {
+    head=q->head;
+    __sync_synchronize(); // full memory barrier
+    if (head==q->tail) return 0; // empty
+    // slot can't be reused by producer until head moves past it
+    job=q->jobs[head&(NXWEB_MAX_QUEUED_JOBS-1)];
+  } while (!__sync_bool_compare_and_swap(&q->head, head, head+1));
+  return job;
+}
+
+static inline _Bool nxw_queue_is_empty(nxw_job_queue* q) {
+  return q->head==q->tail;
+}
+
+static nxw_job* nxw_steal_job(nxw_factory* f) {
+  int i, n=_nxw_num_factories;
+  nxw_factory* victim;
+  nxw_job* job;
+  for (i=1; i<n; i++) {
+    victim=_nxw_factories[(f->index+i)%n];
+    if (!victim || victim->shutdown_in_progress) continue;
+    if ((job=nxw_queue_pop(&victim->queue))) return job;
+  }
+  return 0;
+}
+
+static _Bool nxw_has_pending_jobs(nxw_factory* f) {
+  if (!nxw_queue_is_empty(&f->queue)) return 1;
+  int i, n=_nxw_num_factories;
+  nxw_factory* victim;
+  for (i=1; i<n; i++) {
+    victim=_nxw_factories[(f->index+i)%n];
+    if (victim && !victim->shutdown_in_progress && !nxw_queue_is_empty(&victim->queue)) return 1;
   }
+  return 0;
 }
 
-void nxw_finalize_factory(nxw_factory* f) {
-  pthread_mutex_lock(&f->queue_mux);
-  f->shutdown_in_progress=1;
-  pthread_mutex_unlock(&f->queue_mux);
+static void nxw_expire_queued(nxw_factory* f, nxw_job_class* jc) {
+  if (!jc->queue_timeout) return;
+  nxe_time_t expire_before=f->loop->current_time-jc->queue_timeout;
+  nxw_job* job;
+  while ((job=jc->queue_head) && job->queued_time<=expire_before) {
+    jc->queue_head=job->next;
+    if (!jc->queue_head) jc->queue_tail=0;
+    jc->queued--;
+    job->next=0;
+    job->expired=1;
+    job->on_complete(job);
+  }
+  if (jc->queue_head) nxe_set_timer_usec(f->loop, &jc->expire_timer, jc->queue_head->queued_time-expire_before);
+  else nxe_unset_timer(f->loop, 0, &jc->expire_timer);
+}
+
+static void nxw_expire_on_timeout(nxe_timer* timer, nxe_data data) {
+  nxw_factory* f=data.ptr;
+  nxw_job_class* jc=OBJ_PTR_FROM_FLD_PTR(nxw_job_class, expire_timer, timer);
+  nxw_expire_queued(f, jc);
+}
+
+static const nxe_timer_class nxw_expire_timer_class={.on_timeout=nxw_expire_on_timeout};
+
+static inline _Bool nxw_wake_idle_worker(nxw_factory* f) {
+  if (!f->idle_count) return 0;
+  pthread_mutex_lock(&f->idle_mux);
+  pthread_cond_signal(&f->idle_cond);
+  pthread_mutex_unlock(&f->idle_mux);
+  return 1;
+}
+
+void nxw_init_factory(nxw_factory* f, nxe_loop* loop, int num_workers) {
+  f->loop=loop;
+  pthread_mutex_init(&f->idle_mux, 0);
+  pthread_cond_init(&f->idle_cond, 0);
+  f->complete_head=0;
+  f->in_flight=0;
+  int i;
+  for (i=0; i<NXWEB_MAX_WORKER_CLASSES; i++) {
+    nxe_init_timer(&f->classes[i].expire_timer, &nxw_expire_timer_class);
+    f->classes[i].expire_timer.data.ptr=f;
+  }
+  nxe_init_eventfd_source(&f->complete_efs, NXE_PUB_DEFAULT);
+  nxe_register_eventfd_source(loop, &f->complete_efs);
+  f->complete_sub.super.cls.sub_cls=&nxw_complete_sub_class;
+  nxe_subscribe(loop, &f->complete_efs.data_notify, &f->complete_sub);
 
-  nxweb_log_error("shutting down %d workers", f->worker_count);
+  f->index=__sync_fetch_and_add(&_nxw_num_factories, 1);
+  assert(f->index<NXWEB_MAX_WORKER_FACTORIES);
+  _nxw_factories[f->index]=f;
 
+  // workers inherit CPU affinity of factory (net) thread
+  if (num_workers<=0) num_workers=NXWEB_WORKERS_PER_FACTORY;
+  else if (num_workers>NXWEB_MAX_WORKERS_PER_FACTORY) num_workers=NXWEB_MAX_WORKERS_PER_FACTORY;
+  f->workers=calloc(num_workers, sizeof(nxw_worker));
   nxw_worker* w;
-  while (!nx_queue_workers_pop(&f->queue, &w)) {
-    //nxweb_log_error("waking up %p", (void*)w->tid);
-    pthread_mutex_lock(&w->start_mux);
-    pthread_cond_signal(&w->start_cond);
-    pthread_mutex_unlock(&w->start_mux);
+  for (i=0; i<num_workers; i++) {
+    w=&f->workers[i];
+    w->factory=f;
+    if (pthread_create(&w->tid, 0, nxw_worker_main, w)) {
+      nxweb_log_error("can't create worker thread");
+      break;
+    }
+    f->worker_count++;
   }
+}
+
+static void nxw_release_factory(nxe_data data) {
+  nxw_factory* f=data.ptr;
+  if (!f->workers) return; // already released
 
-  while ((w=f->list)) {
-    pthread_join(w->tid, 0);
-    nxw_destroy_worker(w);
+  int i;
+  for (i=0; i<f->worker_count; i++) {
+    pthread_join(f->workers[i].tid, 0);
   }
+  f->worker_count=0;
+  free(f->workers);
+  f->workers=0;
+  _nxw_factories[f->index]=0; // nothing to steal here any more
 
-  pthread_mutex_destroy(&f->queue_mux);
+  nxe_unsubscribe(&f->complete_efs.data_notify, &f->complete_sub);
+  nxe_unregister_eventfd_source(&f->complete_efs);
+  nxe_finalize_eventfd_source(&f->complete_efs);
+  pthread_cond_destroy(&f->idle_cond);
+  pthread_mutex_destroy(&f->idle_mux);
 }
 
-void nxw_gc_factory(nxw_factory* f) {
-  nxw_worker* w=f->list;
-  nxw_worker* next;
-  int cnt=0;
-  while (w) {
-    next=w->next;
-    if (w->dead) {
-      pthread_join(w->tid, 0);
-      nxw_destroy_worker(w);
-      cnt++;
+void nxw_finalize_factory(nxw_factory* f) {
+  // no new jobs from now on; workers exit once own queue is empty
+  pthread_mutex_lock(&f->idle_mux);
+  f->shutdown_in_progress=1;
+  pthread_cond_broadcast(&f->idle_cond);
+  pthread_mutex_unlock(&f->idle_mux);
+
+  nxweb_log_error("shutting down %d workers; %d jobs in flight", f->worker_count, f->in_flight);
+
+  int i;
+  nxw_job_class* jc;
+  nxw_job* job;
+  for (i=0, jc=f->classes; i<NXWEB_MAX_WORKER_CLASSES; i++, jc++) {
+    nxe_unset_timer(f->loop, 0, &jc->expire_timer);
+    // jobs waiting for class slot have not started yet; complete them as expired
+    while ((job=jc->queue_head)) {
+      jc->queue_head=job->next;
+      jc->queued--;
+      job->next=0;
+      job->expired=1;
+      job->on_complete(job);
     }
-    w=next;
+    jc->queue_tail=0;
   }
-  if (cnt) nxweb_log_error("gc destroyed %d dead workers", cnt);
-  int extra=(nx_queue_workers_length(&f->queue) - NXWEB_MAX_IDLE_WORKERS_IN_QUEUE + 1)/2;
-  // wake up half extra workers so we can destroy them dead in the next gc round
-  for (; extra>0; extra--) {
-    if (nx_queue_workers_pop(&f->queue, &w)) break;
-    w->shutdown_in_progress=1;
-    pthread_mutex_lock(&w->start_mux);
-    pthread_cond_signal(&w->start_cond);
-    pthread_mutex_unlock(&w->start_mux);
+
+  // queued and running jobs (possibly stolen by other factories' workers) complete to this factory;
+  // completion channel stays registered (and keeps loop running) until the last one is done
+  if (!f->in_flight) nxw_release_factory((nxe_data)(void*)f);
+}
+
+void nxw_setup_job_class(nxw_factory* f, int idx, int max_running, int max_queued, nxe_time_t queue_timeout) {
+  assert(idx>=0 && idx<NXWEB_MAX_WORKER_CLASSES);
+  nxw_job_class* jc=&f->classes[idx];
+  jc->max_running=max_running;
+  jc->max_queued=max_queued;
+  jc->queue_timeout=queue_timeout;
+}
+
+static int nxw_start_job(nxw_factory* f, nxw_job* job) {
+  if (nxw_queue_push(&f->queue, job)) return -1;
+  f->classes[job->job_class].running++;
+  f->in_flight++;
+  __sync_synchronize(); // full memory barrier; pairs with idle_count increment in nxw_worker_main()
+  if (nxw_wake_idle_worker(f)) return 0;
+  // own workers are all busy => let idle worker from other factory steal the job
+  int i, n=_nxw_num_factories;
+  nxw_factory* other;
+  for (i=1; i<n; i++) {
+    other=_nxw_factories[(f->index+i)%n];
+    if (other && !other->shutdown_in_progress && nxw_wake_idle_worker(other)) break;
   }
+  return 0;
 }
 
-nxw_worker* nxw_get_worker(nxw_factory* f) {
-  if (f->shutdown_in_progress) return 0;
-  nxw_worker* w;
-  if (nx_queue_workers_pop(&f->queue, &w)) {
-    if (f->worker_count>NXWEB_MAX_WORKERS) return 0; // no more workers
-    w=nxw_create_worker(f);
+static void nxw_dispatch_queued(nxw_factory* f, nxw_job_class* jc) {
+  nxw_expire_queued(f, jc);
+  nxw_job* job;
+  while ((job=jc->queue_head) && jc->running<jc->max_running) {
+    // unlink before starting as worker reuses job->next for completion
+    jc->queue_head=job->next;
+    if (!jc->queue_head) jc->queue_tail=0;
+    job->next=0;
+    if (nxw_start_job(f, job)) { // job queue full; retry on next completion
+      job->next=jc->queue_head;
+      jc->queue_head=job;
+      if (!jc->queue_tail) jc->queue_tail=job;
+      break;
+    }
+    jc->queued--;
   }
-  return w;
-}
-
-void nxw_start_worker(nxw_worker* w, void (*job_func)(void* job_param), void* job_param, volatile int* job_done) {
-  pthread_mutex_lock(&w->start_mux);
-  w->do_job=job_func;
-  w->job_param=job_param;
-  w->job_done=job_done;
-  *job_done=0;
-  pthread_cond_signal(&w->start_cond);
-  pthread_mutex_unlock(&w->start_mux);
-}
-
-static nxw_worker* nxw_create_worker(nxw_factory* f) {
-  nxw_worker* w=nx_calloc(sizeof(nxw_worker));
-  w->factory=f;
-  pthread_cond_init(&w->start_cond, 0);
-  pthread_mutex_init(&w->start_mux, 0);
-  nxe_init_eventfd_source(&w->complete_efs, NXE_PUB_DEFAULT);
-  nxe_register_eventfd_source(f->loop, &w->complete_efs);
-  link_worker(w);
-  f->worker_count++;
-  if (pthread_create(&w->tid, 0, nxw_worker_main, w)) {
-    nxweb_log_error("can't create worker thread");
-    nxw_destroy_worker(w);
-    return 0;
+  if (!jc->queue_head) nxe_unset_timer(f->loop, 0, &jc->expire_timer);
+}
+
+int nxw_submit_job(nxw_factory* f, nxw_job* job) {
+  if (f->shutdown_in_progress || !f->worker_count) return -1;
+  assert(job->job_class>=0 && job->job_class<NXWEB_MAX_WORKER_CLASSES);
+  nxw_job_class* jc=&f->classes[job->job_class];
+  job->factory=f;
+  job->next=0;
+  job->expired=0;
+  if (!jc->max_running || (jc->running<jc->max_running && !jc->queue_head)) {
+    return nxw_start_job(f, job);
   }
-  return w;
+  // class concurrency limit reached => wait in class queue
+  if (jc->queued>=jc->max_queued) return -1;
+  job->queued_time=f->loop->current_time;
+  if (jc->queue_tail) jc->queue_tail->next=job;
+  else jc->queue_head=job;
+  jc->queue_tail=job;
+  jc->queued++;
+  if (jc->queue_timeout && jc->queue_head==job) nxe_set_timer_usec(f->loop, &jc->expire_timer, jc->queue_timeout);
+  return 0;
 }
 
-static void nxw_destroy_worker(nxw_worker* w) { // must be called from factory thread (which runs the loop)!!!
-  nxe_unregister_eventfd_source(&w->complete_efs);
-  nxe_finalize_eventfd_source(&w->complete_efs);
-  pthread_cond_destroy(&w->start_cond);
-  pthread_mutex_destroy(&w->start_mux);
-  unlink_worker(w);
-  w->factory->worker_count--;
-  nx_free(w);
+int nxw_queue_depth(nxw_factory* f) {
+  int i, depth=(int)(f->queue.tail-f->queue.head);
+  for (i=0; i<NXWEB_MAX_WORKER_CLASSES; i++) {
+    depth+=f->classes[i].queued;
+  }
+  return depth;
 }
 
 static void* nxw_worker_main(void* ptr) {
   nxw_worker* w=ptr;
+  nxw_factory* f=w->factory;
+  nxw_job* job;
   _nxweb_worker_thread_data=w;
 
-  while (1) {
-    // wait for start
-    pthread_mutex_lock(&w->start_mux);
-    while (!w->do_job && !w->shutdown_in_progress && !w->factory->shutdown_in_progress) {
-      pthread_cond_wait(&w->start_cond, &w->start_mux);
-      //nxweb_log_error("woken up %p", (void*)w->tid);
+  while (!f->shutdown_in_progress || !nxw_queue_is_empty(&f->queue)) { // finish own queued jobs on shutdown
+    job=nxw_queue_pop(&f->queue);
+    if (!job) job=nxw_steal_job(f);
+    if (job) {
+      w->job=job;
+      job->do_job(job->job_param);
+      w->job=0;
+      nxw_push_complete(job->factory, job); // CAS is a full memory barrier
+      continue;
     }
-    pthread_mutex_unlock(&w->start_mux);
-    if (!w->do_job) break;
-
-    w->do_job(w->job_param);
-    w->do_job=0;
-    __sync_synchronize(); // full memory barrier
-    *w->job_done=1;
-    __sync_synchronize(); // full memory barrier
-    nxe_trigger_eventfd(&w->complete_efs);
-
-    // put itself into queue
-    pthread_mutex_lock(&w->factory->queue_mux);
-    if (w->shutdown_in_progress || w->factory->shutdown_in_progress) {
-      pthread_mutex_unlock(&w->factory->queue_mux);
-      break;
+    // nothing to do => sleep
+    pthread_mutex_lock(&f->idle_mux);
+    f->idle_count++;
+    __sync_synchronize(); // full memory barrier; pairs with queue push in nxw_submit_job()
+    if (!f->shutdown_in_progress && !nxw_has_pending_jobs(f)) {
+      pthread_cond_wait(&f->idle_cond, &f->idle_mux);
     }
-    int result=nx_queue_workers_push(&w->factory->queue, &w);
-    pthread_mutex_unlock(&w->factory->queue_mux);
-    if (result) break; // queue full => kill itself
+    f->idle_count--;
+    pthread_mutex_unlock(&f->idle_mux);
   }
 
-  w->dead=1;
   //nxweb_log_error("worker thread clean exit");
   return 0;
 }
@@ -20,6 +20,8 @@
 #include "nxweb.h"
 
 #include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
 
 static void ibuffer_data_in_do_read(nxe_ostream* os, nxe_istream* is) {
   nxd_ibuffer* ib=(nxd_ibuffer*)((char*)os-offsetof(nxd_ibuffer, data_in));
@@ -213,6 +215,231 @@ void nxd_rbuffer_write(nxd_rbuffer* rb, int size) {
 
 
 
+static void pbuffer_data_in_do_read(nxe_ostream* os, nxe_istream* is) {
+  nxd_pbuffer* pb=OBJ_PTR_FROM_FLD_PTR(nxd_pbuffer, data_in, os);
+
+  nxweb_log_debug("pbuffer_data_in_do_read");
+
+  if (pb->size) { // only refill empty pipe; this way EAGAIN from source always means it is drained
+    nxe_ostream_unset_ready(os);
+    return;
+  }
+  nxe_flags_t flags=0;
+  nxe_ssize_t bytes_received=ISTREAM_CLASS(is)->splice(is, os, pb->pipe_fd[1], NXD_PBUFFER_CHUNK_SIZE, &flags);
+  if (bytes_received>0) {
+    pb->size=bytes_received;
+    nxe_ostream_unset_ready(os);
+    nxe_istream_set_ready(os->super.loop, &pb->data_out);
+  }
+  if (flags&NXEF_EOF) {
+    pb->eof=1;
+    nxe_ostream_unset_ready(os);
+    nxe_istream_set_ready(os->super.loop, &pb->data_out); // even when no bytes received make sure we signal readiness on EOF
+  }
+}
+
+static void pbuffer_data_out_do_write(nxe_istream* is, nxe_ostream* os) {
+  nxd_pbuffer* pb=OBJ_PTR_FROM_FLD_PTR(nxd_pbuffer, data_out, is);
+
+  nxweb_log_debug("pbuffer_data_out_do_write");
+
+  nxe_flags_t flags=pb->eof? NXEF_PIPE|NXEF_EOF : NXEF_PIPE;
+  nxe_ssize_t bytes_sent=OSTREAM_CLASS(os)->write(os, is, pb->pipe_fd[0], 0, (nxe_data)0, pb->size, &flags);
+  if (bytes_sent>0) {
+    pb->size-=bytes_sent;
+    if (!pb->size && !pb->eof) {
+      nxe_istream_unset_ready(is);
+      if (pb->data_in.super.loop) nxe_ostream_set_ready(pb->data_in.super.loop, &pb->data_in);
+      else pb->data_in.ready=1;
+    }
+  }
+}
+
+static const nxe_ostream_class pbuffer_data_in_class={.do_read=pbuffer_data_in_do_read};
+static const nxe_istream_class pbuffer_data_out_class={.do_write=pbuffer_data_out_do_write};
+
+int nxd_pbuffer_init(nxd_pbuffer* pb) {
+  memset(pb, 0, sizeof(nxd_pbuffer));
+  if (pipe2(pb->pipe_fd, O_NONBLOCK|O_CLOEXEC)==-1) {
+    nxweb_log_warning("nxd_pbuffer_init(): pipe2() failed errno=%d", errno);
+    pb->pipe_fd[0]=pb->pipe_fd[1]=-1;
+    return -1;
+  }
+  pb->data_out.super.cls.is_cls=&pbuffer_data_out_class;
+  pb->data_in.super.cls.os_cls=&pbuffer_data_in_class;
+  pb->data_out.evt.cls=NXE_EV_STREAM;
+  pb->data_in.ready=1;
+  return 0;
+}
+
+void nxd_pbuffer_finalize(nxd_pbuffer* pb) {
+  if (pb->data_in.pair) nxe_disconnect_streams(pb->data_in.pair, &pb->data_in);
+  if (pb->data_out.pair) nxe_disconnect_streams(&pb->data_out, pb->data_out.pair);
+  if (pb->pipe_fd[0]!=-1) {
+    close(pb->pipe_fd[0]);
+    close(pb->pipe_fd[1]);
+    pb->pipe_fd[0]=pb->pipe_fd[1]=-1;
+  }
+  pb->size=0;
+}
+
+
+static int sbuffer_spill(nxd_sbuffer* sb) {
+  char fname_template[1024];
+  if (snprintf(fname_template, sizeof(fname_template), "%s/sbuf_tmp_XXXXXX", sb->spill_dir)>=sizeof(fname_template)) return -1;
+  if (nxweb_mkpath(fname_template, 0755)==-1) {
+    nxweb_log_error("can't create path to temp spool file %s; check permissions", fname_template);
+    return -1;
+  }
+  int fd=mkostemp(fname_template, O_CLOEXEC);
+  if (fd==-1) {
+    nxweb_log_error("can't open (mkostemp()) temp spool file %s errno=%d", fname_template, errno);
+    return -1;
+  }
+  unlink(fname_template); // auto-delete on close()
+  sb->fd=fd;
+  return 0;
+}
+
+static nxe_ssize_t sbuffer_store(nxd_sbuffer* sb, nxe_ostream* os, nxe_istream* is, nxe_flags_t* flags) {
+  nxe_ssize_t bytes_received;
+  if (sb->fd==-1) {
+    if (!sb->tail || sb->tail->size==NXD_SBUFFER_BLOCK_SIZE) {
+      nxd_sbuffer_block* blk=nx_alloc(sizeof(nxd_sbuffer_block));
+      blk->next=0;
+      blk->size=0;
+      if (sb->tail) sb->tail->next=blk;
+      else sb->head=blk;
+      sb->tail=blk;
+      sb->mem_size+=NXD_SBUFFER_BLOCK_SIZE;
+    }
+    bytes_received=ISTREAM_CLASS(is)->read(is, os, sb->tail->data+sb->tail->size, NXD_SBUFFER_BLOCK_SIZE-sb->tail->size, flags);
+    if (bytes_received>0) sb->tail->size+=bytes_received;
+    return bytes_received;
+  }
+  char buf[16384];
+  bytes_received=ISTREAM_CLASS(is)->read(is, os, buf, sizeof(buf), flags);
+  if (bytes_received>0) {
+    // pwrite() as file reader does its own lseek() on the same fd
+    if (pwrite(sb->fd, buf, bytes_received, sb->file_size)!=bytes_received) {
+      sb->error=errno? errno : ENOSPC;
+      nxweb_log_error("temp spool file write failed errno=%d", sb->error);
+    }
+    else {
+      sb->file_size+=bytes_received;
+    }
+  }
+  return bytes_received;
+}
+
+static void sbuffer_data_in_do_read(nxe_ostream* os, nxe_istream* is) {
+  nxd_sbuffer* sb=OBJ_PTR_FROM_FLD_PTR(nxd_sbuffer, data_in, os);
+
+  nxweb_log_debug("sbuffer_data_in_do_read");
+
+  nxe_flags_t flags=0;
+  nxe_ssize_t bytes_received;
+  if (sb->error) {
+    // NB: continue reading after error; just swallow the input
+    char buf[16384];
+    bytes_received=ISTREAM_CLASS(is)->read(is, os, buf, sizeof(buf), &flags);
+  }
+  else {
+    if (sb->fd==-1 && (!sb->tail || sb->tail->size==NXD_SBUFFER_BLOCK_SIZE) && sb->mem_size>=sb->max_mem_size) {
+      if (!sb->spill_dir || sbuffer_spill(sb)) {
+        // memory limit reached; wait for data_out to free some blocks
+        nxe_ostream_unset_ready(os);
+        return;
+      }
+    }
+    bytes_received=sbuffer_store(sb, os, is, &flags);
+  }
+  if (bytes_received>0) {
+    sb->size+=bytes_received;
+    if (sb->max_size && sb->size>sb->max_size && !sb->error) sb->error=EFBIG;
+    nxe_istream_set_ready(os->super.loop, &sb->data_out);
+  }
+  if (flags&NXEF_EOF) {
+    sb->eof=1;
+    nxe_ostream_unset_ready(os);
+    nxe_istream_set_ready(os->super.loop, &sb->data_out); // even when no bytes received make sure we signal readiness on EOF
+  }
+}
+
+static void sbuffer_data_out_do_write(nxe_istream* is, nxe_ostream* os) {
+  nxd_sbuffer* sb=OBJ_PTR_FROM_FLD_PTR(nxd_sbuffer, data_out, is);
+
+  nxweb_log_debug("sbuffer_data_out_do_write");
+
+  nxd_sbuffer_block* blk=sb->head;
+  nxe_flags_t flags=0;
+  nxe_ssize_t bytes_sent;
+  if (blk && sb->read_pos < blk->size) {
+    nxe_size_t size=blk->size - sb->read_pos;
+    if (sb->eof && !blk->next && sb->fd==-1) flags|=NXEF_EOF;
+    bytes_sent=OSTREAM_CLASS(os)->write(os, is, 0, 0, (nxe_data)(void*)(blk->data+sb->read_pos), size, &flags);
+    if (bytes_sent>0) {
+      sb->read_pos+=bytes_sent;
+      if (sb->read_pos==NXD_SBUFFER_BLOCK_SIZE) { // block fully consumed
+        sb->head=blk->next;
+        if (!sb->head) sb->tail=0;
+        sb->read_pos=0;
+        nx_free(blk);
+        sb->mem_size-=NXD_SBUFFER_BLOCK_SIZE;
+        if (!sb->eof && sb->fd==-1) {
+          if (sb->data_in.super.loop) nxe_ostream_set_ready(sb->data_in.super.loop, &sb->data_in);
+          else sb->data_in.ready=1;
+        }
+      }
+    }
+    return;
+  }
+  if (sb->fd!=-1 && sb->file_offset < sb->file_size) {
+    if (sb->eof && !sb->error) flags|=NXEF_EOF;
+    bytes_sent=OSTREAM_CLASS(os)->write(os, is, sb->fd, &sb->fr, (nxe_data)sb->file_offset, sb->file_size-sb->file_offset, &flags);
+    if (bytes_sent>0) sb->file_offset+=bytes_sent;
+    return;
+  }
+  if (sb->eof && !sb->error) {
+    flags|=NXEF_EOF;
+    OSTREAM_CLASS(os)->write(os, is, 0, 0, (nxe_data)0, 0, &flags);
+    return;
+  }
+  nxe_istream_unset_ready(is); // wait for more data
+}
+
+static const nxe_ostream_class sbuffer_data_in_class={.do_read=sbuffer_data_in_do_read};
+static const nxe_istream_class sbuffer_data_out_class={.do_write=sbuffer_data_out_do_write};
+
+void nxd_sbuffer_init(nxd_sbuffer* sb, nxe_size_t max_mem_size, const char* spill_dir) {
+  memset(sb, 0, sizeof(nxd_sbuffer));
+  sb->max_mem_size=max_mem_size;
+  sb->spill_dir=spill_dir;
+  sb->fd=-1;
+  sb->data_out.super.cls.is_cls=&sbuffer_data_out_class;
+  sb->data_in.super.cls.os_cls=&sbuffer_data_in_class;
+  sb->data_out.evt.cls=NXE_EV_STREAM;
+  sb->data_in.ready=1;
+}
+
+void nxd_sbuffer_finalize(nxd_sbuffer* sb) {
+  if (sb->data_in.pair) nxe_disconnect_streams(sb->data_in.pair, &sb->data_in);
+  if (sb->data_out.pair) nxe_disconnect_streams(&sb->data_out, sb->data_out.pair);
+  nxd_sbuffer_block* blk;
+  while ((blk=sb->head)) {
+    sb->head=blk->next;
+    nx_free(blk);
+  }
+  sb->tail=0;
+  sb->mem_size=0;
+  nx_file_reader_finalize(&sb->fr);
+  if (sb->fd!=-1) {
+    close(sb->fd);
+    sb->fd=-1;
+  }
+}
+
+
 static void fbuffer_data_out_do_write(nxe_istream* is, nxe_ostream* os) {
   nxd_fbuffer* fb=OBJ_PTR_FROM_FLD_PTR(nxd_fbuffer, data_out, is);
   //nxe_loop* loop=is->super.loop;
@@ -49,8 +49,6 @@ static inline void request_complete(nxd_http_client_proto* hcp, nxe_loop* loop)
 
   nxweb_log_debug("http_client request_complete");
 
-  nxe_publish(&hcp->events_pub, (nxe_data)NXD_HCP_REQUEST_COMPLETE);
-  if (hcp->queued_error_message.i) nxe_publish(&hcp->events_pub, hcp->queued_error_message);
   nxe_ostream_unset_ready(&hcp->data_in);
   nxe_istream_unset_ready(&hcp->data_out);
   nxe_unset_timer(loop, NXWEB_TIMER_READ, &hcp->timer_read);
@@ -64,6 +62,11 @@ static inline void request_complete(nxd_http_client_proto* hcp, nxe_loop* loop)
   hcp->request_complete=1;
   hcp->state=HCP_IDLE;
   hcp->request_count++;
+  // publish last: subscriber may return connection to pool (or free it) right away,
+  // so it must already look idle, and hcp must not be touched afterwards
+  nxe_data error_message=hcp->queued_error_message;
+  nxe_publish(&hcp->events_pub, (nxe_data)NXD_HCP_REQUEST_COMPLETE);
+  if (error_message.i) nxe_publish(&hcp->events_pub, error_message);
 }
 
 static void data_in_do_read(nxe_ostream* os, nxe_istream* is) {
@@ -179,13 +182,12 @@ static void data_out_do_write(nxe_istream* is, nxe_ostream* os) {
 
   nxweb_log_debug("http_client data_out_do_write");
 
-  nxe_unset_timer(loop, NXWEB_TIMER_WRITE, &hcp->timer_write);
-
   if (hcp->state==HCP_CONNECTING) {
     nxe_publish(&hcp->events_pub, (nxe_data)NXD_HCP_CONNECTED);
     if (hcp->req) hcp->state=HCP_SENDING_HEADERS;
     else {
       hcp->state=HCP_IDLE;
+      nxe_unset_timer(loop, NXWEB_TIMER_WRITE, &hcp->timer_write);
       nxe_set_timer(loop, NXWEB_TIMER_KEEP_ALIVE, &hcp->timer_keep_alive);
       nxe_istream_unset_ready(is);
       return;
@@ -198,6 +200,8 @@ static void data_out_do_write(nxe_istream* is, nxe_ostream* os) {
     if (hcp->req_headers_ptr && *hcp->req_headers_ptr) {
       int size=strlen(hcp->req_headers_ptr);
       nxe_flags_t flags=0;
+      if (hcp->req->content_length && !hcp->req->expect_100_continue
+          && hcp->req_body_in.pair && hcp->req_body_in.pair->ready) flags|=NXEF_MORE; // body follows right away
       int bytes_sent=OSTREAM_CLASS(os)->write(os, is, 0, 0, (nxe_data)hcp->req_headers_ptr, size, &flags);
       hcp->req_headers_ptr+=bytes_sent;
       if (bytes_sent<size) return;
@@ -330,6 +334,73 @@ static nxe_size_t resp_body_out_read(nxe_istream* is, nxe_ostream* os, void* ptr
   return bytes_received;
 }
 
+static nxe_ssize_t resp_body_out_splice(nxe_istream* is, nxe_ostream* os, int pipe_fd, nxe_size_t size, nxe_flags_t* flags) {
+  nxd_http_client_proto* hcp=(nxd_http_client_proto*)((char*)is-offsetof(nxd_http_client_proto, resp_body_out));
+  nxe_loop* loop=is->super.loop;
+
+  nxweb_log_debug("http_client resp_body_out_splice");
+
+  if (hcp->request_complete) {
+    nxweb_log_error("hcp->request_complete - resp_body_out_splice() should not be called");
+    *flags|=NXEF_EOF;
+    nxe_istream_unset_ready(is);
+    return 0;
+  }
+
+  if (hcp->state!=HCP_RECEIVING_BODY) {
+    nxe_istream_unset_ready(is);
+    nxe_ostream_set_ready(loop, &hcp->data_in); // get notified when prev_is ready
+    return 0;
+  }
+
+  assert(!hcp->resp.chunked_encoding && hcp->resp.content_length>0);
+
+  nxe_ssize_t bytes_received=0;
+
+  if (hcp->first_body_chunk) {
+    // part of body that came in with headers is already in memory; push it into the pipe
+    nxe_size_t first_body_chunk_size=hcp->first_body_chunk_end-hcp->first_body_chunk;
+    bytes_received=write(pipe_fd, hcp->first_body_chunk, first_body_chunk_size<=size? first_body_chunk_size : size);
+    if (bytes_received<=0) return 0;
+    hcp->first_body_chunk+=bytes_received;
+    if (hcp->first_body_chunk>=hcp->first_body_chunk_end) {
+      hcp->first_body_chunk=0;
+      hcp->first_body_chunk_end=0;
+    }
+    hcp->resp.content_received+=bytes_received;
+    size-=bytes_received;
+  }
+
+  if (hcp->resp.content_received < hcp->resp.content_length) {
+    if (size>hcp->resp.content_length-hcp->resp.content_received) size=hcp->resp.content_length-hcp->resp.content_received;
+    nxe_istream* prev_is=hcp->data_in.pair;
+    if (size>0 && !hcp->first_body_chunk && prev_is) {
+      nxe_ssize_t bytes_received2=0;
+      nxe_flags_t rflags=0;
+      if (prev_is->ready) bytes_received2=ISTREAM_CLASS(prev_is)->splice(prev_is, &hcp->data_in, pipe_fd, size, &rflags);
+      if (!prev_is->ready) {
+        nxe_istream_unset_ready(is);
+        nxe_ostream_set_ready(loop, &hcp->data_in); // get notified when prev_is becomes ready again
+      }
+      hcp->resp.content_received+=bytes_received2;
+      bytes_received+=bytes_received2;
+    }
+    else if (!prev_is) {
+      nxweb_log_error("no connected device for hcp->data_in");
+      nxe_istream_unset_ready(is);
+    }
+  }
+
+  if (hcp->resp.content_received >= hcp->resp.content_length) {
+    hcp->response_body_complete=1;
+    // rearm connection
+    request_complete(hcp, loop);
+    nxe_istream_unset_ready(is);
+    *flags|=NXEF_EOF;
+  }
+  return bytes_received;
+}
+
 static nxe_ssize_t req_body_in_write(nxe_ostream* os, nxe_istream* is, int fd, nx_file_reader* fr, nxe_data ptr, nxe_size_t size, nxe_flags_t* flags) {
   //nxweb_log_error("req_body_in_write(%d)", size);
   nxd_http_client_proto* hcp=(nxd_http_client_proto*)((char*)os-offsetof(nxd_http_client_proto, req_body_in));
@@ -343,13 +414,12 @@ static nxe_ssize_t req_body_in_write(nxe_ostream* os, nxe_istream* is, int fd, n
     return 0;
   }
   hcp->req_body_sending_started=1;
-  nxe_unset_timer(loop, NXWEB_TIMER_WRITE, &hcp->timer_write);
   nxe_ssize_t bytes_sent=0;
   if (size>0) {
     nxe_ostream* next_os=hcp->data_out.pair;
     if (next_os) {
       nxe_flags_t wflags=*flags;
-      if (next_os->ready) bytes_sent=OSTREAM_CLASS(next_os)->write(next_os, &hcp->data_out, 0, 0, (nxe_data)ptr, size, &wflags);
+      if (next_os->ready) bytes_sent=OSTREAM_CLASS(next_os)->write(next_os, &hcp->data_out, fd, fr, ptr, size, &wflags);
       if (!next_os->ready) {
         //nxweb_log_error("req_body_in_write(%d) - next_os unready", size);
         nxe_ostream_unset_ready(os);
@@ -386,6 +456,12 @@ static void data_error_on_message(nxe_subscriber* sub, nxe_publisher* pub, nxe_d
     nxe_istream_set_ready(loop, &hcp->resp_body_out); // signal readiness for EOF
     return;
   }
+  else if (data.i==NXE_RDHUP && hcp->state==HCP_RECEIVING_BODY && hcp->resp.content_length>0 && !hcp->resp.chunked_encoding) {
+    // backend has sent everything and shut down; rest of body may still sit in socket buffer
+    // (reading past its end reports NXE_RDCLOSED if body is actually truncated)
+    hcp->queued_error_message=data;
+    return;
+  }
   else if (hcp->response_body_complete && !hcp->request_complete && data.i<0) {
     // queue error message until request is complete
     hcp->queued_error_message=data;
@@ -425,7 +501,7 @@ static void timer_100_continue_on_timeout(nxe_timer* timer, nxe_data data) {
 static const nxe_ostream_class data_in_class={.do_read=data_in_do_read};
 static const nxe_istream_class data_out_class={.do_write=data_out_do_write};
 static const nxe_subscriber_class data_error_class={.on_message=data_error_on_message};
-static const nxe_istream_class resp_body_out_class={.read=resp_body_out_read};
+static const nxe_istream_class resp_body_out_class={.read=resp_body_out_read, .splice=resp_body_out_splice};
 static const nxe_ostream_class req_body_in_class={.write=req_body_in_write};
 static const nxe_timer_class timer_keep_alive_class={.on_timeout=timer_keep_alive_on_timeout};
 static const nxe_timer_class timer_read_class={.on_timeout=timer_read_on_timeout};
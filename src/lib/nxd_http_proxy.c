@@ -21,44 +21,67 @@
 
 #include <errno.h>
 #include <netdb.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
 
-#define IS_LINKED(hpx) ((hpx)->pool && ((hpx)->prev || (hpx)->pool->first==(hpx)))
+#include "deps/ulib/hash.h"
 
-static inline void nxd_http_proxy_link(nxd_http_proxy* hpx, nxd_http_proxy_pool* pp) {
+#define IS_LINKED(hpx) ((hpx)->server && ((hpx)->prev || (hpx)->server->first==(hpx)))
+
+static inline void nxd_http_proxy_link(nxd_http_proxy* hpx, nxd_http_proxy_server* srv) {
 #if 1
   // add to tail
   hpx->next=0;
-  hpx->prev=pp->last;
-  if (pp->last) pp->last->next=hpx;
-  else pp->first=hpx;
-  pp->last=hpx;
+  hpx->prev=srv->last;
+  if (srv->last) srv->last->next=hpx;
+  else srv->first=hpx;
+  srv->last=hpx;
+  srv->idle_count++;
 #else
   // add to head
   hpx->prev=0;
-  hpx->next=pp->first;
-  if (pp->first) pp->first->prev=hpx;
-  else pp->last=hpx;
-  pp->first=hpx;
+  hpx->next=srv->first;
+  if (srv->first) srv->first->prev=hpx;
+  else srv->last=hpx;
+  srv->first=hpx;
+  srv->idle_count++;
 #endif
 }
 
 static inline void nxd_http_proxy_unlink(nxd_http_proxy* hpx) {
-  nxd_http_proxy_pool* pp=hpx->pool;
+  nxd_http_proxy_server* srv=hpx->server;
   if (hpx->prev) hpx->prev->next=hpx->next;
-  else pp->first=hpx->next;
+  else srv->first=hpx->next;
   if (hpx->next) hpx->next->prev=hpx->prev;
-  else pp->last=hpx->prev;
+  else srv->last=hpx->prev;
   hpx->next=0;
   hpx->prev=0;
+  srv->idle_count--;
+}
+
+static void nxd_http_proxy_server_failed(nxd_http_proxy_server* srv);
+
+static void nxd_http_proxy_pool_schedule_refill(nxd_http_proxy_pool* pp) {
+  if (pp->min_idle>0 && !pp->refill_timer.next && pp->servers && !pp->finalizing) nxe_set_timer_usec(pp->loop, &pp->refill_timer, NXD_HTTP_PROXY_REFILL_DELAY);
 }
 
 static void nxd_http_proxy_events_sub_on_message(nxe_subscriber* sub, nxe_publisher* pub, nxe_data data) {
   // this callback is only subscribed while connection is in idle pooled state
   nxd_http_proxy* hpx=(nxd_http_proxy*)((char*)sub-offsetof(nxd_http_proxy, events_sub));
-  if (data.i<0) {
+  if (data.i==NXD_HCP_CONNECTED) {
+    hpx->connected=1;
+  }
+  else if (data.i<0) {
     nxd_http_proxy_pool* pp=hpx->pool;
+    // error before connection got established => could not connect;
+    // do not refill right away then, or dead server gets hammered with connects.
+    // idle close of established connection (pre-warmed, adopted or returned) is normal => just refill
+    int failed=!hpx->connected;
+    if (failed) nxd_http_proxy_server_failed(hpx->server);
     nxd_http_proxy_finalize(hpx, 0);
     nxp_free(pp->free_pool, hpx);
+    if (!failed) nxd_http_proxy_pool_schedule_refill(pp);
   }
 }
 
@@ -70,31 +93,38 @@ void nxd_http_proxy_init(nxd_http_proxy* hpx, nxp_pool* nxb_pool) {
   nxd_socket_init(&hpx->sock);
 }
 
-int nxd_http_proxy_connect(nxd_http_proxy* hpx, nxe_loop* loop, const char* host, struct addrinfo* saddr) {
+// fd is either connecting or already connected (adopted idle connection); either way it goes idle once writable
+static void nxd_http_proxy_attach(nxd_http_proxy* hpx, nxe_loop* loop, const char* host, int fd) {
   hpx->hcp.host=host;
+  hpx->sock.fs.fd=fd;
+  hpx->hcp.sock_fd=fd;
+  nxe_register_fd_source(loop, &hpx->sock.fs);
+  nxe_subscribe(loop, &hpx->sock.fs.data_error, &hpx->hcp.data_error);
+  nxe_connect_streams(loop, &hpx->sock.fs.data_is, &hpx->hcp.data_in);
+  nxe_connect_streams(loop, &hpx->hcp.data_out, &hpx->sock.fs.data_os);
+  nxd_http_client_proto_connect(&hpx->hcp, loop);
+  hpx->uid=nxweb_generate_unique_id();
+}
+
+int nxd_http_proxy_connect(nxd_http_proxy* hpx, nxe_loop* loop, const char* host, struct addrinfo* saddr) {
   int fd=socket(saddr->ai_family, saddr->ai_socktype|SOCK_NONBLOCK, saddr->ai_protocol);
   if (fd==-1) {
     nxweb_log_error("can't open socket %d", errno);
     return -1;
   }
-  if (/*_nxweb_set_non_block(fd)<0 ||*/ _nxweb_setup_client_socket(fd)<0) {
+  if (/*_nxweb_set_non_block(fd)<0 ||*/ (saddr->ai_family!=AF_UNIX && _nxweb_setup_client_socket(fd)<0)) {
     nxweb_log_error("can't setup http client socket");
+    close(fd);
     return -1;
   }
   if (connect(fd, saddr->ai_addr, saddr->ai_addrlen)) {
     if (errno!=EINPROGRESS && errno!=EALREADY && errno!=EISCONN) {
-      nxweb_log_error("can't connect http client %d", errno);
+      nxweb_log_error("can't connect http client to %s %d", host, errno);
+      close(fd);
       return -1;
     }
   }
-  hpx->sock.fs.fd=fd;
-  hpx->hcp.sock_fd=fd;
-  nxe_register_fd_source(loop, &hpx->sock.fs);
-  nxe_subscribe(loop, &hpx->sock.fs.data_error, &hpx->hcp.data_error);
-  nxe_connect_streams(loop, &hpx->sock.fs.data_is, &hpx->hcp.data_in);
-  nxe_connect_streams(loop, &hpx->hcp.data_out, &hpx->sock.fs.data_os);
-  nxd_http_client_proto_connect(&hpx->hcp, loop);
-  hpx->uid=nxweb_generate_unique_id();
+  nxd_http_proxy_attach(hpx, loop, saddr->ai_family==AF_UNIX? "localhost" : host, fd); // socket path is no use in Host header
   return 0;
 }
 
@@ -112,32 +142,372 @@ void nxd_http_proxy_start_request(nxd_http_proxy* hpx, nxweb_http_request* req)
   nxd_http_client_proto_start_request(&hpx->hcp, req);
 }
 
+// Idle connections shared between net threads:
+
+typedef struct nxd_http_proxy_shared_idle {
+  pthread_mutex_t lock;
+  int count;
+  struct {
+    int fd;
+    nxe_time_t parked_time;
+  } conns[NXD_HTTP_PROXY_SHARED_IDLE_MAX]; // stack; most recently parked on top
+} nxd_http_proxy_shared_idle;
+
+nxd_http_proxy_shared_idle* nxd_http_proxy_shared_idle_create() {
+  nxd_http_proxy_shared_idle* si=nx_calloc(sizeof(nxd_http_proxy_shared_idle));
+  pthread_mutex_init(&si->lock, 0);
+  return si;
+}
+
+void nxd_http_proxy_shared_idle_destroy(nxd_http_proxy_shared_idle* si) {
+  int i;
+  for (i=0; i<si->count; i++) _nxweb_close_good_socket(si->conns[i].fd);
+  pthread_mutex_destroy(&si->lock);
+  nx_free(si);
+}
+
+// parked connections are not watched by any loop, so they are only trusted for half of keep-alive timeout
+static inline nxe_time_t nxd_http_proxy_shared_idle_min_time(nxe_loop* loop) {
+  return loop->current_time-loop->timer_timeouts[NXWEB_TIMER_KEEP_ALIVE]/2;
+}
+
+static void nxd_http_proxy_shared_idle_sweep(nxd_http_proxy_shared_idle* si, nxe_time_t min_time) {
+  int i, j=0;
+  pthread_mutex_lock(&si->lock);
+  for (i=0; i<si->count; i++) {
+    if (si->conns[i].parked_time<min_time) _nxweb_close_good_socket(si->conns[i].fd);
+    else si->conns[j++]=si->conns[i];
+  }
+  si->count=j;
+  pthread_mutex_unlock(&si->lock);
+}
+
+// detaches idle connection from this loop and hands its fd over to shared registry; hpx can be freed then
+static void nxd_http_proxy_park(nxd_http_proxy* hpx) {
+  nxd_http_proxy_shared_idle* si=hpx->server->shared_idle;
+  nxe_loop* loop=hpx->pool->loop;
+  int fd=hpx->sock.fs.fd;
+  nxd_http_client_proto_finalize(&hpx->hcp);
+  if (hpx->sock.fs.data_is.super.loop) nxe_unregister_fd_source(&hpx->sock.fs);
+  pthread_mutex_lock(&si->lock);
+  if (si->count<NXD_HTTP_PROXY_SHARED_IDLE_MAX) {
+    si->conns[si->count].fd=fd;
+    si->conns[si->count].parked_time=loop->current_time;
+    si->count++;
+    fd=-1;
+  }
+  pthread_mutex_unlock(&si->lock);
+  if (fd!=-1) _nxweb_close_good_socket(fd); // registry full
+}
+
+static nxd_http_proxy* nxd_http_proxy_adopt(nxd_http_proxy_server* srv) {
+  nxd_http_proxy_shared_idle* si=srv->shared_idle;
+  nxd_http_proxy_pool* pp=srv->pool;
+  nxe_time_t min_time=nxd_http_proxy_shared_idle_min_time(pp->loop);
+  nxe_time_t parked_time;
+  int fd;
+  char c;
+  for (;;) {
+    pthread_mutex_lock(&si->lock);
+    if (!si->count) {
+      pthread_mutex_unlock(&si->lock);
+      return 0;
+    }
+    si->count--;
+    fd=si->conns[si->count].fd;
+    parked_time=si->conns[si->count].parked_time;
+    pthread_mutex_unlock(&si->lock);
+    // backend might have closed it (or sent something unexpected) while parked
+    if (parked_time>=min_time && recv(fd, &c, 1, MSG_PEEK|MSG_DONTWAIT)<0 && (errno==EAGAIN || errno==EWOULDBLOCK)) break;
+    _nxweb_close_bad_socket(fd);
+  }
+  nxd_http_proxy* hpx=nxp_alloc(pp->free_pool);
+  nxd_http_proxy_init(hpx, pp->nxb_pool);
+  hpx->pool=pp;
+  hpx->server=srv;
+  nxd_http_proxy_attach(hpx, pp->loop, srv->saddr->ai_family==AF_UNIX? "localhost" : srv->host, fd);
+  return hpx;
+}
+
 // Proxy pool methods:
 
 static void gc_sub_on_message(nxe_subscriber* sub, nxe_publisher* pub, nxe_data data) {
   nxd_http_proxy_pool* pp=(nxd_http_proxy_pool*)((char*)sub-offsetof(nxd_http_proxy_pool, gc_sub));
   nxp_gc(pp->free_pool);
+  nxe_time_t min_time=nxd_http_proxy_shared_idle_min_time(pp->loop);
+  int i;
+  for (i=0; i<pp->num_servers; i++) {
+    if (pp->servers[i].shared_idle) nxd_http_proxy_shared_idle_sweep(pp->servers[i].shared_idle, min_time);
+  }
 }
 
 static const nxe_subscriber_class gc_sub_class={.on_message=gc_sub_on_message};
 
-void nxd_http_proxy_pool_init(nxd_http_proxy_pool* pp, nxe_loop* loop, nxp_pool* nxb_pool, const char* host, struct addrinfo* saddr) {
+static int hash_point_cmp(const void* a, const void* b) {
+  uint32_t ha=((const nxd_http_proxy_hash_point*)a)->hash;
+  uint32_t hb=((const nxd_http_proxy_hash_point*)b)->hash;
+  return ha<hb? -1 : (ha>hb? 1 : 0);
+}
+
+static void nxd_http_proxy_pool_build_hash_ring(nxd_http_proxy_pool* pp) {
+  int i, j, k=0;
+  char buf[1024];
+  pp->hash_ring_size=0;
+  for (i=0; i<pp->num_servers; i++) {
+    pp->hash_ring_size+=pp->servers[i].weight*NXD_HTTP_PROXY_HASH_POINTS;
+  }
+  pp->hash_ring=nx_alloc(pp->hash_ring_size*sizeof(nxd_http_proxy_hash_point));
+  for (i=0; i<pp->num_servers; i++) {
+    // points depend on server name only, so adding/removing server only remaps its own share of keys
+    for (j=0; j<pp->servers[i].weight*NXD_HTTP_PROXY_HASH_POINTS; j++) {
+      int len=snprintf(buf, sizeof(buf), "%s-%d", pp->servers[i].host, j);
+      if (len>=(int)sizeof(buf)) len=sizeof(buf)-1;
+      pp->hash_ring[k].hash=hash_murmur32((const unsigned char*)buf, len, 0);
+      pp->hash_ring[k].server_idx=i;
+      k++;
+    }
+  }
+  qsort(pp->hash_ring, pp->hash_ring_size, sizeof(nxd_http_proxy_hash_point), hash_point_cmp);
+}
+
+// Circuit breaker:
+
+static void nxd_http_proxy_server_up(nxd_http_proxy_server* srv) {
+  srv->fails=0;
+  if (srv->state!=NXD_SERVER_UP) {
+    srv->state=NXD_SERVER_UP;
+    srv->ejections=0;
+    srv->up_since=srv->pool->loop->current_time;
+    nxweb_log_error("proxy backend %s is up", srv->host);
+    nxd_http_proxy_pool_schedule_refill(srv->pool);
+  }
+}
+
+static void nxd_http_proxy_server_failed(nxd_http_proxy_server* srv) {
+  nxd_http_proxy_pool* pp=srv->pool;
+  srv->fails++;
+  if (srv->state==NXD_SERVER_DOWN) return;
+  if (srv->state==NXD_SERVER_PROBING || (pp->health.max_fails>0 && srv->fails>=pp->health.max_fails)) {
+    int backoff=srv->ejections<3? 1<<srv->ejections : NXD_HTTP_PROXY_MAX_EJECT_BACKOFF;
+    srv->ejections++;
+    srv->state=NXD_SERVER_DOWN;
+    srv->down_until=pp->loop->current_time+(nxe_time_t)pp->health.fail_timeout*1000*backoff;
+    nxweb_log_error("proxy backend %s is down after %d failures; ejected", srv->host, srv->fails);
+  }
+}
+
+static int nxd_http_proxy_server_available(nxd_http_proxy_server* srv) {
+  nxd_http_proxy_pool* pp=srv->pool;
+  switch (srv->state) {
+    case NXD_SERVER_UP:
+      return 1;
+    case NXD_SERVER_DOWN:
+      if (pp->health.check_interval>0 || pp->loop->current_time<srv->down_until) return 0;
+      srv->state=NXD_SERVER_PROBING;
+      nxweb_log_info("proxy backend %s: sending trial request", srv->host);
+      // fall through
+    case NXD_SERVER_PROBING:
+      return !srv->conn_count;
+  }
+  return 0;
+}
+
+// in hundredths of configured weight; ramps up linearly during slow start
+static int nxd_http_proxy_server_weight(nxd_http_proxy_server* srv) {
+  nxd_http_proxy_pool* pp=srv->pool;
+  nxe_time_t slow_start=(nxe_time_t)pp->health.slow_start*1000;
+  nxe_time_t t=pp->loop->current_time-srv->up_since;
+  if (srv->up_since && t<slow_start) {
+    int w=(int)(srv->weight*100*t/slow_start);
+    return w>0? w : 1;
+  }
+  return srv->weight*100;
+}
+
+static inline int nxd_http_proxy_server_at_capacity(nxd_http_proxy_server* srv) {
+  return srv->pool->max_conns>0 && srv->conn_count>=srv->pool->max_conns;
+}
+
+static int nxd_http_proxy_server_eligible(nxd_http_proxy_server* srv) {
+  return nxd_http_proxy_server_available(srv) && !nxd_http_proxy_server_at_capacity(srv);
+}
+
+// Active health checks:
+
+static void nxd_http_proxy_probe_sub_on_message(nxe_subscriber* sub, nxe_publisher* pub, nxe_data data) {
+  nxd_http_proxy* hpx=OBJ_PTR_FROM_FLD_PTR(nxd_http_proxy, events_sub, sub);
+  nxd_http_proxy_server* srv=hpx->server;
+  if (srv->probe_done) return;
+  // can't close connection from within its own event; it gets closed on next check
+  if (data.i==NXD_HCP_RESPONSE_RECEIVED) {
+    srv->probe_done=1;
+    if (hpx->hcp.resp.status_code<500) nxd_http_proxy_server_up(srv);
+    else nxd_http_proxy_server_failed(srv);
+  }
+  else if (data.i<0) {
+    srv->probe_done=1;
+    nxd_http_proxy_server_failed(srv);
+  }
+}
+
+static const nxe_subscriber_class nxd_http_proxy_probe_sub_class={.on_message=nxd_http_proxy_probe_sub_on_message};
+
+static void nxd_http_proxy_server_close_probe(nxd_http_proxy_server* srv) {
+  nxd_http_proxy* hpx=srv->probe;
+  nxe_unsubscribe(&hpx->hcp.events_pub, &hpx->events_sub);
+  nxd_http_proxy_finalize(hpx, 0);
+  nxp_free(srv->pool->free_pool, hpx);
+  srv->probe=0;
+}
+
+static void nxd_http_proxy_server_start_probe(nxd_http_proxy_server* srv) {
+  nxd_http_proxy_pool* pp=srv->pool;
+  nxd_http_proxy* hpx=nxp_alloc(pp->free_pool);
+  nxd_http_proxy_init(hpx, pp->nxb_pool);
+  hpx->pool=pp;
+  hpx->server=srv;
+  if (nxd_http_proxy_connect(hpx, pp->loop, srv->host, srv->saddr)) {
+    nxp_free(pp->free_pool, hpx);
+    nxd_http_proxy_server_failed(srv);
+    return;
+  }
+  nxweb_http_request* req=nxd_http_proxy_prepare(hpx);
+  req->host=hpx->hcp.host;
+  req->method="GET";
+  req->get_method=1;
+  req->uri=pp->health.check_uri? pp->health.check_uri : "/";
+  req->http11=1;
+  req->keep_alive=0;
+  nxd_http_proxy_start_request(hpx, req);
+  nxe_init_subscriber(&hpx->events_sub, &nxd_http_proxy_probe_sub_class);
+  nxe_subscribe(pp->loop, &hpx->hcp.events_pub, &hpx->events_sub);
+  srv->probe=hpx;
+  srv->probe_done=0;
+}
+
+static void health_timer_on_timeout(nxe_timer* timer, nxe_data data) {
+  nxd_http_proxy_pool* pp=OBJ_PTR_FROM_FLD_PTR(nxd_http_proxy_pool, health_timer, timer);
+  int i;
+  for (i=0; i<pp->num_servers; i++) {
+    nxd_http_proxy_server* srv=&pp->servers[i];
+    if (srv->probe) {
+      if (!srv->probe_done) nxd_http_proxy_server_failed(srv); // no response within check interval
+      nxd_http_proxy_server_close_probe(srv);
+    }
+    // servers in service are judged by real traffic; only ejected ones need probing
+    if (srv->state!=NXD_SERVER_UP) nxd_http_proxy_server_start_probe(srv);
+  }
+  nxe_set_timer_usec(pp->loop, timer, (nxe_time_t)pp->health.check_interval*1000);
+}
+
+static const nxe_timer_class health_timer_class={.on_timeout=health_timer_on_timeout};
+
+// Idle connection pre-warming:
+
+static void nxd_http_proxy_pool_refill(nxd_http_proxy_pool* pp) {
+  int i;
+  for (i=0; i<pp->num_servers; i++) {
+    nxd_http_proxy_server* srv=&pp->servers[i];
+    if (srv->state!=NXD_SERVER_UP) continue;
+    while (srv->idle_count<pp->min_idle) {
+      if (pp->max_conns>0 && srv->conn_count+srv->idle_count>=pp->max_conns) break;
+      nxd_http_proxy* hpx=srv->shared_idle? nxd_http_proxy_adopt(srv) : 0;
+      if (!hpx) {
+        hpx=nxp_alloc(pp->free_pool);
+        nxd_http_proxy_init(hpx, pp->nxb_pool);
+        hpx->pool=pp;
+        hpx->server=srv;
+        if (nxd_http_proxy_connect(hpx, pp->loop, srv->host, srv->saddr)) {
+          nxp_free(pp->free_pool, hpx);
+          nxd_http_proxy_server_failed(srv);
+          break;
+        }
+      }
+      // client proto goes idle once connected; monitor it like any pooled connection
+      nxe_init_subscriber(&hpx->events_sub, &nxd_http_proxy_events_sub_class);
+      nxe_subscribe(pp->loop, &hpx->hcp.events_pub, &hpx->events_sub);
+      nxd_http_proxy_link(hpx, srv);
+    }
+  }
+}
+
+static void refill_timer_on_timeout(nxe_timer* timer, nxe_data data) {
+  nxd_http_proxy_pool* pp=OBJ_PTR_FROM_FLD_PTR(nxd_http_proxy_pool, refill_timer, timer);
+  nxd_http_proxy_pool_refill(pp);
+}
+
+static const nxe_timer_class refill_timer_class={.on_timeout=refill_timer_on_timeout};
+
+// Connection queue timeouts:
+
+static void nxd_http_proxy_pool_expire_queued(nxd_http_proxy_pool* pp) {
+  nxe_time_t expire_before=pp->loop->current_time-pp->queue_timeout;
+  nxd_http_proxy_pool_waiter* w;
+  while ((w=pp->queue_head) && w->queued_time<=expire_before) {
+    pp->queue_head=w->next;
+    if (!pp->queue_head) pp->queue_tail=0;
+    pp->queued--;
+    w->next=0;
+    w->on_connection(w, 0);
+  }
+  if (pp->queue_head) nxe_set_timer_usec(pp->loop, &pp->queue_timer, pp->queue_head->queued_time-expire_before);
+  else nxe_unset_timer(pp->loop, 0, &pp->queue_timer);
+}
+
+static void queue_timer_on_timeout(nxe_timer* timer, nxe_data data) {
+  nxd_http_proxy_pool* pp=OBJ_PTR_FROM_FLD_PTR(nxd_http_proxy_pool, queue_timer, timer);
+  nxd_http_proxy_pool_expire_queued(pp);
+}
+
+static const nxe_timer_class queue_timer_class={.on_timeout=queue_timer_on_timeout};
+
+void nxd_http_proxy_pool_init(nxd_http_proxy_pool* pp, nxe_loop* loop, nxp_pool* nxb_pool, const nxd_http_proxy_pool_config* conf) {
+  const nxd_http_proxy_server_config* servers=conf->servers;
+  int num_servers=conf->num_servers;
+  pp->finalizing=0;
   pp->conn_count=
   pp->conn_count_max=0;
+  pp->response_time_p95=0;
+  pp->response_time_samples=0;
   pp->loop=loop;
   pp->nxb_pool=nxb_pool;
-  pp->host=host;
-  pp->saddr=saddr;
-  pp->first=0;
-  pp->last=0;
-  time_t *samples=pp->backend_time_delta;
+  pp->balance=conf->balance;
+  pp->next_server=0;
+  pp->num_servers=num_servers;
+  pp->servers=nx_calloc(num_servers*sizeof(nxd_http_proxy_server));
   int i;
+  for (i=0; i<num_servers; i++) {
+    nxd_http_proxy_server* srv=&pp->servers[i];
+    srv->pool=pp;
+    srv->host=servers[i].host;
+    srv->saddr=servers[i].saddr;
+    srv->shared_idle=servers[i].shared_idle;
+    srv->weight=servers[i].weight>0? servers[i].weight : 1;
+  }
+  pp->hash_ring=0;
+  pp->hash_ring_size=0;
+  if (pp->balance==NXD_BALANCE_URI_HASH && num_servers>1) nxd_http_proxy_pool_build_hash_ring(pp);
+  time_t *samples=pp->backend_time_delta;
   for (i=0; i<NXD_HTTP_PROXY_POOL_TIME_DELTA_SAMPLES; i++) {
     samples[i]=NXD_HTTP_PROXY_POOL_TIME_DELTA_NO_VALUE;
   }
   pp->free_pool=nxp_create(sizeof(nxd_http_proxy), NXD_FREE_PROXY_POOL_INITIAL_SIZE);
   nxe_init_subscriber(&pp->gc_sub, &gc_sub_class);
   nxe_subscribe(loop, &loop->gc_pub, &pp->gc_sub);
+  pp->health=conf->health;
+  nxe_init_timer(&pp->health_timer, &health_timer_class);
+  if (pp->health.check_interval>0) nxe_set_timer_usec(loop, &pp->health_timer, (nxe_time_t)pp->health.check_interval*1000);
+  pp->max_conns=conf->max_conns;
+  pp->max_queue=conf->max_queue;
+  pp->queue_timeout=conf->queue_timeout;
+  pp->queued=0;
+  pp->queue_head=0;
+  pp->queue_tail=0;
+  nxe_init_timer(&pp->queue_timer, &queue_timer_class);
+  pp->min_idle=conf->min_idle;
+  pp->max_local_idle=conf->max_local_idle<pp->min_idle? pp->min_idle : conf->max_local_idle; // don't park what refill would replace
+  nxe_init_timer(&pp->refill_timer, &refill_timer_class);
+  if (pp->min_idle>0) nxe_set_timer_usec(loop, &pp->refill_timer, 0); // warm up as soon as loop starts
 }
 
 void nxd_http_proxy_pool_report_backend_time_delta(nxd_http_proxy_pool* pp, time_t delta) {
@@ -160,49 +530,267 @@ time_t nxd_http_proxy_pool_get_backend_time_delta(nxd_http_proxy_pool* pp) {
   return avg;
 }
 
-nxd_http_proxy* nxd_http_proxy_pool_connect(nxd_http_proxy_pool* pp) {
-  if (pp->first) {
-    nxd_http_proxy* hpx=pp->first;
-    nxd_http_proxy_unlink(hpx);
-    nxe_unsubscribe(&hpx->hcp.events_pub, &hpx->events_sub);
-    pp->conn_count++;
-    if (pp->conn_count > pp->conn_count_max) pp->conn_count_max=pp->conn_count;
-    return hpx;
+static nxd_http_proxy_server* nxd_http_proxy_pool_select_server(nxd_http_proxy_pool* pp, const char* uri, nxd_http_proxy_server* exclude) {
+  int i, n=pp->num_servers;
+  if (n==1) return pp->servers!=exclude && nxd_http_proxy_server_eligible(pp->servers)? pp->servers : 0;
+  nxd_http_proxy_server* srv;
+  nxd_http_proxy_server* best=0;
+  int w, best_w=0;
+  unsigned start=pp->next_server++; // scan from different positions to spread ties
+  switch (pp->balance) {
+    case NXD_BALANCE_URI_HASH:
+      if (uri) {
+        uint32_t h=hash_murmur32((const unsigned char*)uri, strlen(uri), 0);
+        // first point clockwise from h
+        int lo=0, hi=pp->hash_ring_size;
+        while (lo<hi) {
+          int mid=(lo+hi)/2;
+          if (pp->hash_ring[mid].hash<h) lo=mid+1;
+          else hi=mid;
+        }
+        // skip points of unavailable or busy servers, so their keys spread over the rest
+        for (i=0; i<pp->hash_ring_size; i++, lo++) {
+          if (lo==pp->hash_ring_size) lo=0;
+          srv=&pp->servers[pp->hash_ring[lo].server_idx];
+          if (srv!=exclude && nxd_http_proxy_server_eligible(srv)) return srv;
+        }
+        return 0;
+      }
+      // no uri => fall back to round-robin
+      // fall through
+    case NXD_BALANCE_ROUND_ROBIN:
+    default: {
+      int total=0;
+      for (i=0; i<n; i++) {
+        srv=&pp->servers[i];
+        if (srv==exclude || !nxd_http_proxy_server_eligible(srv)) continue;
+        w=nxd_http_proxy_server_weight(srv);
+        srv->current_weight+=w;
+        total+=w;
+        if (!best || srv->current_weight>best->current_weight) best=srv;
+      }
+      if (best) best->current_weight-=total;
+      return best;
+    }
+    case NXD_BALANCE_LEAST_CONN:
+      for (i=0; i<n; i++) {
+        srv=&pp->servers[(start+i)%n];
+        if (srv==exclude || !nxd_http_proxy_server_eligible(srv)) continue;
+        w=nxd_http_proxy_server_weight(srv);
+        // (conn_count+1)/weight < best's
+        if (!best || (int64_t)(srv->conn_count+1)*best_w < (int64_t)(best->conn_count+1)*w) best=srv, best_w=w;
+      }
+      return best;
+    case NXD_BALANCE_EWMA:
+      for (i=0; i<n; i++) {
+        srv=&pp->servers[(start+i)%n];
+        if (srv==exclude || !nxd_http_proxy_server_eligible(srv)) continue;
+        w=nxd_http_proxy_server_weight(srv);
+        // (ewma+1)*(conn_count+1)/weight < best's; unmeasured servers score lowest and get probed first
+        if (!best || (int64_t)(srv->ewma_response_time+1)*(srv->conn_count+1)*best_w
+                   < (int64_t)(best->ewma_response_time+1)*(best->conn_count+1)*w) best=srv, best_w=w;
+      }
+      return best;
   }
-  else {
-    nxd_http_proxy* hpx=nxp_alloc(pp->free_pool);
+}
+
+static nxd_http_proxy* nxd_http_proxy_pool_acquire(nxd_http_proxy_pool* pp, const char* uri, nxd_http_proxy_server* exclude) {
+  nxd_http_proxy_server* srv=0;
+  nxd_http_proxy* hpx=0;
+  int attempt;
+  if (pp->finalizing) return 0;
+  for (attempt=0; attempt<pp->num_servers; attempt++) { // on immediate connect failure try next server
+    srv=nxd_http_proxy_pool_select_server(pp, uri, exclude);
+    if (!srv) return 0; // none available
+    if (srv->first) {
+      hpx=srv->first;
+      nxd_http_proxy_unlink(hpx);
+      nxe_unsubscribe(&hpx->hcp.events_pub, &hpx->events_sub);
+      if (srv->idle_count<pp->min_idle) nxd_http_proxy_pool_schedule_refill(pp);
+      break;
+    }
+    if (srv->shared_idle && (hpx=nxd_http_proxy_adopt(srv))) break;
+    hpx=nxp_alloc(pp->free_pool);
     nxd_http_proxy_init(hpx, pp->nxb_pool);
     hpx->pool=pp;
-    if (nxd_http_proxy_connect(hpx, pp->loop, pp->host, pp->saddr)) return 0;
-    pp->conn_count++;
-    if (pp->conn_count > pp->conn_count_max) pp->conn_count_max=pp->conn_count;
-    //nxweb_log_error("New conn to backend");
-    return hpx;
+    hpx->server=srv;
+    if (!nxd_http_proxy_connect(hpx, pp->loop, srv->host, srv->saddr)) break;
+    nxp_free(pp->free_pool, hpx);
+    nxd_http_proxy_server_failed(srv);
+    hpx=0;
+  }
+  if (!hpx) return 0;
+  srv->conn_count++;
+  if (srv->conn_count > srv->conn_count_max) srv->conn_count_max=srv->conn_count;
+  pp->conn_count++;
+  if (pp->conn_count > pp->conn_count_max) pp->conn_count_max=pp->conn_count;
+  hpx->request_start_time=pp->loop->current_time;
+  return hpx;
+}
+
+nxd_http_proxy* nxd_http_proxy_pool_connect(nxd_http_proxy_pool* pp, const char* uri) {
+  if (pp->queue_head) return 0; // do not overtake queued requests
+  return nxd_http_proxy_pool_acquire(pp, uri, 0);
+}
+
+nxd_http_proxy* nxd_http_proxy_pool_connect_other(nxd_http_proxy_pool* pp, const char* uri, nxd_http_proxy_server* exclude) {
+  if (pp->queue_head) return 0; // hedged request must not take connection from queued one
+  return nxd_http_proxy_pool_acquire(pp, uri, exclude);
+}
+
+// Connection queue:
+
+static void nxd_http_proxy_pool_dispatch_queued(nxd_http_proxy_pool* pp) {
+  nxd_http_proxy_pool_waiter* w;
+  nxd_http_proxy* hpx;
+  while ((w=pp->queue_head) && (hpx=nxd_http_proxy_pool_acquire(pp, w->uri, 0))) {
+    pp->queue_head=w->next;
+    if (!pp->queue_head) {
+      pp->queue_tail=0;
+      nxe_unset_timer(pp->loop, 0, &pp->queue_timer);
+    }
+    pp->queued--;
+    w->next=0;
+    w->on_connection(w, hpx);
+  }
+}
+
+int nxd_http_proxy_pool_wait(nxd_http_proxy_pool* pp, nxd_http_proxy_pool_waiter* w) {
+  if (pp->finalizing) return -1;
+  if (!pp->queue_head) {
+    // only queue if there is a live server that is just busy
+    int i, busy=0;
+    for (i=0; i<pp->num_servers; i++) {
+      nxd_http_proxy_server* srv=&pp->servers[i];
+      if (nxd_http_proxy_server_at_capacity(srv) && nxd_http_proxy_server_available(srv)) {
+        busy=1;
+        break;
+      }
+    }
+    if (!busy) return -1;
   }
+  if (pp->queued>=pp->max_queue) return 1;
+  w->queued_time=pp->loop->current_time;
+  w->next=0;
+  if (pp->queue_tail) pp->queue_tail->next=w;
+  else {
+    pp->queue_head=w;
+    if (pp->queue_timeout) nxe_set_timer_usec(pp->loop, &pp->queue_timer, pp->queue_timeout);
+  }
+  pp->queue_tail=w;
+  pp->queued++;
+  return 0;
+}
+
+void nxd_http_proxy_pool_cancel_wait(nxd_http_proxy_pool* pp, nxd_http_proxy_pool_waiter* w) {
+  nxd_http_proxy_pool_waiter* prev=0;
+  nxd_http_proxy_pool_waiter* q;
+  for (q=pp->queue_head; q; prev=q, q=q->next) {
+    if (q==w) {
+      if (prev) prev->next=w->next;
+      else pp->queue_head=w->next;
+      if (pp->queue_tail==w) pp->queue_tail=prev;
+      pp->queued--;
+      w->next=0;
+      if (!pp->queue_head) nxe_unset_timer(pp->loop, 0, &pp->queue_timer);
+      return;
+    }
+  }
+}
+
+static void nxd_http_proxy_pool_track_p95(nxd_http_proxy_pool* pp, nxe_time_t t) {
+  // stochastic quantile estimate: step up 19 times bigger than step down => 5% of samples stay above
+  nxe_time_t step=pp->response_time_p95/32+1;
+  if (t>pp->response_time_p95) pp->response_time_p95+=step*19;
+  else if (pp->response_time_p95>step) pp->response_time_p95-=step;
+  if (pp->response_time_samples<NXD_HTTP_PROXY_P95_MIN_SAMPLES) pp->response_time_samples++;
+}
+
+nxe_time_t nxd_http_proxy_pool_get_response_time_p95(nxd_http_proxy_pool* pp) {
+  return pp->response_time_samples<NXD_HTTP_PROXY_P95_MIN_SAMPLES? 0 : pp->response_time_p95;
+}
+
+void nxd_http_proxy_pool_report_cancelled(nxd_http_proxy* hpx) {
+  // request lost the race to its hedge; time spent so far is a lower bound of its response time
+  nxe_time_t t=hpx->pool->loop->current_time-hpx->request_start_time;
+  nxd_http_proxy_pool_track_p95(hpx->pool, t>0? t : 0);
+}
+
+void nxd_http_proxy_pool_report_response(nxd_http_proxy* hpx) {
+  nxd_http_proxy_server* srv=hpx->server;
+  nxe_time_t current_time=hpx->pool->loop->current_time;
+  nxe_time_t t=current_time>hpx->request_start_time? current_time-hpx->request_start_time : 0;
+  srv->ewma_response_time=srv->ewma_response_time? (srv->ewma_response_time*7+t)/8 : t;
+  nxd_http_proxy_pool_track_p95(hpx->pool, t);
+  // late responses from before ejection do not re-admit server; only trial requests and probes do
+  if (srv->state!=NXD_SERVER_DOWN) nxd_http_proxy_server_up(srv);
+}
+
+void nxd_http_proxy_pool_report_failure(nxd_http_proxy* hpx) {
+  nxd_http_proxy_server_failed(hpx->server);
+}
+
+static void nxd_http_proxy_pool_release(nxd_http_proxy_pool* pp) {
+  nxp_destroy(pp->free_pool);
+  if (pp->hash_ring) nx_free(pp->hash_ring);
+  nx_free(pp->servers);
+  pp->hash_ring=0;
+  pp->servers=0;
 }
 
 void nxd_http_proxy_pool_return(nxd_http_proxy* hpx, int closed) {
   nxd_http_proxy_pool* pp=hpx->pool;
   pp->conn_count--;
+  hpx->server->conn_count--;
+  if (pp->finalizing) {
+    // pool has been finalized while this connection was checked out
+    nxd_http_proxy_finalize(hpx, 0);
+    nxp_free(pp->free_pool, hpx);
+    if (!pp->conn_count) nxd_http_proxy_pool_release(pp);
+    return;
+  }
   if (closed || !hpx->hcp.request_complete || hpx->hcp.state!=HCP_IDLE || !hpx->hcp.resp.keep_alive) {
     nxd_http_proxy_finalize(hpx, 0);
     nxp_free(pp->free_pool, hpx);
   }
+  else if (hpx->server->shared_idle && hpx->server->idle_count>=pp->max_local_idle && !pp->queue_head) {
+    nxd_http_proxy_park(hpx);
+    nxp_free(pp->free_pool, hpx);
+  }
   else {
     nxd_http_client_proto_rearm(&hpx->hcp); // disconnect & unsubscribe & free resources
+    hpx->connected=1; // completed request => connection is established
     nxe_init_subscriber(&hpx->events_sub, &nxd_http_proxy_events_sub_class);
     nxe_subscribe(pp->loop, &hpx->hcp.events_pub, &hpx->events_sub);
-    nxd_http_proxy_link(hpx, pp);
+    nxd_http_proxy_link(hpx, hpx->server);
   }
+  if (pp->queue_head) nxd_http_proxy_pool_dispatch_queued(pp);
 }
 
 void nxd_http_proxy_pool_finalize(nxd_http_proxy_pool* pp) {
-  if (!pp || !pp->saddr) return; // not initialized
+  if (!pp || !pp->servers || pp->finalizing) return; // not initialized or already finalized
   //nxweb_log_error("proxy_pool conn=%d max=%d", pp->conn_count, pp->conn_count_max);
   nxd_http_proxy* hpx;
-  while ((hpx=pp->first)) {
-    nxd_http_proxy_finalize(hpx, 0);
+  int i;
+  nxe_unset_timer(pp->loop, 0, &pp->health_timer);
+  nxe_unset_timer(pp->loop, 0, &pp->queue_timer);
+  nxe_unset_timer(pp->loop, 0, &pp->refill_timer);
+  nxd_http_proxy_pool_waiter* w;
+  while ((w=pp->queue_head)) {
+    pp->queue_head=w->next;
+    pp->queued--;
+    w->next=0;
+    w->on_connection(w, 0);
+  }
+  pp->queue_tail=0;
+  for (i=0; i<pp->num_servers; i++) {
+    while ((hpx=pp->servers[i].first)) {
+      nxd_http_proxy_finalize(hpx, 0);
+    }
+    if (pp->servers[i].probe) nxd_http_proxy_server_close_probe(&pp->servers[i]);
   }
   nxe_unsubscribe(&pp->loop->gc_pub, &pp->gc_sub);
-  nxp_destroy(pp->free_pool);
+  pp->finalizing=1; // no more connections given out
+  // requests in flight still hold connections; free servers & hpx pool when the last one is returned
+  if (!pp->conn_count) nxd_http_proxy_pool_release(pp);
 }
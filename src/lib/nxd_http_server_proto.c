@@ -37,7 +37,9 @@ void _nxweb_call_request_finalizers(nxd_http_server_proto* hsp) {
 
   nxweb_http_server_connection_finalize_subrequests(conn, 0);
 
-  nxweb_http_request* req=&hsp->req;
+  if (!hsp->rq) return; // idle connection
+
+  nxweb_http_request* req=&hsp->rq->req;
   nxweb_http_response* resp=hsp->resp;
 
   if (resp && resp->content_out && resp->content_out->pair) {
@@ -55,7 +57,7 @@ void _nxweb_call_request_finalizers(nxd_http_server_proto* hsp) {
     hsp->req_finalize=0; // call no more
     hsp->req_data=0;
   }
-  nxweb_http_request_data* rdata=hsp->req.data_chain;
+  nxweb_http_request_data* rdata=req->data_chain;
   while (rdata) {
     if (rdata->finalize) {
       rdata->finalize(conn, req, resp, rdata->value);
@@ -86,6 +88,8 @@ void _nxweb_call_request_finalizers(nxd_http_server_proto* hsp) {
   conn->handler_param=(nxe_data)0;
 }
 
+static void parse_request_headers(nxe_loop* loop, nxd_http_server_proto* hsp);
+
 static void request_cleanup(nxe_loop* loop, nxd_http_server_proto* hsp) {
 
   nxweb_log_debug("request_cleanup");
@@ -94,18 +98,30 @@ static void request_cleanup(nxe_loop* loop, nxd_http_server_proto* hsp) {
   //  - release per-request resources
   //  - initialize variables
   _nxweb_call_request_finalizers(hsp);
-  nxd_fbuffer_finalize(&hsp->fb);
+  nxd_fbuffer_finalize(&hsp->rq->fb);
   if (hsp->resp && hsp->resp->sendfile_fd) {
     close(hsp->resp->sendfile_fd);
   }
-  nxb_empty(hsp->nxb);
-  nxp_free(hsp->nxb_pool, hsp->nxb);
+  _Bool keep_alive=hsp->resp && hsp->resp->keep_alive;
+  _Bool pipelined=hsp->pipelined_data && keep_alive;
+  nxb_buffer* prev_nxb=hsp->nxb;
   hsp->nxb=0;
+  _nxd_http_server_proto_free_request(hsp);
+  hsp->resp=0;
 
   hsp->request_count++;
   hsp->state=HSP_WAITING_FOR_REQUEST;
   hsp->headers_bytes_received=0;
-  if (hsp->resp && hsp->resp->keep_alive) {
+  if (pipelined) {
+    // carry over pipelined bytes into next request's buffer
+    _nxd_http_server_proto_alloc_request(hsp);
+    nxb_make_room(hsp->nxb, NXWEB_MAX_REQUEST_HEADERS_SIZE);
+    nxb_append(hsp->nxb, hsp->pipelined_data, hsp->pipelined_data_end-hsp->pipelined_data);
+    hsp->state=HSP_RECEIVING_HEADERS;
+    nxe_ostream_set_ready(loop, &hsp->data_in);
+    nxe_set_timer(loop, NXWEB_TIMER_READ, &hsp->timer_read);
+  }
+  else if (keep_alive) {
     nxe_ostream_set_ready(loop, &hsp->data_in);
     nxe_set_timer(loop, NXWEB_TIMER_KEEP_ALIVE, &hsp->timer_keep_alive);
   }
@@ -114,9 +130,12 @@ static void request_cleanup(nxe_loop* loop, nxd_http_server_proto* hsp) {
     if (os && OSTREAM_CLASS(os)->shutdown) OSTREAM_CLASS(os)->shutdown(os);
     nxe_set_timer(loop, NXWEB_TIMER_KEEP_ALIVE, &hsp->timer_keep_alive); // do not rely on other end properly reacting to shutdown
   }
-  memset(&hsp->req, 0, sizeof(nxweb_http_request));
-  memset(&hsp->_resp, 0, sizeof(nxweb_http_response));
-  hsp->resp=0;
+  hsp->pipelined_data=0;
+  hsp->pipelined_data_end=0;
+  nxb_empty(prev_nxb);
+  nxp_free(hsp->nxb_pool, prev_nxb);
+
+  if (pipelined) parse_request_headers(loop, hsp); // next request might be complete already
 }
 
 static void request_complete(nxe_loop* loop, nxd_http_server_proto* hsp) {
@@ -130,6 +149,76 @@ static void request_complete(nxe_loop* loop, nxd_http_server_proto* hsp) {
   nxe_publish(&hsp->events_pub, (nxe_data)NXD_HSP_REQUEST_COMPLETE);
 }
 
+static void parse_request_headers(nxe_loop* loop, nxd_http_server_proto* hsp) {
+  nxe_ostream* os=&hsp->data_in;
+  int read_buf_size;
+  char* read_buf=nxb_get_unfinished(hsp->nxb, &read_buf_size);
+  hsp->headers_bytes_received=read_buf_size;
+  char* end_of_headers;
+  char* start_of_body;
+  if ((end_of_headers=_nxweb_find_end_of_http_headers(read_buf, read_buf_size, &start_of_body))) {
+    nxb_finish_stream(hsp->nxb, 0);
+    hsp->rq->req.nxb=hsp->nxb;
+    hsp->rq->req.uid=nxweb_generate_unique_id();
+    if (_nxweb_parse_http_request(&hsp->rq->req, read_buf, end_of_headers)) {
+      // bad request
+      nxe_unset_timer(loop, NXWEB_TIMER_READ, &hsp->timer_read);
+      nxe_ostream_unset_ready(os);
+      nxweb_http_response* resp=_nxweb_http_response_init(&hsp->rq->_resp, hsp->nxb, 0);
+      nxweb_send_http_error(resp, 400, "Bad Request");
+      resp->keep_alive=0; // close connection
+      hsp->cls->start_sending_response(hsp, resp);
+      return;
+    }
+    char* read_buf_end=read_buf+read_buf_size;
+    if (start_of_body<read_buf_end && hsp->rq->req.content_length>=0) {
+      // split what follows headers into body of this request and pipelined requests;
+      // chunked body end is not known in advance so it takes all
+      char* end_of_body=hsp->rq->req.content_length<read_buf_end-start_of_body? start_of_body+hsp->rq->req.content_length : read_buf_end;
+      if (end_of_body<read_buf_end) {
+        hsp->pipelined_data=end_of_body;
+        hsp->pipelined_data_end=read_buf_end;
+      }
+      read_buf_end=end_of_body;
+    }
+    if (start_of_body<read_buf_end) {
+      hsp->first_body_chunk=start_of_body;
+      hsp->first_body_chunk_end=read_buf_end;
+    }
+    else {
+      hsp->first_body_chunk=0;
+      hsp->first_body_chunk_end=0;
+      if (hsp->rq->req.expect_100_continue) {
+        hsp->rq->req.sending_100_continue=1;
+        hsp->resp_headers_ptr=response_100_continue;
+        nxe_istream_set_ready(loop, &hsp->data_out);
+      }
+    }
+    nxe_ostream_unset_ready(os);
+    hsp->resp=_nxweb_http_response_init(&hsp->rq->_resp, hsp->nxb, &hsp->rq->req);
+    nxe_publish(&hsp->events_pub, (nxe_data)NXD_HSP_REQUEST_RECEIVED);
+    if (hsp->rq->req.content_length) { // is body expected?
+      hsp->state=HSP_RECEIVING_BODY;
+      nxe_istream_set_ready(loop, &hsp->req_body_out);
+    }
+    else {
+      nxe_unset_timer(loop, NXWEB_TIMER_READ, &hsp->timer_read);
+      hsp->state=HSP_HANDLING;
+    }
+  }
+  else {
+    if (read_buf_size>=NXWEB_MAX_REQUEST_HEADERS_SIZE) {
+      // bad request (too large)
+      nxe_unset_timer(loop, NXWEB_TIMER_READ, &hsp->timer_read);
+      nxe_ostream_unset_ready(os);
+      nxweb_http_response* resp=_nxweb_http_response_init(&hsp->rq->_resp, hsp->nxb, 0);
+      nxweb_send_http_error(resp, 400, "Bad Request");
+      resp->keep_alive=0; // close connection
+      hsp->cls->start_sending_response(hsp, resp);
+    }
+  }
+}
+
 static void data_in_do_read(nxe_ostream* os, nxe_istream* is) {
   nxd_http_server_proto* hsp=(nxd_http_server_proto*)((char*)os-offsetof(nxd_http_server_proto, data_in));
   nxe_loop* loop=os->super.loop;
@@ -137,8 +226,7 @@ static void data_in_do_read(nxe_ostream* os, nxe_istream* is) {
   nxweb_log_debug("data_in_do_read");
 
   if (hsp->state==HSP_WAITING_FOR_REQUEST) {
-    hsp->nxb=nxp_alloc(hsp->nxb_pool);
-    nxb_init(hsp->nxb, NXWEB_CONN_NXB_SIZE);
+    _nxd_http_server_proto_alloc_request(hsp);
     nxb_make_room(hsp->nxb, NXWEB_MAX_REQUEST_HEADERS_SIZE);
     nxe_unset_timer(loop, NXWEB_TIMER_KEEP_ALIVE, &hsp->timer_keep_alive);
     nxe_set_timer(loop, NXWEB_TIMER_READ, &hsp->timer_read);
@@ -152,62 +240,7 @@ static void data_in_do_read(nxe_ostream* os, nxe_istream* is) {
     int bytes_received=ISTREAM_CLASS(is)->read(is, os, ptr, size, &flags);
     if (bytes_received) {
       nxb_blank_fast(hsp->nxb, bytes_received);
-      int read_buf_size;
-      char* read_buf=nxb_get_unfinished(hsp->nxb, &read_buf_size);
-      hsp->headers_bytes_received=read_buf_size;
-      char* end_of_headers;
-      char* start_of_body;
-      if ((end_of_headers=_nxweb_find_end_of_http_headers(read_buf, read_buf_size, &start_of_body))) {
-        nxb_finish_stream(hsp->nxb, 0);
-        hsp->req.nxb=hsp->nxb;
-        hsp->req.uid=nxweb_generate_unique_id();
-        if (_nxweb_parse_http_request(&hsp->req, read_buf, end_of_headers)) {
-          // bad request
-          nxe_unset_timer(loop, NXWEB_TIMER_READ, &hsp->timer_read);
-          nxe_ostream_unset_ready(os);
-          nxweb_http_response* resp=_nxweb_http_response_init(&hsp->_resp, hsp->nxb, 0);
-          nxweb_send_http_error(resp, 400, "Bad Request");
-          resp->keep_alive=0; // close connection
-          hsp->cls->start_sending_response(hsp, resp);
-          return;
-        }
-        char* read_buf_end=read_buf+read_buf_size;
-        if (start_of_body<read_buf_end) {
-          hsp->first_body_chunk=start_of_body;
-          hsp->first_body_chunk_end=read_buf_end;
-        }
-        else {
-          hsp->first_body_chunk=0;
-          hsp->first_body_chunk_end=0;
-          if (hsp->req.expect_100_continue) {
-            hsp->req.sending_100_continue=1;
-            hsp->resp_headers_ptr=response_100_continue;
-            nxe_istream_set_ready(loop, &hsp->data_out);
-          }
-        }
-        nxe_ostream_unset_ready(os);
-        hsp->resp=_nxweb_http_response_init(&hsp->_resp, hsp->nxb, &hsp->req);
-        nxe_publish(&hsp->events_pub, (nxe_data)NXD_HSP_REQUEST_RECEIVED);
-        if (hsp->req.content_length) { // is body expected?
-          hsp->state=HSP_RECEIVING_BODY;
-          nxe_istream_set_ready(loop, &hsp->req_body_out);
-        }
-        else {
-          nxe_unset_timer(loop, NXWEB_TIMER_READ, &hsp->timer_read);
-          hsp->state=HSP_HANDLING;
-        }
-      }
-      else {
-        if (read_buf_size>=NXWEB_MAX_REQUEST_HEADERS_SIZE) {
-          // bad request (too large)
-          nxe_unset_timer(loop, NXWEB_TIMER_READ, &hsp->timer_read);
-          nxe_ostream_unset_ready(os);
-          nxweb_http_response* resp=_nxweb_http_response_init(&hsp->_resp, hsp->nxb, 0);
-          nxweb_send_http_error(resp, 400, "Bad Request");
-          resp->keep_alive=0; // close connection
-          hsp->cls->start_sending_response(hsp, resp);
-        }
-      }
+      parse_request_headers(loop, hsp);
     }
   }
   else if (hsp->state==HSP_RECEIVING_BODY) {
@@ -232,14 +265,14 @@ static void data_out_do_write(nxe_istream* is, nxe_ostream* os) {
 
   nxweb_log_debug("data_out_do_write");
 
-  if (hsp->req.sending_100_continue) {
+  if (hsp->rq->req.sending_100_continue) {
     if (hsp->resp_headers_ptr && *hsp->resp_headers_ptr) {
       int size=strlen(hsp->resp_headers_ptr);
       nxe_flags_t flags=NXEF_EOF;
       nxe_ssize_t bytes_sent=OSTREAM_CLASS(os)->write(os, is, 0, 0, (nxe_data)hsp->resp_headers_ptr, size, &flags);
       hsp->resp_headers_ptr+=bytes_sent;
       if (bytes_sent==size) {
-        hsp->req.sending_100_continue=0;
+        hsp->rq->req.sending_100_continue=0;
         if (hsp->state==HSP_SENDING_HEADERS) hsp->resp_headers_ptr=hsp->resp->raw_headers;
         else {
           nxe_istream_unset_ready(is);
@@ -252,12 +285,18 @@ static void data_out_do_write(nxe_istream* is, nxe_ostream* os) {
     }
   }
 
-  nxe_unset_timer(loop, NXWEB_TIMER_WRITE, &hsp->timer_write);
   //nxweb_log_error("conn hsp=%p write timer restarted", hsp);
-  nxe_set_timer(loop, NXWEB_TIMER_WRITE, &hsp->timer_write);
+  nxe_set_timer(loop, NXWEB_TIMER_WRITE, &hsp->timer_write); // rearming is cheap (lazy)
 
   if (hsp->state==HSP_SENDING_HEADERS) {
-    if (hsp->resp_headers_ptr && *hsp->resp_headers_ptr) {
+    if (hsp->resp_headers_ptr && *hsp->resp_headers_ptr && OSTREAM_CLASS(os)->write_prefixed
+        && hsp->resp->content_length && !hsp->rq->req.head_method && !hsp->resp->chunked_autoencode
+        && hsp->resp_body_in.pair && hsp->resp_body_in.pair->ready) {
+      // body is ready => keep headers pending; resp_body_in_write_or_sendfile() sends them
+      // together with first body segment in single syscall
+      hsp->state=HSP_SENDING_BODY;
+    }
+    else if (hsp->resp_headers_ptr && *hsp->resp_headers_ptr) {
       int size=strlen(hsp->resp_headers_ptr);
       nxe_flags_t flags=NXEF_EOF;
       nxe_ssize_t bytes_sent=OSTREAM_CLASS(os)->write(os, is, 0, 0, (nxe_data)hsp->resp_headers_ptr, size, &flags);
@@ -265,11 +304,16 @@ static void data_out_do_write(nxe_istream* is, nxe_ostream* os) {
       if (bytes_sent<size) return;
       hsp->resp_headers_ptr=0;
     }
-    if (!hsp->resp->content_length || hsp->req.head_method) {
-      request_complete(loop, hsp);
-      return;
+    else {
+      hsp->resp_headers_ptr=0;
+    }
+    if (hsp->state==HSP_SENDING_HEADERS) {
+      if (!hsp->resp->content_length || hsp->rq->req.head_method) {
+        request_complete(loop, hsp);
+        return;
+      }
+      hsp->state=HSP_SENDING_BODY;
     }
-    hsp->state=HSP_SENDING_BODY;
   }
 
   if (hsp->state==HSP_SENDING_BODY) {
@@ -297,8 +341,9 @@ static void data_out_do_write(nxe_istream* is, nxe_ostream* os) {
 }
 
 static inline int is_request_body_complete(nxd_http_server_proto* hsp) {
-  return (hsp->req.content_length > 0 && hsp->req.content_received >= hsp->req.content_length)
-          || (hsp->req.chunked_content_complete);
+  nxweb_http_request* req=&hsp->rq->req;
+  return (req->content_length > 0 && req->content_received >= req->content_length)
+          || (req->chunked_content_complete);
 }
 
 static nxe_size_t req_body_out_read(nxe_istream* is, nxe_ostream* os, void* ptr, nxe_size_t size, nxe_flags_t* flags) {
@@ -336,12 +381,12 @@ static nxe_size_t req_body_out_read(nxe_istream* is, nxe_ostream* os, void* ptr,
       memcpy(ptr, hsp->first_body_chunk, size);
       hsp->first_body_chunk+=size;
     }
-    if (hsp->req.chunked_encoding) {
-      int r=_nxweb_decode_chunked_stream(&hsp->req.cdstate, ptr, &bytes_received);
+    if (hsp->rq->req.chunked_encoding) {
+      int r=_nxweb_decode_chunked_stream(&hsp->rq->req.cdstate, ptr, &bytes_received);
       if (r<0) nxe_publish(&hsp->events_pub, (nxe_data)NXD_HSP_REQUEST_CHUNKED_ENCODING_ERROR);
-      else if (r>0) hsp->req.chunked_content_complete=1;
+      else if (r>0) hsp->rq->req.chunked_content_complete=1;
     }
-    hsp->req.content_received+=bytes_received;
+    hsp->rq->req.content_received+=bytes_received;
     if (is_request_body_complete(hsp)) {
       nxe_publish(&hsp->events_pub, (nxe_data)NXD_HSP_REQUEST_BODY_RECEIVED);
       hsp->state=HSP_HANDLING;
@@ -353,6 +398,9 @@ static nxe_size_t req_body_out_read(nxe_istream* is, nxe_ostream* os, void* ptr,
     ptr+=bytes_received;
     size-=bytes_received;
   }
+  if (hsp->rq->req.content_length>0 && size>hsp->rq->req.content_length-hsp->rq->req.content_received) {
+    size=hsp->rq->req.content_length-hsp->rq->req.content_received; // do not read into pipelined request
+  }
   if (size>0) {
     nxe_istream* prev_is=hsp->data_in.pair;
     if (prev_is) {
@@ -363,12 +411,12 @@ static nxe_size_t req_body_out_read(nxe_istream* is, nxe_ostream* os, void* ptr,
         nxe_istream_unset_ready(is);
         nxe_ostream_set_ready(loop, &hsp->data_in); // get notified when prev_is becomes ready again
       }
-      if (hsp->req.chunked_encoding) {
-        int r=_nxweb_decode_chunked_stream(&hsp->req.cdstate, ptr, &bytes_received2);
+      if (hsp->rq->req.chunked_encoding) {
+        int r=_nxweb_decode_chunked_stream(&hsp->rq->req.cdstate, ptr, &bytes_received2);
         if (r<0) nxe_publish(&hsp->events_pub, (nxe_data)NXD_HSP_REQUEST_CHUNKED_ENCODING_ERROR);
-        else if (r>0) hsp->req.chunked_content_complete=1;
+        else if (r>0) hsp->rq->req.chunked_content_complete=1;
       }
-      hsp->req.content_received+=bytes_received2;
+      hsp->rq->req.content_received+=bytes_received2;
       bytes_received+=bytes_received2;
       if (is_request_body_complete(hsp)) {
         nxe_publish(&hsp->events_pub, (nxe_data)NXD_HSP_REQUEST_BODY_RECEIVED);
@@ -389,6 +437,77 @@ static nxe_size_t req_body_out_read(nxe_istream* is, nxe_ostream* os, void* ptr,
   return bytes_received;
 }
 
+static nxe_ssize_t req_body_out_splice(nxe_istream* is, nxe_ostream* os, int pipe_fd, nxe_size_t size, nxe_flags_t* flags) {
+  nxd_http_server_proto* hsp=(nxd_http_server_proto*)((char*)is-offsetof(nxd_http_server_proto, req_body_out));
+  nxe_loop* loop=is->super.loop;
+  nxweb_http_request* req=&hsp->rq->req;
+
+  nxweb_log_debug("req_body_out_splice");
+
+  if (hsp->state==HSP_HANDLING) {
+    nxweb_log_error("hsp->state==HSP_HANDLING - req_body_out_splice() should not be called");
+    *flags|=NXEF_EOF;
+    nxe_istream_unset_ready(is);
+    return 0;
+  }
+
+  if (hsp->state!=HSP_RECEIVING_BODY) {
+    nxe_istream_unset_ready(is);
+    nxe_ostream_set_ready(loop, &hsp->data_in); // get notified when prev_is ready
+    return 0;
+  }
+
+  assert(!req->chunked_encoding && req->content_length>0);
+
+  nxe_unset_timer(loop, NXWEB_TIMER_READ, &hsp->timer_read);
+
+  nxe_ssize_t bytes_received=0;
+  if (hsp->first_body_chunk) {
+    // part of body that came in with headers is already in memory; push it into the pipe
+    nxe_size_t first_body_chunk_size=hsp->first_body_chunk_end-hsp->first_body_chunk;
+    bytes_received=write(pipe_fd, hsp->first_body_chunk, first_body_chunk_size<=size? first_body_chunk_size : size);
+    if (bytes_received<=0) bytes_received=0;
+    hsp->first_body_chunk+=bytes_received;
+    if (hsp->first_body_chunk>=hsp->first_body_chunk_end) {
+      hsp->first_body_chunk=0;
+      hsp->first_body_chunk_end=0;
+    }
+    req->content_received+=bytes_received;
+    size-=bytes_received;
+  }
+  if (size>req->content_length-req->content_received) {
+    size=req->content_length-req->content_received; // do not read into pipelined request
+  }
+  if (size>0 && !hsp->first_body_chunk) {
+    nxe_istream* prev_is=hsp->data_in.pair;
+    if (prev_is) {
+      nxe_ssize_t bytes_received2=0;
+      nxe_flags_t rflags=0;
+      if (prev_is->ready) bytes_received2=ISTREAM_CLASS(prev_is)->splice(prev_is, &hsp->data_in, pipe_fd, size, &rflags);
+      if (!prev_is->ready) {
+        nxe_istream_unset_ready(is);
+        nxe_ostream_set_ready(loop, &hsp->data_in); // get notified when prev_is becomes ready again
+      }
+      req->content_received+=bytes_received2;
+      bytes_received+=bytes_received2;
+    }
+    else {
+      nxweb_log_error("no connected device for hsp->data_in");
+      nxe_istream_unset_ready(is);
+    }
+  }
+  if (is_request_body_complete(hsp)) {
+    nxe_publish(&hsp->events_pub, (nxe_data)NXD_HSP_REQUEST_BODY_RECEIVED);
+    hsp->state=HSP_HANDLING;
+    nxe_ostream_unset_ready(&hsp->data_in);
+    nxe_istream_unset_ready(is);
+    *flags|=NXEF_EOF;
+    return bytes_received;
+  }
+  nxe_set_timer(loop, NXWEB_TIMER_READ, &hsp->timer_read);
+  return bytes_received;
+}
+
 static nxe_ssize_t resp_body_in_write_or_sendfile(nxe_ostream* os, nxe_istream* is, int fd, nx_file_reader* fr, nxe_data ptr, nxe_size_t size, nxe_flags_t* flags) {
   nxd_http_server_proto* hsp=(nxd_http_server_proto*)((char*)os-offsetof(nxd_http_server_proto, resp_body_in));
   nxe_loop* loop=os->super.loop;
@@ -400,9 +519,8 @@ static nxe_ssize_t resp_body_in_write_or_sendfile(nxe_ostream* os, nxe_istream*
     nxe_istream_set_ready(loop, &hsp->data_out); // get notified when next_os is ready
     return 0;
   }
-  nxe_unset_timer(loop, NXWEB_TIMER_WRITE, &hsp->timer_write);
   nxe_ssize_t bytes_sent=0;
-  if (size || hsp->resp->chunked_autoencode) {
+  if (size || hsp->resp->chunked_autoencode || hsp->resp_headers_ptr) {
     nxe_ostream* next_os=hsp->data_out.pair;
     if (next_os) {
       nxe_flags_t wflags=*flags;
@@ -414,12 +532,14 @@ static nxe_ssize_t resp_body_in_write_or_sendfile(nxe_ostream* os, nxe_istream*
           nxe_size_t send_size;
           nxe_flags_t cwf=*flags;
           if (_nxweb_encode_chunked_stream(&hsp->resp->cestate, &chunk_size, &send_ptr, &send_size, &cwf)) {
-            nxe_ssize_t cbs=OSTREAM_CLASS(next_os)->write(next_os, &hsp->data_out, 0, 0, (nxe_data)send_ptr, send_size, &cwf);
+            nxe_flags_t mf=chunk_size? cwf|NXEF_MORE : cwf; // chunk data follows
+            nxe_ssize_t cbs=OSTREAM_CLASS(next_os)->write(next_os, &hsp->data_out, 0, 0, (nxe_data)send_ptr, send_size, &mf);
             _nxweb_encode_chunked_advance(&hsp->resp->cestate, cbs);
             if (cbs!=send_size) skip=1;
           }
           if (!skip && chunk_size) {
-            bytes_sent=OSTREAM_CLASS(next_os)->write(next_os, &hsp->data_out, fd, fr, ptr, chunk_size, &cwf);
+            nxe_flags_t mf=cwf|NXEF_MORE; // chunk trailer follows
+            bytes_sent=OSTREAM_CLASS(next_os)->write(next_os, &hsp->data_out, fd, fr, ptr, chunk_size, &mf);
             _nxweb_encode_chunked_advance(&hsp->resp->cestate, bytes_sent);
             if (bytes_sent!=chunk_size) skip=1;
           }
@@ -435,6 +555,18 @@ static nxe_ssize_t resp_body_in_write_or_sendfile(nxe_ostream* os, nxe_istream*
             }
           }
         }
+        else if (hsp->resp_headers_ptr) { // headers still pending => gather them with body
+          nxe_size_t hsize=strlen(hsp->resp_headers_ptr);
+          bytes_sent=OSTREAM_CLASS(next_os)->write_prefixed(next_os, &hsp->data_out, hsp->resp_headers_ptr, hsize, fd, fr, ptr, size, &wflags);
+          if (bytes_sent<hsize) {
+            hsp->resp_headers_ptr+=bytes_sent;
+            bytes_sent=0;
+          }
+          else {
+            hsp->resp_headers_ptr=0;
+            bytes_sent-=hsize;
+          }
+        }
         else {
           bytes_sent=OSTREAM_CLASS(next_os)->write(next_os, &hsp->data_out, fd, fr, ptr, size, &wflags);
         }
@@ -450,7 +582,7 @@ static nxe_ssize_t resp_body_in_write_or_sendfile(nxe_ostream* os, nxe_istream*
     }
   }
   hsp->resp->bytes_sent+=bytes_sent;
-  if (*flags&NXEF_EOF && bytes_sent==size && (!hsp->resp->chunked_autoencode || _nxweb_encode_chunked_is_complete(&hsp->resp->cestate))) {
+  if (*flags&NXEF_EOF && bytes_sent==size && !hsp->resp_headers_ptr && (!hsp->resp->chunked_autoencode || _nxweb_encode_chunked_is_complete(&hsp->resp->cestate))) {
     // end of response => rearm connection
     request_complete(loop, hsp);
     return bytes_sent;
@@ -470,7 +602,7 @@ static void data_error_on_message(nxe_subscriber* sub, nxe_publisher* pub, nxe_d
     // SSL protocol error (http connection attempted on SSL port?) => bad request
     nxe_unset_timer(loop, NXWEB_TIMER_READ, &hsp->timer_read);
     nxe_ostream_unset_ready(&hsp->data_in);
-    nxweb_http_response* resp=_nxweb_http_response_init(&hsp->_resp, hsp->nxb, 0);
+    nxweb_http_response* resp=_nxweb_http_response_init(&hsp->rq->_resp, hsp->nxb, 0);
     nxweb_send_http_error(resp, 400, "Bad Request");
     nxd_http_server_proto_start_sending_response(hsp, resp);
     return;
@@ -503,7 +635,7 @@ static void timer_write_on_timeout(nxe_timer* timer, nxe_data data) {
 static const nxe_ostream_class data_in_class={.do_read=data_in_do_read};
 static const nxe_istream_class data_out_class={.do_write=data_out_do_write};
 static const nxe_subscriber_class data_error_class={.on_message=data_error_on_message};
-static const nxe_istream_class req_body_out_class={.read=req_body_out_read};
+static const nxe_istream_class req_body_out_class={.read=req_body_out_read, .splice=req_body_out_splice};
 static const nxe_ostream_class resp_body_in_class={.write=resp_body_in_write_or_sendfile};
 static const nxe_timer_class timer_keep_alive_class={.on_timeout=timer_keep_alive_on_timeout};
 static const nxe_timer_class timer_read_class={.on_timeout=timer_read_on_timeout};
@@ -521,11 +653,27 @@ void nxd_http_server_proto_finalize(nxd_http_server_proto* hsp) {
   if (hsp->data_out.pair) nxe_disconnect_streams(&hsp->data_out, hsp->data_out.pair);
   if (hsp->resp_body_in.pair) nxe_disconnect_streams(hsp->resp_body_in.pair, &hsp->resp_body_in);
   if (hsp->req_body_out.pair) nxe_disconnect_streams(&hsp->req_body_out, hsp->req_body_out.pair);
-  nxd_fbuffer_finalize(&hsp->fb);
+  if (hsp->rq) nxd_fbuffer_finalize(&hsp->rq->fb);
   if (hsp->resp && hsp->resp->sendfile_fd) close(hsp->resp->sendfile_fd);
+  _nxd_http_server_proto_free_request(hsp);
+}
+
+void _nxd_http_server_proto_alloc_request(nxd_http_server_proto* hsp) {
+  hsp->nxb=nxp_alloc(hsp->nxb_pool);
+  nxb_init(hsp->nxb, NXWEB_CONN_NXB_SIZE);
+  hsp->rq=nxp_alloc(hsp->rq_pool);
+  memset(hsp->rq, 0, sizeof(nxd_http_server_proto_request));
+}
+
+void _nxd_http_server_proto_free_request(nxd_http_server_proto* hsp) {
   if (hsp->nxb) {
     nxb_empty(hsp->nxb);
     nxp_free(hsp->nxb_pool, hsp->nxb);
+    hsp->nxb=0;
+  }
+  if (hsp->rq) {
+    nxp_free(hsp->rq_pool, hsp->rq);
+    hsp->rq=0;
   }
 }
 
@@ -552,22 +700,22 @@ void nxd_http_server_proto_setup_content_out(nxd_http_server_proto* hsp, nxweb_h
   nxd_http_server_proto_finish_response(resp);
 
   if (resp->content && resp->content_length>0) {
-    nxd_obuffer_init(&hsp->ob, resp->content, resp->content_length);
-    resp->content_out=&hsp->ob.data_out;
+    nxd_obuffer_init(&hsp->rq->ob, resp->content, resp->content_length);
+    resp->content_out=&hsp->rq->ob.data_out;
   }
   else if (resp->sendfile_fd && resp->content_length>0) {
     assert(resp->sendfile_end - resp->sendfile_offset == resp->content_length);
-    assert(!hsp->fb.fd); // must not setup fbuffer twice
-    nxd_fbuffer_init(&hsp->fb, resp->sendfile_fd, resp->sendfile_offset, resp->sendfile_end);
-    resp->content_out=&hsp->fb.data_out;
+    assert(!hsp->rq->fb.fd); // must not setup fbuffer twice
+    nxd_fbuffer_init(&hsp->rq->fb, resp->sendfile_fd, resp->sendfile_offset, resp->sendfile_end);
+    resp->content_out=&hsp->rq->fb.data_out;
   }
   else if (resp->sendfile_path && resp->content_length>0) {
     resp->sendfile_fd=open(resp->sendfile_path, O_RDONLY|O_NONBLOCK);
     if (resp->sendfile_fd!=-1) {
       assert(resp->sendfile_end - resp->sendfile_offset == resp->content_length);
-      assert(!hsp->fb.fd); // must not setup fbuffer twice
-      nxd_fbuffer_init(&hsp->fb, resp->sendfile_fd, resp->sendfile_offset, resp->sendfile_end);
-      resp->content_out=&hsp->fb.data_out;
+      assert(!hsp->rq->fb.fd); // must not setup fbuffer twice
+      nxd_fbuffer_init(&hsp->rq->fb, resp->sendfile_fd, resp->sendfile_offset, resp->sendfile_end);
+      resp->content_out=&hsp->rq->fb.data_out;
     }
     else {
       nxweb_log_error("nxd_http_server_proto_start_sending_response(): can't open %s", resp->sendfile_path);
@@ -581,7 +729,7 @@ void nxweb_reset_content_out(nxd_http_server_proto* hsp, nxweb_http_response* re
   resp->content_length=0;
   resp->sendfile_path=0;
   if (resp->sendfile_fd) close(resp->sendfile_fd);
-  if (hsp->fb.fd) nxd_fbuffer_finalize(&hsp->fb);
+  if (hsp->rq->fb.fd) nxd_fbuffer_finalize(&hsp->rq->fb);
   resp->sendfile_fd=0;
   resp->chunked_autoencode=0;
   resp->chunked_encoding=0;
@@ -596,7 +744,7 @@ static void nxd_http_server_proto_start_sending_response(nxd_http_server_proto*
     return;
   }
 
-  nxweb_http_request* req=&hsp->req;
+  nxweb_http_request* req=&hsp->rq->req;
   hsp->resp=resp;
   nxe_loop* loop=hsp->data_in.super.loop;
   nxe_unset_timer(loop, NXWEB_TIMER_READ, &hsp->timer_read);
@@ -655,10 +803,11 @@ static const nxd_http_server_proto_class http_server_proto_class={
   .request_cleanup=request_cleanup
 };
 
-void nxd_http_server_proto_init(nxd_http_server_proto* hsp, nxp_pool* nxb_pool) {
+void nxd_http_server_proto_init(nxd_http_server_proto* hsp, nxp_pool* nxb_pool, nxp_pool* rq_pool) {
   memset(hsp, 0, sizeof(nxd_http_server_proto));
   hsp->cls=&http_server_proto_class;
   hsp->nxb_pool=nxb_pool;
+  hsp->rq_pool=rq_pool;
   hsp->data_in.super.cls.os_cls=&data_in_class;
   hsp->data_out.super.cls.is_cls=&data_out_class;
   hsp->data_out.evt.cls=NXE_EV_STREAM;
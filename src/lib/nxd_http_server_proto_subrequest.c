@@ -35,13 +35,14 @@ static void request_cleanup(nxe_loop* loop, nxd_http_server_proto* hsp) {
   // but perhaps we can free resources earlier here
   // not waiting for parent request to complete
   _nxweb_call_request_finalizers(hsp);
-  nxd_fbuffer_finalize(&hsp->fb);
+  nxd_fbuffer_finalize(&hsp->rq->fb);
   if (hsp->resp && hsp->resp->sendfile_fd) {
     close(hsp->resp->sendfile_fd);
   }
   nxb_empty(hsp->nxb);
   nxp_free(hsp->nxb_pool, hsp->nxb);
   hsp->nxb=0;
+  // request state is kept as parent might still refer to subrequest's req & resp
 }
 
 static void request_complete(nxe_loop* loop, nxd_http_server_proto* hsp) {
@@ -54,12 +55,9 @@ static void subrequest_finalize(nxd_http_server_proto* hsp) {
   _nxweb_call_request_finalizers(hsp);
   nxe_loop* loop=hsp->events_pub.super.loop;
   while (hsp->events_pub.sub) nxe_unsubscribe(&hsp->events_pub, hsp->events_pub.sub);
-  nxd_fbuffer_finalize(&hsp->fb);
+  if (hsp->rq) nxd_fbuffer_finalize(&hsp->rq->fb);
   if (hsp->resp && hsp->resp->sendfile_fd) close(hsp->resp->sendfile_fd);
-  if (hsp->nxb) {
-    nxb_empty(hsp->nxb);
-    nxp_free(hsp->nxb_pool, hsp->nxb);
-  }
+  _nxd_http_server_proto_free_request(hsp);
 }
 
 static void subrequest_start_sending_response(nxd_http_server_proto* hsp, nxweb_http_response* resp) {
@@ -70,7 +68,7 @@ static void subrequest_start_sending_response(nxd_http_server_proto* hsp, nxweb_
 
   nxweb_log_debug("subrequest_start_sending_response");
 
-  nxweb_http_request* req=&hsp->req;
+  nxweb_http_request* req=&hsp->rq->req;
   hsp->resp=resp;
   nxe_loop* loop=hsp->events_pub.super.loop;
   if (!resp->nxb) resp->nxb=hsp->nxb;
@@ -92,11 +90,11 @@ static void subrequest_connect_request_body_out(nxd_http_server_proto* hsp, nxe_
 
   nxweb_log_debug("subrequest_connect_request_body_out");
 
-  nxe_connect_streams(hsp->events_pub.super.loop, &hsp->ob.data_out, is);
+  nxe_connect_streams(hsp->events_pub.super.loop, &hsp->rq->ob.data_out, is);
 }
 
 static nxe_ostream* subrequest_get_request_body_out_pair(nxd_http_server_proto* hsp) {
-  return hsp->ob.data_out.pair;
+  return hsp->rq->ob.data_out.pair;
 }
 
 static void subrequest_start_receiving_request_body(nxd_http_server_proto* hsp) {
@@ -112,10 +110,11 @@ static const nxd_http_server_proto_class subrequest_class={
   .request_cleanup=request_cleanup
 };
 
-void nxd_http_server_proto_subrequest_init(nxd_http_server_proto* hsp, nxp_pool* nxb_pool) {
+void nxd_http_server_proto_subrequest_init(nxd_http_server_proto* hsp, nxp_pool* nxb_pool, nxp_pool* rq_pool) {
   memset(hsp, 0, sizeof(nxd_http_server_proto));
   hsp->cls=&subrequest_class;
   hsp->nxb_pool=nxb_pool;
+  hsp->rq_pool=rq_pool;
   hsp->events_pub.super.cls.pub_cls=NXE_PUB_DEFAULT;
   hsp->state=HSP_WAITING_FOR_REQUEST;
 }
@@ -124,10 +123,9 @@ void nxweb_http_server_proto_subrequest_execute(nxd_http_server_proto* hsp, cons
 
   nxweb_log_debug("nxweb_http_server_proto_subrequest_execute %s %s", host, uri);
 
-  hsp->nxb=nxp_alloc(hsp->nxb_pool);
-  nxb_init(hsp->nxb, NXWEB_CONN_NXB_SIZE);
+  _nxd_http_server_proto_alloc_request(hsp);
   hsp->state=HSP_RECEIVING_HEADERS;
-  nxweb_http_request* req=&hsp->req;
+  nxweb_http_request* req=&hsp->rq->req;
   req->nxb=hsp->nxb;
   req->parent_req=parent_req;
   req->uid=nxweb_generate_unique_id();
@@ -138,6 +136,6 @@ void nxweb_http_server_proto_subrequest_execute(nxd_http_server_proto* hsp, cons
   //req->http_version=;
   req->uri=uri;
   hsp->headers_bytes_received=1;
-  hsp->resp=_nxweb_http_response_init(&hsp->_resp, hsp->nxb, &hsp->req);
+  hsp->resp=_nxweb_http_response_init(&hsp->rq->_resp, hsp->nxb, &hsp->rq->req);
   nxe_publish(&hsp->events_pub, (nxe_data)NXD_HSP_REQUEST_RECEIVED);
 }
@@ -21,7 +21,9 @@
 
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/sendfile.h>
 
 static nxe_size_t sock_data_recv_read(nxe_istream* is, nxe_ostream* os, void* ptr, nxe_size_t size, nxe_flags_t* flags) {
@@ -31,7 +33,7 @@ static nxe_size_t sock_data_recv_read(nxe_istream* is, nxe_ostream* os, void* pt
   nxweb_log_debug("sock_data_recv_read");
 
   if (size>0) {
-    nxe_ssize_t bytes_received=read(fs->fd, ptr, size);
+    nxe_ssize_t bytes_received=fs->uring_io? _nxe_uring_recv(is->super.loop, fs->fd, ptr, size) : read(fs->fd, ptr, size);
     if (bytes_received<0) {
       nxe_istream_unset_ready(is);
       if (errno!=EAGAIN) nxe_publish(&fs->data_error, (nxe_data)NXE_ERROR);
@@ -49,19 +51,60 @@ static nxe_size_t sock_data_recv_read(nxe_istream* is, nxe_ostream* os, void* pt
   return 0;
 }
 
+static nxe_ssize_t sock_data_recv_splice(nxe_istream* is, nxe_ostream* os, int pipe_fd, nxe_size_t size, nxe_flags_t* flags) {
+  nxe_fd_source* fs=(nxe_fd_source*)((char*)is-offsetof(nxe_fd_source, data_is));
+
+  nxweb_log_debug("sock_data_recv_splice");
+
+  if (size>0) {
+    nxe_ssize_t bytes_received=fs->uring_io? _nxe_uring_recv_splice(is->super.loop, fs->fd, pipe_fd, size)
+                                           : splice(fs->fd, 0, pipe_fd, 0, size, SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+    if (bytes_received<0) {
+      nxe_istream_unset_ready(is);
+      if (errno!=EAGAIN) nxe_publish(&fs->data_error, (nxe_data)NXE_ERROR);
+      return 0;
+    }
+    if (bytes_received==0) {
+      nxe_istream_unset_ready(is);
+      nxe_publish(&fs->data_error, (nxe_data)NXE_RDCLOSED);
+      return 0;
+    }
+    // short count does not mean socket is drained (pipe might have run out of slots); keep ready until EAGAIN
+    return bytes_received;
+  }
+  return 0;
+}
+
+static nxe_ssize_t sock_data_send_buffered(nxe_ostream* os, nxe_fd_source* fs, const void* ptr, nxe_size_t size) {
+  nxe_ssize_t bytes_sent=_nxe_uring_send(os->super.loop, fs->fd, ptr, size);
+  if (bytes_sent<0) {
+    nxe_ostream_unset_ready(os);
+    if (errno!=EAGAIN) nxe_publish(&fs->data_error, (nxe_data)NXE_ERROR);
+    return 0;
+  }
+  if (bytes_sent<size) nxe_ostream_unset_ready(os); // send buffer is full
+  return bytes_sent;
+}
+
 static nxe_ssize_t sock_data_send_write(nxe_ostream* os, nxe_istream* is, int sfd, nx_file_reader* fr, nxe_data ptr, nxe_size_t size, nxe_flags_t* flags) {
   nxe_fd_source* fs=(nxe_fd_source*)((char*)os-offsetof(nxe_fd_source, data_os));
 
   nxweb_log_debug("sock_data_send_write");
 
   if (size>0) {
-    nxe_loop* loop=os->super.loop;
     int fd=fs->fd;
-    if (!loop->batch_write_fd) {
-      _nxweb_batch_write_begin(fd);
-      loop->batch_write_fd=fd;
+    nxe_ssize_t bytes_sent;
+    if (fs->uring_io) {
+      if (!sfd) return sock_data_send_buffered(os, fs, ptr.cptr, size);
+      // file/pipe data goes to socket directly; buffered data must go first
+      if (_nxe_uring_send_flush(os->super.loop, fd, 1)) {
+        nxe_ostream_unset_ready(os);
+        if (errno!=EAGAIN) nxe_publish(&fs->data_error, (nxe_data)NXE_ERROR);
+        return 0;
+      }
     }
-    nxe_ssize_t bytes_sent=sfd? sendfile(fd, sfd, &ptr.offs, size) : write(fd, ptr.cptr, size);
+    if (sfd && *flags&NXEF_PIPE) bytes_sent=splice(sfd, 0, fd, 0, size, SPLICE_F_MOVE|SPLICE_F_NONBLOCK|(*flags&NXEF_MORE? SPLICE_F_MORE : 0));
+    else bytes_sent=sfd? sendfile(fd, sfd, &ptr.offs, size) : send(fd, ptr.cptr, size, *flags&NXEF_MORE? MSG_MORE : 0);
     if (bytes_sent<0) {
       nxe_ostream_unset_ready(os);
       if (errno!=EAGAIN) nxe_publish(&fs->data_error, (nxe_data)NXE_ERROR);
@@ -79,18 +122,57 @@ static nxe_ssize_t sock_data_send_write(nxe_ostream* os, nxe_istream* is, int sf
   return 0;
 }
 
+static nxe_ssize_t sock_data_send_write_prefixed(nxe_ostream* os, nxe_istream* is, const void* prefix, nxe_size_t prefix_size, int sfd, nx_file_reader* fr, nxe_data ptr, nxe_size_t size, nxe_flags_t* flags) {
+  nxe_fd_source* fs=(nxe_fd_source*)((char*)os-offsetof(nxe_fd_source, data_os));
+
+  nxweb_log_debug("sock_data_send_write_prefixed");
+
+  if (sfd && size>0) {
+    // prefix goes out with MSG_MORE so kernel merges it with the first file segment
+    nxe_flags_t pflags=*flags|NXEF_MORE;
+    nxe_ssize_t bytes_sent=sock_data_send_write(os, is, 0, 0, (nxe_data)prefix, prefix_size, &pflags);
+    if (bytes_sent<prefix_size) return bytes_sent;
+    return bytes_sent+sock_data_send_write(os, is, sfd, fr, ptr, size, flags);
+  }
+
+  if (fs->uring_io) {
+    nxe_ssize_t bytes_sent=sock_data_send_buffered(os, fs, prefix, prefix_size);
+    if (bytes_sent<prefix_size || !size) return bytes_sent;
+    return bytes_sent+sock_data_send_buffered(os, fs, ptr.ptr, size);
+  }
+
+  struct iovec iov[2]={{(void*)prefix, prefix_size}, {ptr.ptr, size}};
+  struct msghdr msg={.msg_iov=iov, .msg_iovlen=size? 2 : 1};
+  nxe_ssize_t bytes_sent=sendmsg(fs->fd, &msg, *flags&NXEF_MORE? MSG_MORE : 0);
+  if (bytes_sent<0) {
+    nxe_ostream_unset_ready(os);
+    if (errno!=EAGAIN) nxe_publish(&fs->data_error, (nxe_data)NXE_ERROR);
+    return 0;
+  }
+  if (bytes_sent<prefix_size+size) {
+    nxe_ostream_unset_ready(os);
+    if (bytes_sent==0) {
+      nxe_publish(&fs->data_error, (nxe_data)NXE_WRITTEN_NONE);
+      return 0;
+    }
+  }
+  return bytes_sent;
+}
+
 static void sock_data_send_shutdown(nxe_ostream* os) {
   nxe_fd_source* fs=(nxe_fd_source*)((char*)os-offsetof(nxe_fd_source, data_os));
-  shutdown(fs->fd, SHUT_WR);
+  if (fs->uring_io && os->super.loop) _nxe_uring_shutdown(os->super.loop, fs->fd);
+  else shutdown(fs->fd, SHUT_WR);
 }
 
-static const nxe_istream_class sock_data_recv_class={.read=sock_data_recv_read};
+static const nxe_istream_class sock_data_recv_class={.read=sock_data_recv_read, .splice=sock_data_recv_splice};
 static const nxe_ostream_class sock_data_send_class={.write=sock_data_send_write,
-        .shutdown=sock_data_send_shutdown};
+        .write_prefixed=sock_data_send_write_prefixed, .shutdown=sock_data_send_shutdown};
 
 static void socket_shutdown(nxd_socket* sock) {
   //nxweb_log_error("socket_shutdown %p", sock);
-  shutdown(sock->fs.fd, SHUT_WR);
+  if (sock->fs.uring_io && sock->fs.data_is.super.loop) _nxe_uring_shutdown(sock->fs.data_is.super.loop, sock->fs.fd);
+  else shutdown(sock->fs.fd, SHUT_WR);
 }
 
 static const nxd_socket_class socket_class={.shutdown=socket_shutdown, .finalize=nxd_socket_finalize};
@@ -99,6 +181,7 @@ void nxd_socket_init(nxd_socket* ss) {
   memset(ss, 0, sizeof(nxd_socket));
   ss->cls=&socket_class;
   nxe_init_fd_source(&ss->fs, 0, &sock_data_recv_class, &sock_data_send_class, NXE_PUB_DEFAULT);
+  ss->fs.uring_io=1; // used if loop has io_uring backend
 /*
   ss->fs.data_is.super.cls.is_cls=&sock_data_recv_class;
   ss->fs.data_os.super.cls.os_cls=&sock_data_send_class;
@@ -107,9 +190,10 @@ void nxd_socket_init(nxd_socket* ss) {
 }
 
 void nxd_socket_finalize(nxd_socket* ss, int good) {
-  if (ss->fs.data_is.super.loop) nxe_unregister_fd_source(&ss->fs); // this also disconnects streams and unsubscribes subscribers
-  nx_file_reader_finalize(&ss->fr);
+  nxe_loop* loop=ss->fs.data_is.super.loop;
+  if (loop) nxe_unregister_fd_source(&ss->fs); // this also disconnects streams and unsubscribes subscribers
   //nxweb_log_error("nxd_socket_finalize %p %d", ss, good);
-  if (good) _nxweb_close_good_socket(ss->fs.fd);
+  if (loop && ss->fs.uring_io) _nxe_uring_close_socket(loop, ss->fs.fd, good); // waits for buffered data to be sent
+  else if (good) _nxweb_close_good_socket(ss->fs.fd);
   else _nxweb_close_bad_socket(ss->fs.fd);
 }
\ No newline at end of file